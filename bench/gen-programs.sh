@@ -0,0 +1,51 @@
+#!/bin/sh
+# Generate the MU-MIPS benchmark programs into <outdir>.
+#
+# The simulator does not execute branches yet, so the "loop" programs
+# are unrolled straight-line code.  Every program starts by loading the
+# exit code into $v0 and ends with SYSCALL.
+set -e
+out=${1:-bench/out}
+mkdir -p "$out"
+
+gen() {
+	name=$1 count=$2 kind=$3
+	awk -v n="$count" -v kind="$kind" '
+	function r(op, rs, rt, rd, sa, fn) { return sprintf("%08X", op * 67108864 + rs * 2097152 + rt * 65536 + rd * 2048 + sa * 64 + fn) }
+	function i(op, rs, rt, imm) { return sprintf("%08X", op * 67108864 + rs * 2097152 + rt * 65536 + imm) }
+	BEGIN {
+		print i(9, 0, 2, 10)                 # ADDIU $v0, $zero, 10
+		print i(15, 0, 3, 4097)              # LUI   $r3, 0x1001 (data segment)
+		for (k = 0; k < n; k++) {
+			d = 8 + k % 16; s = 8 + (k + 5) % 16; t = 8 + (k + 11) % 16
+			if (kind == "alu") {
+				m = k % 4
+				if (m == 0) print r(0, s, t, d, 0, 33)          # ADDU
+				else if (m == 1) print r(0, s, t, d, 0, 38)     # XOR
+				else if (m == 2) print r(0, 0, t, d, k % 31, 0) # SLL
+				else print i(13, s, d, k % 65536)               # ORI
+			} else if (kind == "mem") {
+				off = (k % 1024) * 4
+				if (k % 2) print i(43, 3, t, off)               # SW
+				else print i(35, 3, d, off)                     # LW
+			} else if (kind == "hazard") {
+				# every instruction consumes the previous result
+				if (k % 3 == 2) print i(35, 3, 9, (k % 1024) * 4)
+				else print r(0, 9, 9, 9, 0, 33)
+			} else {
+				m = k % 8
+				if (m < 4) print r(0, s, t, d, 0, 33)
+				else if (m == 4) print i(35, 3, d, (k % 4096) * 4)
+				else if (m == 5) print i(43, 3, t, (k % 4096) * 4)
+				else if (m == 6) print i(9, s, d, k % 32768)
+				else print r(0, s, t, d, 0, 42)                 # SLT
+			}
+		}
+		print "0000000C"                     # SYSCALL
+	}' > "$out/$name.in"
+}
+
+gen alu-bound 200000 alu
+gen load-store-bound 200000 mem
+gen hazard-dense 200000 hazard
+gen long-loop 1000000 loop
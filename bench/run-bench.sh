@@ -0,0 +1,73 @@
+#!/bin/sh
+# Run the MU-MIPS speed benchmarks against a reference build.
+#
+# usage: run-bench.sh <simulator> <reference simulator> <program dir>
+#
+# Each program is simulated to completion non-interactively (-q -x);
+# small programs are re-run until enough cycles have been simulated to
+# time them.  Host speed varies from machine to machine and from minute
+# to minute, so the reference (a build of the revision in bench/reference
+# or of BENCH_REF, see the Makefile) is timed on the same host in the
+# same run: each of BENCH_RUNS rounds (default 7) runs both, taking turns
+# at going first, and the fastest run of each is kept.  The result is
+# host-ns per simulated cycle and simulated MIPS.  A program more than
+# BENCH_TOLERANCE percent (default 25) slower than the reference gets
+# another BENCH_RUNS rounds, since a burst of host noise can outlast one
+# set, and fails the run if it is still that much slower over all of them.
+set -e
+sim=$1 ref=$2 dir=$3
+tolerance=${BENCH_TOLERANCE:-25}
+runs=${BENCH_RUNS:-7}
+script=$(mktemp)
+results=$(mktemp)
+ref_results=$(mktemp)
+trap 'rm -f "$script" "$results" "$ref_results"' EXIT
+
+# compare the fastest runs so far; prints the row, fails if too slow
+verdict() {
+	awk -F'\t: ' -v name="$name" -v tol="$tolerance" '
+	FNR == 1 { file++ }
+	file == 1 && /^Host ns\/Cycle/ { if (ref == "" || $2 < ref) ref = $2 }
+	file == 2 && /^# Cycles Simulated/ { cycles = $2 }
+	file == 2 && /^# Instructions Simulated/ { instrs = $2 }
+	file == 2 && /^Host ns\/Cycle/ { ns = $2 }
+	file == 2 && /^Simulated MIPS/ { if (nspc == "" || ns < nspc) { nspc = ns; mips = $2 } }
+	END {
+		delta = sprintf("%+.1f%%", (nspc - ref) * 100 / ref)
+		if (nspc > ref * (1 + tol / 100)) { delta = delta " SLOW"; bad = 1 }
+		printf "%-26s %10d %10d %10.2f %10.2f %10.2f %8s\n", name, cycles, instrs, nspc, mips, ref, delta
+		exit bad
+	}' "$ref_results" "$results"
+}
+
+printf '%-26s %10s %10s %10s %10s %10s %8s\n' program cycles instrs ns/cycle sim-MIPS reference delta
+status=0
+for prog in "$dir"/*.in testPipeline1.in testPipelineDataHazards1.in; do
+	name=$(basename "$prog" .in)
+	words=$(wc -l < "$prog")
+	reps=$(( 2000000 / (words + 8) ))
+	[ "$reps" -lt 1 ] && reps=1
+	printf 'repeat %d\nreset\nsim\nend\nstats\n' "$reps" > "$script"
+	: > "$results"
+	: > "$ref_results"
+	i=0
+	while [ "$i" -lt $((2 * runs)) ]; do
+		if [ $((i % 2)) -eq 0 ]; then
+			"$ref" "$prog" -q -x "$script" >> "$ref_results"
+			"$sim" "$prog" -q -x "$script" >> "$results"
+		else
+			"$sim" "$prog" -q -x "$script" >> "$results"
+			"$ref" "$prog" -q -x "$script" >> "$ref_results"
+		fi
+		i=$((i + 1))
+		if [ "$i" -eq "$runs" ] && verdict > /dev/null; then
+			break
+		fi
+	done
+	verdict || status=1
+done
+
+if [ "$status" -ne 0 ]; then
+	echo "speed regression: ns/cycle more than $tolerance% above the reference"
+fi
+exit $status
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/***************************************************************/
+/* Trace-driven cache simulator for MU-MIPS memory traces.           */
+/*                                                                                                               */
+/* usage: mu-mips-cache <trace file> [-j threads] [config ...]        */
+/*                                                                                                               */
+/* Replays the trace written by the simulator's trace command     */
+/* through split L1 instruction and data caches of each             */
+/* configuration <size>:<ways>:<line bytes> (size may end in K or   */
+/* M), LRU, write-back and write-allocate.  Without configurations  */
+/* it sweeps 1K..512K, 1..8 ways and 32/64-byte lines.  Each worker */
+/* thread takes the next configuration; the trace is shared.        */
+/***************************************************************/
+
+#define TRACE_MAGIC "MUTRACE1"
+#define TRACE_FETCH 0
+#define TRACE_LOAD 1
+#define TRACE_STORE 2
+#define MAX_THREADS 256
+
+typedef struct {
+	uint32_t address;
+	uint32_t kind;
+} trace_record_t;
+
+typedef struct {
+	uint32_t sets, ways, line_shift;
+	uint32_t *tags;	/* tag + 1 per way, 0 if invalid */
+	uint64_t *stamps;	/* last use of each way */
+	uint8_t *dirty;
+	uint64_t clock, accesses, misses, writebacks;
+} cache_t;
+
+typedef struct {
+	uint32_t size, ways, line;
+	uint64_t fetches, fetch_misses;
+	uint64_t data_accesses, data_misses, writebacks;
+} config_t;
+
+static trace_record_t *records;
+static uint64_t record_count;
+static config_t *configs;
+static int config_count;
+static int next_config;	/* taken atomically by the workers */
+
+/***************************************************************/
+/* Read the whole trace into memory                                              */
+/***************************************************************/
+static void read_trace(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	char magic[8];
+	long bytes;
+
+	if (fp == NULL) {
+		perror(filename);
+		exit(1);
+	}
+	if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0) {
+		printf("Error: %s is not a MU-MIPS trace\n", filename);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	bytes = ftell(fp) - 8;
+	fseek(fp, 8, SEEK_SET);
+	record_count = bytes / sizeof(trace_record_t);
+	records = malloc((record_count + 1) * sizeof(trace_record_t));
+	if (records == NULL || fread(records, sizeof(trace_record_t), record_count, fp) != record_count) {
+		printf("Error: cannot read %s\n", filename);
+		exit(1);
+	}
+	fclose(fp);
+}
+
+/***************************************************************/
+/* Parse <size>[K|M]:<ways>:<line>; all must be powers of two       */
+/***************************************************************/
+static int parse_config(const char *text, config_t *config) {
+	char *end;
+	unsigned long size, ways, line;
+
+	size = strtoul(text, &end, 10);
+	if (*end == 'K' || *end == 'k') {
+		size <<= 10;
+		end++;
+	} else if (*end == 'M' || *end == 'm') {
+		size <<= 20;
+		end++;
+	}
+	if (*end != ':') {
+		return 0;
+	}
+	ways = strtoul(end + 1, &end, 10);
+	if (*end != ':') {
+		return 0;
+	}
+	line = strtoul(end + 1, &end, 10);
+	if (*end != '\0' || size == 0 || ways == 0 || line < 4 || (size & (size - 1)) != 0
+			|| (ways & (ways - 1)) != 0 || (line & (line - 1)) != 0 || size < ways * line) {
+		return 0;
+	}
+	memset(config, 0, sizeof(*config));
+	config->size = size;
+	config->ways = ways;
+	config->line = line;
+	return 1;
+}
+
+static void cache_init(cache_t *cache, const config_t *config) {
+	memset(cache, 0, sizeof(*cache));
+	cache->ways = config->ways;
+	cache->sets = config->size / (config->ways * config->line);
+	cache->line_shift = __builtin_ctz(config->line);
+	cache->tags = calloc((size_t)cache->sets * cache->ways, sizeof(uint32_t));
+	cache->stamps = calloc((size_t)cache->sets * cache->ways, sizeof(uint64_t));
+	cache->dirty = calloc((size_t)cache->sets * cache->ways, 1);
+	if (cache->tags == NULL || cache->stamps == NULL || cache->dirty == NULL) {
+		printf("Error: out of memory\n");
+		exit(1);
+	}
+}
+
+static void cache_free(cache_t *cache) {
+	free(cache->tags);
+	free(cache->stamps);
+	free(cache->dirty);
+}
+
+/***************************************************************/
+/* One access: a hit refreshes the way, a miss replaces the least */
+/* recently used one, writing it back if dirty                               */
+/***************************************************************/
+static void cache_access(cache_t *cache, uint32_t address, int write) {
+	uint32_t line = address >> cache->line_shift;
+	uint32_t tag = line / cache->sets + 1;
+	size_t base = (size_t)(line & (cache->sets - 1)) * cache->ways, way, victim = base;
+
+	cache->accesses++;
+	cache->clock++;
+	for (way = base; way < base + cache->ways; way++) {
+		if (cache->tags[way] == tag) {
+			cache->stamps[way] = cache->clock;
+			cache->dirty[way] |= write;
+			return;
+		}
+		if (cache->stamps[way] < cache->stamps[victim]) {
+			victim = way;
+		}
+	}
+	cache->misses++;
+	if (cache->tags[victim] != 0 && cache->dirty[victim]) {
+		cache->writebacks++;
+	}
+	cache->tags[victim] = tag;
+	cache->stamps[victim] = cache->clock;
+	cache->dirty[victim] = write;
+}
+
+/***************************************************************/
+/* Worker: replay the trace for configurations until none is left  */
+/***************************************************************/
+static void *worker(void *arg) {
+	cache_t icache, dcache;
+	config_t *config;
+	uint64_t i;
+	int index;
+
+	(void)arg;
+	while ((index = __atomic_fetch_add(&next_config, 1, __ATOMIC_RELAXED)) < config_count) {
+		config = &configs[index];
+		cache_init(&icache, config);
+		cache_init(&dcache, config);
+		for (i = 0; i < record_count; i++) {
+			if (records[i].kind == TRACE_FETCH) {
+				cache_access(&icache, records[i].address, 0);
+			} else {
+				cache_access(&dcache, records[i].address, records[i].kind == TRACE_STORE);
+			}
+		}
+		config->fetches = icache.accesses;
+		config->fetch_misses = icache.misses;
+		config->data_accesses = dcache.accesses;
+		config->data_misses = dcache.misses;
+		config->writebacks = dcache.writebacks;
+		cache_free(&icache);
+		cache_free(&dcache);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[]) {
+	static const uint32_t ways[] = { 1, 2, 4, 8 }, lines[] = { 32, 64 };
+	pthread_t threads[MAX_THREADS];
+	struct timespec start, stop;
+	int threads_count = sysconf(_SC_NPROCESSORS_ONLN), i, w, l, capacity;
+	uint32_t size;
+	uint64_t loads = 0, stores = 0;
+	config_t *config;
+
+	if (argc < 2) {
+		printf("Usage: %s <trace file> [-j threads] [<size>:<ways>:<line> ...]\n", argv[0]);
+		return 1;
+	}
+	read_trace(argv[1]);
+
+	capacity = argc + 10 * 4 * 2;
+	configs = malloc(capacity * sizeof(config_t));
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads_count = atoi(argv[++i]);
+		} else if (!parse_config(argv[i], &configs[config_count++])) {
+			printf("Error: bad configuration %s (expected <size>:<ways>:<line>, powers of two)\n", argv[i]);
+			return 1;
+		}
+	}
+	if (config_count == 0) {
+		for (size = 1024; size <= 512 * 1024; size *= 2) {
+			for (w = 0; w < 4; w++) {
+				for (l = 0; l < 2; l++) {
+					configs[config_count++] = (config_t){ .size = size, .ways = ways[w], .line = lines[l] };
+				}
+			}
+		}
+	}
+	if (threads_count < 1) {
+		threads_count = 1;
+	}
+	if (threads_count > MAX_THREADS) {
+		threads_count = MAX_THREADS;
+	}
+	if (threads_count > config_count) {
+		threads_count = config_count;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < threads_count; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+	for (i = 0; i < threads_count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	for (i = 0; (uint64_t)i < record_count; i++) {
+		loads += records[i].kind == TRACE_LOAD;
+		stores += records[i].kind == TRACE_STORE;
+	}
+	printf("%llu fetches, %llu loads, %llu stores; %d configurations on %d threads in %.3f s\n",
+		(unsigned long long)(record_count - loads - stores), (unsigned long long)loads, (unsigned long long)stores,
+		config_count, threads_count, (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) * 1e-9);
+	printf("%10s %5s %5s %12s %9s %12s %9s %12s\n", "size", "ways", "line",
+		"I-misses", "I-miss%", "D-misses", "D-miss%", "writebacks");
+	for (i = 0; i < config_count; i++) {
+		config = &configs[i];
+		printf("%10u %5u %5u %12llu %8.3f%% %12llu %8.3f%% %12llu\n", config->size, config->ways, config->line,
+			(unsigned long long)config->fetch_misses, config->fetches ? 100.0 * config->fetch_misses / config->fetches : 0.0,
+			(unsigned long long)config->data_misses, config->data_accesses ? 100.0 * config->data_misses / config->data_accesses : 0.0,
+			(unsigned long long)config->writebacks);
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mu-mips-client.h"
+
+/***************************************************************/
+/* Throughput benchmark for the simulation server:                        */
+/* repeatedly load/reset, simulate to completion and rdump.             */
+/***************************************************************/
+static double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	mu_client_t *client;
+	const char *reply;
+	uint64_t cycles = 0, total_cycles = 0;
+	double start, elapsed;
+	int i, runs;
+
+	if (argc < 3) {
+		printf("Usage: %s <socket path> <input program> [runs]\n", argv[0]);
+		return 1;
+	}
+	runs = argc > 3 ? atoi(argv[3]) : 1000;
+
+	client = mu_client_connect(argv[1]);
+	if (client == NULL) {
+		printf("Error: Can't connect to %s\n", argv[1]);
+		return 1;
+	}
+	reply = mu_client_request(client, "load %s", argv[2]);
+	if (!mu_client_ok(reply)) {
+		printf("Error: load failed: %s", reply ? reply : "disconnected\n");
+		return 1;
+	}
+
+	start = now_seconds();
+	for (i = 0; i < runs; i++) {
+		if (!mu_client_ok(mu_client_request(client, "reset")) ||
+				!mu_client_ok(reply = mu_client_request(client, "sim")) ||
+				!mu_client_ok(mu_client_request(client, "rdump"))) {
+			printf("Error: request failed in run %d\n", i);
+			return 1;
+		}
+		mu_client_field(reply, "cycles", &cycles);
+		total_cycles += cycles;
+	}
+	elapsed = now_seconds() - start;
+
+	printf("%d runs (%d requests) in %.3f s\n", runs, 3 * runs, elapsed);
+	printf("%.1f runs/s, %.1f requests/s, %.2f us/request\n",
+		runs / elapsed, 3 * runs / elapsed, elapsed * 1e6 / (3 * runs));
+	printf("%llu simulated cycles, %.2f simulated Mcycles/s\n",
+		(unsigned long long)total_cycles, total_cycles / elapsed / 1e6);
+
+	mu_client_request(client, "quit");
+	mu_client_close(client);
+	return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "mu-mips-client.h"
+
+/***************************************************************/
+/* Connect to a running simulation server                                     */
+/***************************************************************/
+mu_client_t *mu_client_connect(const char *socket_path) {
+	struct sockaddr_un addr;
+	mu_client_t *client;
+	int fd;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return NULL;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	client = calloc(1, sizeof(mu_client_t));
+	client->in = fdopen(fd, "r");
+	client->out = fdopen(dup(fd), "w");
+	return client;
+}
+
+/***************************************************************/
+/* Send one request and wait for its reply (NULL on disconnect) */
+/***************************************************************/
+const char *mu_client_request(mu_client_t *client, const char *format, ...) {
+	va_list args;
+
+	va_start(args, format);
+	vfprintf(client->out, format, args);
+	va_end(args);
+	fputc('\n', client->out);
+	fflush(client->out);
+
+	if (getline(&client->reply, &client->reply_size, client->in) < 0) {
+		return NULL;
+	}
+	return client->reply;
+}
+
+/***************************************************************/
+/* Did the server accept the request?                                            */
+/***************************************************************/
+int mu_client_ok(const char *reply) {
+	return reply != NULL && strncmp(reply, "{\"ok\":true", 10) == 0;
+}
+
+/***************************************************************/
+/* Extract a top-level numeric field from a reply                            */
+/***************************************************************/
+int mu_client_field(const char *reply, const char *name, uint64_t *value) {
+	char key[64];
+	const char *p;
+
+	if (reply == NULL || snprintf(key, sizeof(key), "\"%s\":", name) >= (int)sizeof(key)) {
+		return 0;
+	}
+	p = strstr(reply, key);
+	if (p == NULL) {
+		return 0;
+	}
+	*value = strtoull(p + strlen(key), NULL, 10);
+	return 1;
+}
+
+/***************************************************************/
+/* Disconnect and release the client                                              */
+/***************************************************************/
+void mu_client_close(mu_client_t *client) {
+	if (client == NULL) {
+		return;
+	}
+	fclose(client->in);
+	fclose(client->out);
+	free(client->reply);
+	free(client);
+}
@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include <stdint.h>
+
+/***************************************************************/
+/* Client for the MU-MIPS simulation server (mu-mips -S <path>).  */
+/* Requests are command lines, replies are single JSON lines.      */
+/***************************************************************/
+typedef struct {
+	FILE *in;
+	FILE *out;
+	char *reply;	/* last reply line, owned by the client */
+	size_t reply_size;
+} mu_client_t;
+
+mu_client_t *mu_client_connect(const char *socket_path);
+const char *mu_client_request(mu_client_t *client, const char *format, ...);
+int mu_client_ok(const char *reply);
+int mu_client_field(const char *reply, const char *name, uint64_t *value);
+void mu_client_close(mu_client_t *client);
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/***************************************************************/
+/* Offline SimPoint clustering for MU-MIPS basic-block vectors.     */
+/*                                                                                                               */
+/* usage: mu-mips-simpoint <bbv file> <output prefix> [max k]        */
+/*                                                                                                               */
+/* Reads the .bb file written by the simulator's bbv command,       */
+/* normalizes and randomly projects each interval's vector, runs  */
+/* k-means for k = 1..max k and keeps the smallest k whose BIC     */
+/* score reaches 90% of the best.  Writes <prefix>.simpoints          */
+/* ("interval cluster") and <prefix>.weights ("weight cluster").    */
+/***************************************************************/
+
+#define DIMENSIONS 15
+#define KMEANS_ITERATIONS 100
+#define KMEANS_SEEDS 5
+#define BIC_THRESHOLD 0.9
+
+typedef struct {
+	double v[DIMENSIONS];
+} point_t;
+
+static uint64_t rng_state = 0x853c49e6748fea9bULL;
+
+/***************************************************************/
+/* Deterministic xorshift generator in [0, 1)                                  */
+/***************************************************************/
+static double rng_next() {
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/***************************************************************/
+/* Projection weight of basic block <id> on dimension <d>          */
+/***************************************************************/
+static double projection(uint32_t id, int d) {
+	uint64_t x = ((uint64_t)id << 8 | d) * 0x9E3779B97F4A7C15ULL;
+	x ^= x >> 31;
+	x *= 0xBF58476D1CE4E5B9ULL;
+	x ^= x >> 29;
+	return (x >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
+static double distance2(const point_t *a, const point_t *b) {
+	double sum = 0, diff;
+	int d;
+	for (d = 0; d < DIMENSIONS; d++) {
+		diff = a->v[d] - b->v[d];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+/***************************************************************/
+/* Read and project every interval of a .bb file                         */
+/***************************************************************/
+static point_t *read_bbv(const char *filename, int *count) {
+	FILE *fp;
+	point_t *points = NULL;
+	char *line = NULL, *p;
+	size_t line_size = 0;
+	int capacity = 0, d;
+	unsigned int id;
+	unsigned long long n;
+	double total;
+	int used;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		perror(filename);
+		exit(1);
+	}
+	*count = 0;
+	while (getline(&line, &line_size, fp) >= 0) {
+		if (line[0] != 'T') {
+			continue;
+		}
+		if (*count == capacity) {
+			capacity = capacity ? 2 * capacity : 256;
+			points = realloc(points, capacity * sizeof(point_t));
+		}
+		memset(&points[*count], 0, sizeof(point_t));
+		total = 0;
+		for (p = line + 1; sscanf(p, " :%u:%llu%n", &id, &n, &used) == 2; p += used) {
+			total += n;
+		}
+		for (p = line + 1; total > 0 && sscanf(p, " :%u:%llu%n", &id, &n, &used) == 2; p += used) {
+			for (d = 0; d < DIMENSIONS; d++) {
+				points[*count].v[d] += projection(id, d) * (n / total);
+			}
+		}
+		(*count)++;
+	}
+	free(line);
+	fclose(fp);
+	return points;
+}
+
+/***************************************************************/
+/* k-means with k-means++ seeding; returns the distortion           */
+/***************************************************************/
+static double kmeans(const point_t *points, int count, int k, point_t *centers, int *assign) {
+	double *nearest = malloc(count * sizeof(double));
+	int *sizes = malloc(k * sizeof(int));
+	double sum, pick, best, dist, distortion = 0;
+	int i, c, d, iteration, changed;
+
+	/* k-means++: spread the initial centers out */
+	centers[0] = points[(int)(rng_next() * count)];
+	for (i = 0; i < count; i++) {
+		nearest[i] = distance2(&points[i], &centers[0]);
+	}
+	for (c = 1; c < k; c++) {
+		sum = 0;
+		for (i = 0; i < count; i++) {
+			sum += nearest[i];
+		}
+		pick = rng_next() * sum;
+		for (i = 0; i < count - 1 && (pick -= nearest[i]) > 0; i++);
+		centers[c] = points[i];
+		for (i = 0; i < count; i++) {
+			dist = distance2(&points[i], &centers[c]);
+			if (dist < nearest[i]) {
+				nearest[i] = dist;
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		assign[i] = -1;
+	}
+	for (iteration = 0; iteration < KMEANS_ITERATIONS; iteration++) {
+		changed = 0;
+		for (i = 0; i < count; i++) {
+			best = -1;
+			for (c = 0; c < k; c++) {
+				dist = distance2(&points[i], &centers[c]);
+				if (best < 0 || dist < best) {
+					best = dist;
+					d = c;
+				}
+			}
+			if (assign[i] != d) {
+				assign[i] = d;
+				changed = 1;
+			}
+		}
+		if (!changed) {
+			break;
+		}
+		memset(centers, 0, k * sizeof(point_t));
+		memset(sizes, 0, k * sizeof(int));
+		for (i = 0; i < count; i++) {
+			sizes[assign[i]]++;
+			for (d = 0; d < DIMENSIONS; d++) {
+				centers[assign[i]].v[d] += points[i].v[d];
+			}
+		}
+		for (c = 0; c < k; c++) {
+			for (d = 0; d < DIMENSIONS && sizes[c] > 0; d++) {
+				centers[c].v[d] /= sizes[c];
+			}
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		distortion += distance2(&points[i], &centers[assign[i]]);
+	}
+	free(nearest);
+	free(sizes);
+	return distortion;
+}
+
+/***************************************************************/
+/* Bayesian information criterion of a clustering (X-means form) */
+/***************************************************************/
+static double bic(int count, int k, double distortion, const int *assign) {
+	double variance, log_likelihood = 0, parameters;
+	int *sizes = calloc(k, sizeof(int));
+	int i, c;
+
+	if (count <= k) {
+		free(sizes);
+		return 0;
+	}
+	for (i = 0; i < count; i++) {
+		sizes[assign[i]]++;
+	}
+	variance = distortion / (DIMENSIONS * (double)(count - k));
+	if (variance <= 0) {
+		variance = 1e-300;
+	}
+	for (c = 0; c < k; c++) {
+		if (sizes[c] == 0) {
+			continue;
+		}
+		log_likelihood += sizes[c] * log((double)sizes[c]) - sizes[c] * log((double)count)
+			- sizes[c] * 0.5 * log(2 * M_PI * variance) * DIMENSIONS - (sizes[c] - k) * 0.5;
+	}
+	parameters = (k - 1) + DIMENSIONS * k + 1;
+	free(sizes);
+	return log_likelihood - parameters * 0.5 * log((double)count);
+}
+
+int main(int argc, char *argv[]) {
+	point_t *points, *centers, *best_centers = NULL;
+	int *assign, *best_assign = NULL, *cluster_size;
+	int count, max_k, k, seed, i, c, best_k = 1, chosen;
+	double distortion, best_distortion, score, low = 0, high = 0;
+	double *scores;
+	char filename[1024];
+	FILE *points_fp, *weights_fp;
+
+	if (argc < 3) {
+		printf("Usage: %s <bbv file> <output prefix> [max k]\n", argv[0]);
+		return 1;
+	}
+	max_k = argc > 3 ? atoi(argv[3]) : 10;
+	points = read_bbv(argv[1], &count);
+	if (count == 0) {
+		printf("Error: %s holds no intervals\n", argv[1]);
+		return 1;
+	}
+	if (max_k > count) {
+		max_k = count;
+	}
+	if (max_k < 1) {
+		max_k = 1;
+	}
+
+	centers = malloc(max_k * sizeof(point_t));
+	assign = malloc(count * sizeof(int));
+	scores = malloc((max_k + 1) * sizeof(double));
+	best_centers = malloc((size_t)(max_k + 1) * max_k * sizeof(point_t));
+	best_assign = malloc((size_t)(max_k + 1) * count * sizeof(int));
+
+	/* cluster for every k, keeping the best of several seedings */
+	for (k = 1; k <= max_k; k++) {
+		best_distortion = -1;
+		for (seed = 0; seed < KMEANS_SEEDS; seed++) {
+			distortion = kmeans(points, count, k, centers, assign);
+			if (best_distortion < 0 || distortion < best_distortion) {
+				best_distortion = distortion;
+				memcpy(&best_centers[(size_t)k * max_k], centers, k * sizeof(point_t));
+				memcpy(&best_assign[(size_t)k * count], assign, count * sizeof(int));
+			}
+		}
+		score = bic(count, k, best_distortion, &best_assign[(size_t)k * count]);
+		scores[k] = score;
+		if (k == 1 || score < low) low = score;
+		if (k == 1 || score > high) high = score;
+	}
+	for (k = 1; k <= max_k; k++) {
+		if (scores[k] >= low + BIC_THRESHOLD * (high - low)) {
+			best_k = k;
+			break;
+		}
+	}
+
+	/* the representative of each cluster is the interval nearest its center */
+	snprintf(filename, sizeof(filename), "%s.simpoints", argv[2]);
+	points_fp = fopen(filename, "w");
+	snprintf(filename, sizeof(filename), "%s.weights", argv[2]);
+	weights_fp = fopen(filename, "w");
+	if (points_fp == NULL || weights_fp == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+	cluster_size = calloc(best_k, sizeof(int));
+	memcpy(assign, &best_assign[(size_t)best_k * count], count * sizeof(int));
+	memcpy(centers, &best_centers[(size_t)best_k * max_k], best_k * sizeof(point_t));
+	for (i = 0; i < count; i++) {
+		cluster_size[assign[i]]++;
+	}
+	for (c = 0; c < best_k; c++) {
+		if (cluster_size[c] == 0) {
+			continue;
+		}
+		chosen = -1;
+		for (i = 0; i < count; i++) {
+			if (assign[i] == c && (chosen < 0 ||
+					distance2(&points[i], &centers[c]) < distance2(&points[chosen], &centers[c]))) {
+				chosen = i;
+			}
+		}
+		fprintf(points_fp, "%d %d\n", chosen, c);
+		fprintf(weights_fp, "%.6f %d\n", (double)cluster_size[c] / count, c);
+	}
+	fclose(points_fp);
+	fclose(weights_fp);
+
+	printf("%d intervals, %d clusters chosen (max %d)\n", count, best_k, max_k);
+	printf("wrote %s.simpoints and %s.weights\n", argv[2], argv[2]);
+	return 0;
+}
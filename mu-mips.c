@@ -1,8 +1,25 @@
+#define _GNU_SOURCE	/* memfd_create */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <assert.h>
+#include <math.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include "mu-mips.h"
 
@@ -18,31 +35,85 @@ void help() {
 	printf("reset\t-- clears all registers/memory and re-loads the program\n");
 	printf("input <reg> <val>\t-- set GPR <reg> to <val>\n");
 	printf("mdump <start> <stop>\t-- dump memory from <start> to <stop> address\n");
+	printf("mdump-bin <start> <stop> <file>\t-- write memory <start>..<stop> to a raw binary file\n");
+	printf("mload <addr> <file>\t-- load a raw binary file into memory at <addr>\n");
 	printf("high <val>\t-- set the HI register to <val>\n");
 	printf("low <val>\t-- set the LO register to <val>\n");
 	printf("print\t-- print the program loaded into memory\n");
-	printf("show\t-- print the current content of the pipeline registers\n");
+	printf("show [full|delta]\t-- print the pipeline registers (delta: only latches that changed)\n");
+	printf("assert <reg|hi|lo|pc> <val>\t-- check a register value (scripts)\n");
+	printf("assert mem <addr> <val>\t-- check a memory word (scripts)\n");
+	printf("repeat <n> ... end\t-- repeat the enclosed commands <n> times (scripts)\n");
+	printf("echo <text>\t-- print <text>\n");
+	printf("stats\t-- show simulator speed and syscall statistics\n");
+	printf("sandbox <dir>\t-- let the program open files (syscall 13) below <dir>\n");
+	printf("uart <file>\t-- feed <file> to the memory-mapped UART receiver\n");
+	printf("kernel <file>\t-- load exception handlers at 0x%08x (also -k <file>)\n", EXCEPTION_VECTOR);
+	printf("dram open|closed [banks] [row bytes]\t-- put a DRAM timing model behind MEM (dram off: none)\n");
+	printf("dram timing <tCAS> <tRCD> <tRP> [tBURST]\t-- set the DRAM timing in cycles\n");
+	printf("prefetch next|stride|stream [degree]\t-- prefetch data lines ahead of loads (prefetch off: none)\n");
+	printf("reuse on [line bytes]|off\t-- measure LRU stack distances of fetches and data accesses\n");
+	printf("reuse curve <file>\t-- write the miss ratio of every fully associative cache size\n");
+	printf("trace <file>|off\t-- record fetch, load and store addresses for mu-mips-cache\n");
+	printf("pipeview <file>|off\t-- export each instruction's pipeline stages for Konata\n");
+	printf("interval <cycles> <file>|off\t-- write IPC, stall and memory counters every <cycles> as CSV\n");
+	printf("roi on|off\t-- run only the guest's region of interest (SYSCALL 0x%x..0x%x) in detail;\n"
+		"\t\t   outside it branches are taken, inside the pipeline runs them as NOPs\n", SYS_ROI_BEGIN, SYS_ROI_END);
+	printf("roi restore\t-- restart the pipeline from the guest's last checkpoint (SYSCALL 0x%x)\n", SYS_CHECKPOINT);
+	printf("fuzz <programs> [length] [seed]\t-- check the pipeline against the functional model on random programs\n");
+	printf("gdb <port>|<socket path>\t-- wait for gdb (target remote localhost:<port>) and let it drive the simulator\n");
+	printf("store <dir>|off\t-- share parsed images and memoize quiet sim results in <dir> (also -c <dir>, $MU_MIPS_STORE)\n");
+	printf("store\t-- show store hits\n");
+	printf("profile on|off|reset\t-- control the per-PC/basic-block profiler\n");
+	printf("profile report [n]\t-- print the <n> hottest instructions and blocks\n");
+	printf("profile flame <file>\t-- write a folded-stack profile for flamegraph tools\n");
+	printf("bbv <interval> <file>\t-- run functionally, writing basic-block vectors per <interval> instructions\n");
+	printf("simpoint <points> <weights> <interval> [warmup]\t-- simulate only the chosen intervals in detail\n");
+	printf("parallel <interval> <jobs> [warmup]\t-- simulate intervals in detail on <jobs> worker processes\n");
+	printf("decoupled [model]\t-- run functionally, timing on a second thread (inorder|noforward)\n");
+	printf("sweep <lanes> <reg> <start> <step> [file]\t-- run <lanes> copies in lockstep, lane i with <reg> = <start> + i*<step>\n");
 	printf("?\t-- display help menu\n");
 	printf("quit\t-- exit the simulator\n\n");
 	printf("------------------------------------------------------------------\n\n");
 }
 
+uart_device_t UART = { { "uart", UART_BASE, 1, uart_reset, uart_read, uart_write }, 0, DEVICE_READY, -1 };
+timer_device_t TIMER = { { "timer", TIMER_BASE, 1, timer_reset, timer_read, timer_write } };
+
+mmio_device_t *MMIO_DEVICES[] = { &UART.base, &TIMER.base };
+#define NUM_MMIO_DEVICES (sizeof(MMIO_DEVICES) / sizeof(MMIO_DEVICES[0]))
+
+dram_model_t DRAM_OPEN = { { "open", "open-page DRAM", dram_reset, dram_idle, dram_access, dram_report },
+	TRUE, 8, 2048, 14, 14, 14, 4 };
+dram_model_t DRAM_CLOSED = { { "closed", "closed-page DRAM", dram_reset, dram_idle, dram_access, dram_report },
+	FALSE, 8, 2048, 14, 14, 14, 4 };
+
+memory_model_t *MEMORY_MODELS[] = { &DRAM_OPEN.base, &DRAM_CLOSED.base };
+#define NUM_MEMORY_MODELS (sizeof(MEMORY_MODELS) / sizeof(MEMORY_MODELS[0]))
+
+next_line_prefetcher_t NEXT_LINE_PREFETCHER = { { "next", "next-line", next_line_reset, next_line_observe, 1 } };
+stride_prefetcher_t STRIDE_PREFETCHER = { { "stride", "PC-indexed stride table", stride_reset, stride_observe, 2 } };
+stream_prefetcher_t STREAM_PREFETCHER = { { "stream", "stream buffers", stream_reset, stream_observe, 4 } };
+
+prefetcher_t *PREFETCHERS[] = { &NEXT_LINE_PREFETCHER.base, &STRIDE_PREFETCHER.base, &STREAM_PREFETCHER.base };
+#define NUM_PREFETCHERS (sizeof(PREFETCHERS) / sizeof(PREFETCHERS[0]))
+
 /***************************************************************/
 /* Read a 32-bit word from memory                                                                            */
 /***************************************************************/
 uint32_t mem_read_32(uint32_t address)
 {
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) &&  ( address <= MEM_REGIONS[i].end) ) {
-			uint32_t offset = address - MEM_REGIONS[i].begin;
-			return (MEM_REGIONS[i].mem[offset+3] << 24) |
-					(MEM_REGIONS[i].mem[offset+2] << 16) |
-					(MEM_REGIONS[i].mem[offset+1] <<  8) |
-					(MEM_REGIONS[i].mem[offset+0] <<  0);
-		}
+	uintptr_t entry = PAGE_TABLE[address >> PAGE_SHIFT];
+	uint8_t *mem;
+
+	if (entry & PAGE_HOST_MASK) {
+		mem = (uint8_t *)(entry & PAGE_HOST_MASK) + (address & (MEM_PAGE_SIZE - 1));
+		return (mem[3] << 24) |
+				(mem[2] << 16) |
+				(mem[1] <<  8) |
+				(mem[0] <<  0);
 	}
-	return 0;
+	return mmio_read(entry, address);
 }
 
 /***************************************************************/
@@ -50,17 +121,40 @@ uint32_t mem_read_32(uint32_t address)
 /***************************************************************/
 void mem_write_32(uint32_t address, uint32_t value)
 {
-	int i;
-	uint32_t offset;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
-			offset = address - MEM_REGIONS[i].begin;
+	uintptr_t entry = PAGE_TABLE[address >> PAGE_SHIFT];
+	uint8_t *mem;
+	int region;
+
+	if (entry & PAGE_HOST_MASK) {
+		mem = (uint8_t *)(entry & PAGE_HOST_MASK) + (address & (MEM_PAGE_SIZE - 1));
+		mem[3] = (value >> 24) & 0xFF;
+		mem[2] = (value >> 16) & 0xFF;
+		mem[1] = (value >>  8) & 0xFF;
+		mem[0] = (value >>  0) & 0xFF;
+		region = entry & PAGE_REGION_MASK;
+		mark_dirty(region, address - MEM_REGIONS[region].begin, 4);
+		return;
+	}
+	mmio_write(entry, address, value);
+}
 
-			MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-			MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-			MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-			MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+/***************************************************************/
+/* Record that [offset, offset+length) of a region was written      */
+/***************************************************************/
+void mark_dirty(int region, uint32_t offset, uint32_t length)
+{
+	mem_region_t *mem_region = &MEM_REGIONS[region];
+	uint32_t page = offset / MEM_PAGE_SIZE;
+	uint32_t last = (offset + length - 1) / MEM_PAGE_SIZE;
+	for (; page <= last; page++) {
+		if (mem_region->dirty[page >> 3] & (1 << (page & 7))) {
+			continue;
+		}
+		mem_region->dirty[page >> 3] |= 1 << (page & 7);
+		if (mem_region->dirty_count < DIRTY_LOG_SIZE) {
+			mem_region->dirty_log[mem_region->dirty_count] = page;
 		}
+		mem_region->dirty_count++;
 	}
 }
 
@@ -68,9 +162,93 @@ void mem_write_32(uint32_t address, uint32_t value)
 /* Execute one cycle                                                                                                              */
 /***************************************************************/
 void cycle() {                                                
+	pipeline_latches_t *latches;
+
+	if (PROFILE_ENABLED){
+		profile_cycle();
+	}
 	handle_pipeline();
-	CURRENT_STATE = NEXT_STATE;
+	if (PIPEVIEW_FD >= 0){
+		pipeview_cycle();
+	}
+	if (REDIRECT_PENDING | (CURRENT_STATE.COP0[COP0_STATUS] & (STATUS_IE | STATUS_EXL))){
+		cop0_edge();
+	}
+
+	/* clock edge: the latches just written become current */
+	latches = LATCHES;
+	LATCHES = NEXT_LATCHES;
+	NEXT_LATCHES = latches;
+	if (!QUIET){
+		show_pipeline();
+	}
+	commit_state();
 	CYCLE_COUNT++;
+	if (INTERVAL_CYCLES != 0 && --INTERVAL_LEFT == 0){
+		interval_row();
+	}
+}
+
+/***************************************************************/
+/* Write a register (REG_HI/REG_LO/REG_PC for the others) of the     */
+/* next state; COP0 goes through write_cop0                                                */
+/***************************************************************/
+void write_register(uint32_t reg, uint32_t value) {
+	if (reg == 0){
+		return;	/* $zero */
+	}
+	if (reg < MIPS_REGS){
+		NEXT_STATE.REGS[reg] = value;
+	}else if (reg == REG_HI){
+		NEXT_STATE.HI = value;
+	}else if (reg == REG_LO){
+		NEXT_STATE.LO = value;
+	}else{
+		NEXT_STATE.PC = value;
+	}
+	STATE_DIRTY |= 1ull << reg;
+}
+
+/***************************************************************/
+/* Clock edge for the architectural state: bring the current state  */
+/* up to date with the registers written this cycle                  */
+/***************************************************************/
+void commit_state() {
+	uint64_t dirty = STATE_DIRTY;
+	uint32_t regs = (uint32_t)dirty, reg;
+
+	if (dirty & (1ull << REG_COP0)){
+		memcpy(CURRENT_STATE.COP0, NEXT_STATE.COP0, sizeof(CURRENT_STATE.COP0));
+	}
+	/*fetch writes PC nearly every cycle: copy it unconditionally*/
+	CURRENT_STATE.PC = NEXT_STATE.PC;
+	while (regs != 0){
+		reg = __builtin_ctz(regs);
+		regs &= regs - 1;
+		CURRENT_STATE.REGS[reg] = NEXT_STATE.REGS[reg];
+	}
+	if (dirty & (1ull << REG_HI)){
+		CURRENT_STATE.HI = NEXT_STATE.HI;
+	}
+	if (dirty & (1ull << REG_LO)){
+		CURRENT_STATE.LO = NEXT_STATE.LO;
+	}
+	STATE_DIRTY = 0;
+}
+
+/***************************************************************/
+/* Empty both banks of pipeline latches                                                          */
+/***************************************************************/
+void clear_pipeline() {
+	memset(LATCH_BANK, 0, sizeof(LATCH_BANK));
+	SYSCALL_SEQ = 0;
+}
+
+/***************************************************************/
+/* Is no instruction in any pipeline latch?                                        */
+/***************************************************************/
+int pipeline_empty() {
+	return (ID_IF.seq | IF_EX.seq | EX_MEM.seq | MEM_WB.seq) == 0;
 }
 
 /***************************************************************/
@@ -84,14 +262,21 @@ void run(int num_cycles) {
 	}
 
 	printf("Running simulator for %d cycles...\n\n", num_cycles);
+	uint64_t start_ns = host_time_ns();
+	uint32_t start_cycles = CYCLE_COUNT, start_instructions = INSTRUCTION_COUNT;
 	int i;
 	for (i = 0; i < num_cycles; i++) {
+		if (ROI_OUTSIDE) {
+			roi_fast_forward();
+		}
 		if (RUN_FLAG == FALSE) {
 			printf("Simulation Stopped.\n\n");
 			break;
 		}
 		cycle();
 	}
+	guest_flush();
+	account_host_time(start_ns, start_cycles, start_instructions);
 }
 
 /***************************************************************/
@@ -104,12 +289,118 @@ void runAll() {
 	}
 
 	printf("Simulation Started...\n\n");
-	while (RUN_FLAG){
-		cycle();
+	uint64_t start_ns = host_time_ns();
+	uint32_t start_cycles = CYCLE_COUNT, start_instructions = INSTRUCTION_COUNT;
+	int memo = memo_begin();
+	while (memo != MEMO_HIT && (RUN_FLAG || ROI_OUTSIDE)){
+		if (ROI_OUTSIDE){
+			roi_fast_forward();
+			continue;
+		}
+		while (RUN_FLAG){
+			cycle();
+		}
+	}
+	if (memo == MEMO_RECORD){
+		memo_end();
+	}
+	guest_flush();
+	if (memo != MEMO_HIT){
+		account_host_time(start_ns, start_cycles, start_instructions);
 	}
 	printf("Simulation Finished.\n\n");
 }
 
+/***************************************************************/
+/* Charge a timed run to the host-speed statistics                          */
+/***************************************************************/
+void account_host_time(uint64_t start_ns, uint32_t start_cycles, uint32_t start_instructions) {
+	SIM_HOST_NS += host_time_ns() - start_ns;
+	SIM_CYCLES += CYCLE_COUNT - start_cycles;
+	SIM_INSTRUCTIONS += INSTRUCTION_COUNT - start_instructions;
+}
+
+/***************************************************************/
+/* Dump simulator speed statistics to the terminal                         */
+/***************************************************************/
+void stats() {
+	int i, shown = 0, devices = 0, exceptions = 0;
+
+	printf("-------------------------------------\n");
+	printf("Simulation Statistics\n");
+	printf("-------------------------------------\n");
+	printf("# Cycles Simulated\t: %llu\n", (unsigned long long)SIM_CYCLES);
+	printf("# Instructions Simulated\t: %llu\n", (unsigned long long)SIM_INSTRUCTIONS);
+	printf("Host Time (ns)\t: %llu\n", (unsigned long long)SIM_HOST_NS);
+	printf("Host ns/Cycle\t: %.2f\n", SIM_CYCLES ? (double)SIM_HOST_NS / SIM_CYCLES : 0.0);
+	printf("Simulated MIPS\t: %.3f\n", SIM_HOST_NS ? SIM_INSTRUCTIONS * 1000.0 / SIM_HOST_NS : 0.0);
+	printf("-------------------------------------\n");
+	if (STORE_DIR[0] != '\0'){
+		printf("Store image hits / misses\t: %llu / %llu\n", (unsigned long long)STORE_IMAGE_HITS, (unsigned long long)STORE_IMAGE_MISSES);
+		printf("Memoized runs replayed / stored\t: %llu / %llu\n", (unsigned long long)MEMO_HITS, (unsigned long long)MEMO_STORES);
+		printf("-------------------------------------\n");
+	}
+	if (STATS_RESET_DONE || ROI_FAST_INSTRUCTIONS > 0){
+		if (STATS_RESET_DONE){
+			printf("Cycles since stats reset\t: %u\n", CYCLE_COUNT - STATS_BASE_CYCLES);
+			printf("Instructions since stats reset\t: %u\n", INSTRUCTION_COUNT - STATS_BASE_INSTRUCTIONS);
+			printf("CPI since stats reset\t: %.3f\n", INSTRUCTION_COUNT != STATS_BASE_INSTRUCTIONS ?
+				(double)(CYCLE_COUNT - STATS_BASE_CYCLES) / (INSTRUCTION_COUNT - STATS_BASE_INSTRUCTIONS) : 0.0);
+		}
+		if (ROI_FAST_INSTRUCTIONS > 0){
+			printf("Fast-forwarded instructions\t: %llu\n", (unsigned long long)ROI_FAST_INSTRUCTIONS);
+		}
+		printf("-------------------------------------\n");
+	}
+	for (i = 0; i <= SYS_MAX; i++){
+		if (SYSCALL_COUNTS[i] > 0){
+			printf("Syscall %s\t: %llu\n", i ? SYSCALL_NAMES[i] : "(unknown)", (unsigned long long)SYSCALL_COUNTS[i]);
+			shown++;
+		}
+	}
+	if (shown > 0){
+		printf("Heap break\t: 0x%08x\n", HEAP_BREAK);
+		printf("Exit code\t: %u\n", GUEST_EXIT_CODE);
+		printf("-------------------------------------\n");
+	}
+	for (i = 0; i < EXC_NONE; i++){
+		if (EXCEPTION_COUNTS[i] > 0){
+			printf("Exception %s\t: %llu, %llu handler cycles\n", EXCEPTION_NAMES[i],
+				(unsigned long long)EXCEPTION_COUNTS[i], (unsigned long long)HANDLER_CYCLES[i]);
+			exceptions++;
+		}
+	}
+	if (exceptions > 0){
+		printf("-------------------------------------\n");
+	}
+	for (i = 0; i < NUM_MMIO_DEVICES; i++){
+		if (MMIO_DEVICES[i]->reads + MMIO_DEVICES[i]->writes > 0){
+			printf("Device %s\t: %llu reads, %llu writes\n", MMIO_DEVICES[i]->name,
+				(unsigned long long)MMIO_DEVICES[i]->reads, (unsigned long long)MMIO_DEVICES[i]->writes);
+			devices++;
+		}
+	}
+	if (devices > 0){
+		printf("UART bytes in/out\t: %llu / %llu\n", (unsigned long long)UART.bytes_in, (unsigned long long)UART.bytes_out);
+		printf("Timer expirations\t: %llu\n", (unsigned long long)TIMER.expirations);
+		printf("-------------------------------------\n");
+	}
+	if (MEMORY_MODEL != NULL){
+		printf("Memory model\t: %s (%s)\n", MEMORY_MODEL->name, MEMORY_MODEL->description);
+		printf("MEM stall cycles\t: %llu\n", (unsigned long long)MEMORY_STALLS);
+		MEMORY_MODEL->report(MEMORY_MODEL);
+		printf("-------------------------------------\n");
+	}
+	if (PREFETCHER != NULL){
+		prefetch_report();
+		printf("-------------------------------------\n");
+	}
+	if (REUSE_ENABLED){
+		reuse_report();
+		printf("-------------------------------------\n");
+	}
+}
+
 /***************************************************************/ 
 /* Dump a word-aligned region of memory to the terminal                              */
 /***************************************************************/
@@ -126,6 +417,103 @@ void mdump(uint32_t start, uint32_t stop) {
 	printf("\n");
 }
 
+/***************************************************************/
+/* Find the memory region holding [address, address+length)       */
+/***************************************************************/
+int mem_region_index(uint32_t address, uint32_t length) {
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		if ( (address >= MEM_REGIONS[i].begin) && (address <= MEM_REGIONS[i].end) ) {
+			if (length > 0 && length - 1 > MEM_REGIONS[i].end - address) {
+				return -1;
+			}
+			return i;
+		}
+	}
+	return -1;
+}
+
+/***************************************************************/ 
+/* Dump words [start..stop] to a raw binary file (guest byte order) */
+/***************************************************************/
+int mdump_bin(uint32_t start, uint32_t stop, const char *filename) {
+	uint32_t length;
+	uint8_t *dst;
+	int region, fd;
+
+	if (stop < start || (stop - start) > 0xFFFFFFFBu) {
+		printf("Error: Invalid address range\n");
+		return CMD_ERROR;
+	}
+	length = stop - start + 4;
+	region = mem_region_index(start, length);
+	if (region < 0) {
+		printf("Error: [0x%08x..0x%08x] is not inside one memory region\n", start, stop);
+		return CMD_ERROR;
+	}
+
+	fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(filename);
+		return CMD_ERROR;
+	}
+	/*map the output and copy straight out of the backing store*/
+	if (ftruncate(fd, length) != 0 ||
+			(dst = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror(filename);
+		close(fd);
+		return CMD_ERROR;
+	}
+	memcpy(dst, MEM_REGIONS[region].mem + (start - MEM_REGIONS[region].begin), length);
+	munmap(dst, length);
+	close(fd);
+
+	printf("Dumped %u bytes [0x%08x..0x%08x] to %s\n\n", length, start, start + length - 1, filename);
+	return CMD_OK;
+}
+
+/***************************************************************/ 
+/* Load a raw binary file into memory starting at <address>           */
+/***************************************************************/
+int mload(uint32_t address, const char *filename) {
+	struct stat st;
+	uint8_t *src;
+	uint32_t length;
+	int region, fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		perror(filename);
+		if (fd >= 0) close(fd);
+		return CMD_ERROR;
+	}
+	if (st.st_size == 0 || (uint64_t)st.st_size > 0xFFFFFFFFu) {
+		printf("Error: %s is empty or too large\n", filename);
+		close(fd);
+		return CMD_ERROR;
+	}
+	length = (uint32_t)st.st_size;
+	region = mem_region_index(address, length);
+	if (region < 0) {
+		printf("Error: %u bytes at 0x%08x do not fit in one memory region\n", length, address);
+		close(fd);
+		return CMD_ERROR;
+	}
+
+	src = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (src == MAP_FAILED) {
+		perror(filename);
+		return CMD_ERROR;
+	}
+	memcpy(MEM_REGIONS[region].mem + (address - MEM_REGIONS[region].begin), src, length);
+	mark_dirty(region, address - MEM_REGIONS[region].begin, length);
+	munmap(src, length);
+
+	printf("Loaded %u bytes from %s at 0x%08x\n\n", length, filename, address);
+	return CMD_OK;
+}
+
 /***************************************************************/
 /* Dump current values of registers to the teminal                                              */   
 /***************************************************************/
@@ -150,34 +538,237 @@ void rdump() {
 }
 
 /***************************************************************/
-/* Read a command from standard input.                                                               */  
+/* Split a command line into whitespace separated tokens.             */
+/* Everything after a '#' is treated as a comment.                          */
 /***************************************************************/
-void handle_command() {                         
-	char buffer[20];
+int tokenize_command(char *line, char **argv, int max_args) {
+	int argc = 0;
+	char *token;
+	char *comment;
+
+	comment = strchr(line, '#');
+	if (comment != NULL){
+		*comment = '\0';
+	}
+
+	token = strtok(line, " \t\r\n");
+	while (token != NULL && argc < max_args){
+		argv[argc++] = token;
+		token = strtok(NULL, " \t\r\n");
+	}
+	return argc;
+}
+
+/***************************************************************/
+/* Parse a numeric command argument; returns FALSE if malformed.  */
+/***************************************************************/
+int parse_value(const char *text, int base, uint32_t *value) {
+	char *end;
+	unsigned long parsed;
+
+	if (text == NULL || *text == '\0'){
+		return FALSE;
+	}
+	errno = 0;
+	if (text[0] == '-'){
+		parsed = (unsigned long)strtol(text, &end, base);
+	}else{
+		parsed = strtoul(text, &end, base);
+	}
+	if (errno != 0 || *end != '\0'){
+		return FALSE;
+	}
+	*value = (uint32_t)parsed;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Parse a register name ($r3, r3 or 3) into a register number.      */
+/***************************************************************/
+int parse_register(const char *text, uint32_t *register_no) {
+	if (text[0] == '$'){
+		text++;
+	}
+	if (text[0] == 'r' || text[0] == 'R'){
+		text++;
+	}
+	if (!parse_value(text, 10, register_no) || *register_no >= MIPS_REGS){
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* assert <reg|hi|lo|pc|cycles|instructions> <val>                          */
+/* assert mem <address> <val>                                                          */
+/***************************************************************/
+int assert_command(int argc, char **argv) {
+	uint32_t register_no, address, expected, actual;
+	const char *what = argv[1];
+
+	if (argc == 4 && strcmp(what, "mem") == 0){
+		if (!parse_value(argv[2], 16, &address) || !parse_value(argv[3], 0, &expected)){
+			return CMD_ERROR;
+		}
+		actual = mem_read_32(address);
+	}else if (argc == 3){
+		if (!parse_value(argv[2], 0, &expected)){
+			return CMD_ERROR;
+		}
+		if (strcmp(what, "hi") == 0){
+			actual = CURRENT_STATE.HI;
+		}else if (strcmp(what, "lo") == 0){
+			actual = CURRENT_STATE.LO;
+		}else if (strcmp(what, "pc") == 0){
+			actual = CURRENT_STATE.PC;
+		}else if (strcmp(what, "cycles") == 0){
+			actual = CYCLE_COUNT;
+		}else if (strcmp(what, "instructions") == 0){
+			actual = INSTRUCTION_COUNT;
+		}else if (parse_register(what, &register_no)){
+			actual = CURRENT_STATE.REGS[register_no];
+		}else{
+			return CMD_ERROR;
+		}
+	}else{
+		return CMD_ERROR;
+	}
+
+	if (actual == expected){
+		ASSERT_PASSED++;
+	}else{
+		ASSERT_FAILED++;
+		if (argc == 4){
+			printf("ASSERT FAILED: mem[0x%08x] = 0x%08x, expected 0x%08x\n", address, actual, expected);
+		}else{
+			printf("ASSERT FAILED: %s = 0x%08x, expected 0x%08x\n", what, actual, expected);
+		}
+	}
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* Execute one tokenized command.                                                */
+/***************************************************************/
+int execute_command(int argc, char **argv) {
 	uint32_t start, stop, cycles;
 	uint32_t register_no;
-	int register_value;
-	int hi_reg_value, lo_reg_value;
+	uint32_t register_value;
+	uint32_t hi_reg_value, lo_reg_value;
+	int i;
 
-	printf("MU-MIPS SIM:> ");
+	if (argc == 0){
+		return CMD_OK;
+	}
 
-	if (scanf("%s", buffer) == EOF){
-		exit(0);
+	if (strcmp(argv[0], "assert") == 0){
+		return assert_command(argc, argv);
+	}
+	if (strcmp(argv[0], "mdump-bin") == 0){
+		if (argc != 4 || !parse_value(argv[1], 16, &start) || !parse_value(argv[2], 16, &stop)){
+			return CMD_ERROR;
+		}
+		return mdump_bin(start, stop, argv[3]);
+	}
+	if (strcmp(argv[0], "mload") == 0){
+		if (argc != 3 || !parse_value(argv[1], 16, &start)){
+			return CMD_ERROR;
+		}
+		return mload(start, argv[2]);
+	}
+	if (strcmp(argv[0], "bbv") == 0 || strcmp(argv[0], "simpoint") == 0){
+		return simpoint_command(argc, argv);
+	}
+	if (strcmp(argv[0], "parallel") == 0){
+		return parallel_command(argc, argv);
+	}
+	if (strcmp(argv[0], "decoupled") == 0){
+		return decoupled_command(argc, argv);
+	}
+	if (strcmp(argv[0], "sweep") == 0){
+		return sweep_command(argc, argv);
+	}
+	if (strcmp(argv[0], "sandbox") == 0){
+		if (argc != 2){
+			printf("Usage: sandbox <directory>\n");
+			return CMD_ERROR;
+		}
+		return set_sandbox(argv[1]) ? CMD_OK : CMD_ERROR;
+	}
+	if (strcmp(argv[0], "kernel") == 0){
+		if (argc != 2 || strlen(argv[1]) >= sizeof(kernel_file)){
+			printf("Usage: kernel <file>\n");
+			return CMD_ERROR;
+		}
+		strcpy(kernel_file, argv[1]);
+		load_kernel();
+		return KERNEL_SIZE ? CMD_OK : CMD_ERROR;
+	}
+	if (strcmp(argv[0], "uart") == 0){
+		if (argc != 2){
+			printf("Usage: uart <input file>\n");
+			return CMD_ERROR;
+		}
+		return uart_input(argv[1]) ? CMD_OK : CMD_ERROR;
+	}
+	if (strcmp(argv[0], "dram") == 0){
+		return dram_command(argc, argv);
+	}
+	if (strcmp(argv[0], "prefetch") == 0){
+		return prefetch_command(argc, argv);
+	}
+	if (strcmp(argv[0], "reuse") == 0){
+		return reuse_command(argc, argv);
+	}
+	if (strcmp(argv[0], "trace") == 0){
+		return trace_command(argc, argv);
+	}
+	if (strcmp(argv[0], "pipeview") == 0){
+		return pipeview_command(argc, argv);
+	}
+	if (strcmp(argv[0], "interval") == 0){
+		return interval_command(argc, argv);
+	}
+	if (strcmp(argv[0], "roi") == 0){
+		return roi_command(argc, argv);
+	}
+	if (strcmp(argv[0], "fuzz") == 0){
+		return fuzz_command(argc, argv);
+	}
+	if (strcmp(argv[0], "gdb") == 0){
+		return gdb_command(argc, argv);
+	}
+	if (strcmp(argv[0], "store") == 0){
+		return store_command(argc, argv);
+	}
+	if (strcmp(argv[0], "stats") == 0){
+		stats();
+		return CMD_OK;
+	}
+	if (strcmp(argv[0], "profile") == 0){
+		return profile_command(argc, argv);
+	}
+	if (strcmp(argv[0], "echo") == 0){
+		for (i = 1; i < argc; i++){
+			printf("%s%s", argv[i], (i + 1 < argc) ? " " : "");
+		}
+		printf("\n");
+		return CMD_OK;
 	}
 
-	switch(buffer[0]) {
+	switch(argv[0][0]) {
 		case 'S':
 		case 's':
-			if (buffer[1] == 'h' || buffer[1] == 'H'){
-				show_pipeline();
+			if (argv[0][1] == 'h' || argv[0][1] == 'H'){
+				return show_command(argc, argv);
 			}else {
 				runAll(); 
 			}
 			break;
 		case 'M':
 		case 'm':
-			if (scanf("%x %x", &start, &stop) != 2){
-				break;
+			if (argc != 3 || !parse_value(argv[1], 16, &start) || !parse_value(argv[2], 16, &stop)){
+				return CMD_ERROR;
 			}
 			mdump(start, stop);
 			break;
@@ -186,44 +777,44 @@ void handle_command() {
 			break;
 		case 'Q':
 		case 'q':
-			printf("**************************\n");
-			printf("Exiting MU-MIPS! Good Bye...\n");
-			printf("**************************\n");
-			exit(0);
+			return CMD_QUIT;
 		case 'R':
 		case 'r':
-			if (buffer[1] == 'd' || buffer[1] == 'D'){
+			if (argv[0][1] == 'd' || argv[0][1] == 'D'){
 				rdump();
-			}else if(buffer[1] == 'e' || buffer[1] == 'E'){
+			}else if(argv[0][1] == 'e' || argv[0][1] == 'E'){
 				reset();
 			}
 			else {
-				if (scanf("%d", &cycles) != 1) {
-					break;
+				if (argc != 2 || !parse_value(argv[1], 10, &cycles)) {
+					return CMD_ERROR;
 				}
 				run(cycles);
 			}
 			break;
 		case 'I':
 		case 'i':
-			if (scanf("%u %i", &register_no, &register_value) != 2){
-				break;
+			if (argc != 3 || !parse_value(argv[1], 10, &register_no) || !parse_value(argv[2], 0, &register_value)){
+				return CMD_ERROR;
+			}
+			if (register_no >= MIPS_REGS){
+				return CMD_ERROR;
 			}
 			CURRENT_STATE.REGS[register_no] = register_value;
 			NEXT_STATE.REGS[register_no] = register_value;
 			break;
 		case 'H':
 		case 'h':
-			if (scanf("%i", &hi_reg_value) != 1){
-				break;
+			if (argc != 2 || !parse_value(argv[1], 0, &hi_reg_value)){
+				return CMD_ERROR;
 			}
 			CURRENT_STATE.HI = hi_reg_value; 
 			NEXT_STATE.HI = hi_reg_value; 
 			break;
 		case 'L':
 		case 'l':
-			if (scanf("%i", &lo_reg_value) != 1){
-				break;
+			if (argc != 2 || !parse_value(argv[1], 0, &lo_reg_value)){
+				return CMD_ERROR;
 			}
 			CURRENT_STATE.LO = lo_reg_value;
 			NEXT_STATE.LO = lo_reg_value;
@@ -233,77 +824,527 @@ void handle_command() {
 			print_program(); 
 			break;
 		default:
-			printf("Invalid Command.\n");
-			break;
+			return CMD_ERROR;
 	}
+	return CMD_OK;
 }
 
 /***************************************************************/
-/* reset registers/memory and reload program                                                    */
+/* Leave the simulator, reporting script assertion results.           */
 /***************************************************************/
-void reset() {   
-	int i;
-	/*reset registers*/
-	for (i = 0; i < MIPS_REGS; i++){
-		CURRENT_STATE.REGS[i] = 0;
-	}
-	CURRENT_STATE.HI = 0;
-	CURRENT_STATE.LO = 0;
-	
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		memset(MEM_REGIONS[i].mem, 0, region_size);
+void quit_simulator() {
+	guest_flush();
+	trace_close();
+	pipeview_close();
+	interval_close();
+	if (SCRIPT_MODE){
+		printf("Assertions: %u passed, %u failed\n", ASSERT_PASSED, ASSERT_FAILED);
+		exit(ASSERT_FAILED ? EXIT_ASSERT_FAILED : EXIT_PASS);
 	}
-	
-	/*load program*/
-	load_program();
-	
-	/*reset PC*/
-	INSTRUCTION_COUNT = 0;
-	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
-	NEXT_STATE = CURRENT_STATE;
-	RUN_FLAG = TRUE;
+	printf("**************************\n");
+	printf("Exiting MU-MIPS! Good Bye...\n");
+	printf("**************************\n");
+	exit(EXIT_PASS);
 }
 
 /***************************************************************/
-/* Allocate and set memory to zero                                                                            */
+/* Read a command from standard input.                                                               */  
 /***************************************************************/
-void init_memory() {                                           
-	int i;
-	for (i = 0; i < NUM_MEM_REGION; i++) {
-		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
-		MEM_REGIONS[i].mem = malloc(region_size);
-		memset(MEM_REGIONS[i].mem, 0, region_size);
-	}
-}
+void handle_command() {                         
+	char buffer[CMD_BUFFER_SIZE];
+	char *argv[CMD_MAX_ARGS];
+	int argc;
 
-/**************************************************************/
-/* load program into memory                                                                                      */
-/**************************************************************/
-void load_program() {                   
-	FILE * fp;
-	int i, word;
-	uint32_t address;
+	printf("MU-MIPS SIM:> ");
+	fflush(stdout);
 
-	/* Open program file. */
-	fp = fopen(prog_file, "r");
-	if (fp == NULL) {
-		printf("Error: Can't open program file %s\n", prog_file);
-		exit(-1);
+	if (fgets(buffer, sizeof(buffer), stdin) == NULL){
+		exit(EXIT_PASS);
 	}
 
-	/* Read in the program. */
+	argc = tokenize_command(buffer, argv, CMD_MAX_ARGS);
+	if (argc > 0 && (strcmp(argv[0], "repeat") == 0 || strcmp(argv[0], "end") == 0)){
+		printf("repeat/end are only available in command scripts (-x).\n");
+		return;
+	}
+	switch(execute_command(argc, argv)){
+		case CMD_QUIT:
+			quit_simulator();
+			break;
+		case CMD_ERROR:
+			printf("Invalid Command.\n");
+			break;
+	}
+}
+
+/***************************************************************/
+/* Report a fatal script error and exit.                                            */
+/***************************************************************/
+void script_error(const char *filename, int line, const char *message) {
+	fprintf(stderr, "%s:%d: %s\n", filename, line, message);
+	exit(EXIT_SCRIPT_ERROR);
+}
 
-	i = 0;
-	while( fscanf(fp, "%x\n", &word) != EOF ) {
-		address = MEM_TEXT_BEGIN + i;
-		mem_write_32(address, word);
-		printf("writing 0x%08x into address 0x%08x (%d)\n", word, address, address);
-		i += 4;
+/***************************************************************/
+/* Find the 'end' matching the 'repeat' on line <first>.               */
+/***************************************************************/
+int find_block_end(script_t *script, int first) {
+	int depth = 0;
+	int i;
+
+	for (i = first; i < script->count; i++){
+		if (script->args[i].argc == 0){
+			continue;
+		}
+		if (strcmp(script->args[i].argv[0], "repeat") == 0){
+			depth++;
+		}else if (strcmp(script->args[i].argv[0], "end") == 0){
+			if (--depth == 0){
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+/***************************************************************/
+/* Execute script lines [first, last), expanding repeat blocks.   */
+/***************************************************************/
+void run_script_block(script_t *script, int first, int last, int depth) {
+	script_line_t *line;
+	uint32_t count, n;
+	int i, end;
+
+	for (i = first; i < last; i++){
+		line = &script->args[i];
+		if (line->argc == 0){
+			continue;
+		}
+		if (strcmp(line->argv[0], "repeat") == 0){
+			if (line->argc != 2 || !parse_value(line->argv[1], 0, &count)){
+				script_error(script->filename, i + 1, "usage: repeat <n>");
+			}
+			end = find_block_end(script, i);
+			if (end < 0){
+				script_error(script->filename, i + 1, "repeat without matching end");
+			}
+			if (depth + 1 >= SCRIPT_MAX_DEPTH){
+				script_error(script->filename, i + 1, "repeat nested too deeply");
+			}
+			for (n = 0; n < count; n++){
+				run_script_block(script, i + 1, end, depth + 1);
+			}
+			i = end;
+			continue;
+		}
+		if (strcmp(line->argv[0], "end") == 0){
+			script_error(script->filename, i + 1, "end without matching repeat");
+		}
+		switch(execute_command(line->argc, line->argv)){
+			case CMD_QUIT:
+				quit_simulator();
+				break;
+			case CMD_ERROR:
+				script_error(script->filename, i + 1, "invalid command");
+				break;
+		}
+	}
+}
+
+/***************************************************************/
+/* Run a command script non-interactively, then exit.                     */
+/***************************************************************/
+void run_script(const char *filename) {
+	FILE *fp;
+	script_t script;
+	char buffer[CMD_BUFFER_SIZE];
+	int capacity = 64;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error: Can't open command script %s\n", filename);
+		exit(EXIT_SCRIPT_ERROR);
+	}
+
+	script.filename = filename;
+	script.count = 0;
+	script.args = malloc(capacity * sizeof(script_line_t));
+	while (fgets(buffer, sizeof(buffer), fp) != NULL){
+		if (strchr(buffer, '\n') == NULL && !feof(fp)){
+			script_error(filename, script.count + 1, "line too long");
+		}
+		if (script.count == capacity){
+			capacity *= 2;
+			script.args = realloc(script.args, capacity * sizeof(script_line_t));
+		}
+		script.args[script.count].text = strdup(buffer);
+		script.args[script.count].argc = tokenize_command(script.args[script.count].text,
+			script.args[script.count].argv, CMD_MAX_ARGS);
+		script.count++;
+	}
+	fclose(fp);
+
+	SCRIPT_MODE = TRUE;
+	run_script_block(&script, 0, script.count, 0);
+	quit_simulator();
+}
+
+/***************************************************************/
+/* reset registers/memory and reload program                                                    */
+/***************************************************************/
+void reset() {   
+	int i;
+
+	if (INTERVAL_CYCLES != 0 && CYCLE_COUNT != INTERVAL_BASE.cycle){
+		interval_row();
+	}
+	/*reset registers*/
+	for (i = 0; i < MIPS_REGS; i++){
+		CURRENT_STATE.REGS[i] = 0;
+	}
+	CURRENT_STATE.HI = 0;
+	CURRENT_STATE.LO = 0;
+	memset(CURRENT_STATE.COP0, 0, sizeof(CURRENT_STATE.COP0));
+	memset(EXCEPTION_COUNTS, 0, sizeof(EXCEPTION_COUNTS));
+	memset(HANDLER_CYCLES, 0, sizeof(HANDLER_CYCLES));
+	REDIRECT_PENDING = FALSE;
+	REDIRECT_HOLD = 0;
+	
+	reset_memory();
+	syscall_reset();
+	mmio_reset();
+	if (MEMORY_MODEL != NULL){
+		MEMORY_MODEL->reset(MEMORY_MODEL);
+	}
+	MEMORY_STALLS = 0;
+	prefetch_reset();
+	reuse_reset(&REUSE_DATA);
+	reuse_reset(&REUSE_INST);
+
+	/*empty the pipeline*/
+	clear_pipeline();
+	
+	/*load program*/
+	load_program();
+	load_kernel();
+	
+	/*reset PC*/
+	INSTRUCTION_COUNT = 0;
+	CYCLE_COUNT = 0;
+	FETCH_SEQ = 0;
+	if (PROFILE != NULL){
+		profile_reset();
+	}
+	CURRENT_STATE.PC =  MEM_TEXT_BEGIN;
+	NEXT_STATE = CURRENT_STATE;
+	RUN_FLAG = TRUE;
+	ROI_OUTSIDE = ROI_FAST;
+	ROI_FAST_INSTRUCTIONS = 0;
+	STATS_RESET_DONE = FALSE;
+	if (INTERVAL_CYCLES != 0){
+		interval_start();
+	}
+}
+
+/***************************************************************/
+/* Zero a memory region                                                                                  */
+/***************************************************************/
+void clear_region(int region) {
+	uint32_t region_size = MEM_REGIONS[region].end - MEM_REGIONS[region].begin + 1;
+
+	/*hand the pages back to the kernel; they read back as zero on next touch*/
+	/*a program image mapped over the text would come back on MADV_DONTNEED: map fresh zero pages instead*/
+	if ((region == MEM_TEXT_REGION && TEXT_SHARED_LENGTH > 0) || madvise(MEM_REGIONS[region].mem, region_size, MADV_DONTNEED) != 0){
+		if (map_region(region, MEM_REGIONS[region].mem) == MAP_FAILED) {
+			printf("Error: Can't clear memory region 0x%08x..0x%08x\n", MEM_REGIONS[region].begin, MEM_REGIONS[region].end);
+			exit(-1);
+		}
+	}
+	memset(MEM_REGIONS[region].dirty, 0, region_size / MEM_PAGE_SIZE / 8 + 1);
+	MEM_REGIONS[region].dirty_count = 0;
+	if (region == MEM_TEXT_REGION){
+		TEXT_SHARED_LENGTH = 0;
+	}
+}
+
+/***************************************************************/
+/* Zero all memory regions                                                                            */
+/***************************************************************/
+void clear_memory() {
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		clear_region(i);
+	}
+}
+
+/***************************************************************/
+/* Zero all memory regions but keep a program image mapped over  */
+/* the text: only the pages written since the last clear are undone */
+/***************************************************************/
+void reset_memory() {
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		reset_region(i);
+	}
+}
+
+/***************************************************************/
+/* Undo the writes to a region: zero the few pages written in place  */
+/* (a page of the text image reads back from the image on next      */
+/* touch), or release the whole region if many were written           */
+/***************************************************************/
+void reset_region(int region) {
+	mem_region_t *mem_region = &MEM_REGIONS[region];
+	uint32_t shared = region == MEM_TEXT_REGION ? TEXT_SHARED_LENGTH / MEM_PAGE_SIZE : 0;
+	uint32_t i, page;
+
+	if (mem_region->dirty_count > DIRTY_LOG_SIZE) {
+		clear_region(region);
+		return;
+	}
+	for (i = 0; i < mem_region->dirty_count; i++) {
+		page = mem_region->dirty_log[i];
+		if (page < shared) {
+			if (madvise(mem_region->mem + (size_t)page * MEM_PAGE_SIZE, MEM_PAGE_SIZE, MADV_DONTNEED) != 0) {
+				clear_region(region);
+				return;
+			}
+		}else{
+			memset(mem_region->mem + (size_t)page * MEM_PAGE_SIZE, 0, MEM_PAGE_SIZE);
+		}
+		mem_region->dirty[page >> 3] = 0;
+	}
+	mem_region->dirty_count = 0;
+}
+
+/***************************************************************/
+/* Map zero-filled anonymous memory for a region, at <address> if  */
+/* not NULL; data regions get huge pages as HUGE_PAGES asks             */
+/***************************************************************/
+void *map_region(int region, void *address) {
+	uint32_t region_size = MEM_REGIONS[region].end - MEM_REGIONS[region].begin + 1;
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (address != NULL ? MAP_FIXED : 0);
+	int huge = HUGE_PAGES != HUGE_PAGES_OFF && region != MEM_TEXT_REGION && MEM_REGIONS[region].begin != MEM_KTEXT_BEGIN;
+	void *mem = MAP_FAILED;
+
+	if (huge && HUGE_PAGES == HUGE_PAGES_EXPLICIT) {
+		/*reserved up front: touching an unreserved hugetlb page would raise SIGBUS*/
+		mem = mmap(address, region_size, PROT_READ | PROT_WRITE, (flags & ~MAP_NORESERVE) | MAP_HUGETLB, -1, 0);
+	}
+	if (mem == MAP_FAILED) {
+		/*no hugetlbfs pages reserved: fall back to transparent huge pages*/
+		mem = mmap(address, region_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+		if (mem != MAP_FAILED && huge) {
+			madvise(mem, region_size, MADV_HUGEPAGE);
+		}
+	}
+	return mem;
+}
+
+/***************************************************************/
+/* Allocate and set memory to zero                                                                            */
+/***************************************************************/
+void init_memory() {                                           
+	int i;
+	for (i = 0; i < NUM_MEM_REGION; i++) {
+		uint32_t region_size = MEM_REGIONS[i].end - MEM_REGIONS[i].begin + 1;
+		/*anonymous mappings are zero-filled lazily and can be released again by reset()*/
+		MEM_REGIONS[i].mem = map_region(i, NULL);
+		if (MEM_REGIONS[i].mem == MAP_FAILED) {
+			printf("Error: Can't allocate memory region 0x%08x..0x%08x\n", MEM_REGIONS[i].begin, MEM_REGIONS[i].end);
+			exit(-1);
+		}
+		MEM_REGIONS[i].dirty = calloc(region_size / MEM_PAGE_SIZE / 8 + 1, 1);
+	}
+	map_pages();
+}
+
+/**************************************************************/
+/* Parse a program file into a cached image; NULL if unreadable */
+/**************************************************************/
+program_image_t *load_program_image(const char *filename) {
+	FILE * fp;
+	struct stat st;
+	program_image_t *image, *victim;
+	uint32_t word, capacity;
+	uint64_t hash = 0;
+	int i, mapped = FALSE;
+
+	if (stat(filename, &st) != 0) {
+		return NULL;
+	}
+
+	/* Reuse the parsed image if the file has not changed. */
+	IMAGE_CACHE_CLOCK++;
+	victim = &IMAGE_CACHE[0];
+	for (i = 0; i < IMAGE_CACHE_SIZE; i++) {
+		image = &IMAGE_CACHE[i];
+		if (image->words != NULL && strcmp(image->path, filename) == 0 &&
+				image->dev == (uint64_t)st.st_dev && image->ino == (uint64_t)st.st_ino &&
+				image->mtime == (uint64_t)st.st_mtime && image->size == (uint64_t)st.st_size) {
+			image->last_use = IMAGE_CACHE_CLOCK;
+			IMAGE_CACHE_HITS++;
+			return image;
+		}
+		if (image->last_use < victim->last_use) {
+			victim = image;
+		}
+	}
+	IMAGE_CACHE_MISSES++;
+
+	/* Open program file. */
+	fp = fopen(filename, "r");
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	if (victim == CURRENT_IMAGE) {
+		CURRENT_IMAGE = NULL;
+	}
+	if (victim->mapping != NULL) {
+		munmap(victim->mapping, victim->mapping_size);
+	}else{
+		if (victim->text_fd != 0) {
+			munmap(victim->words, (size_t)victim->count * sizeof(uint32_t));	/* the memfd's */
+		}else{
+			free(victim->words);
+		}
+		free(victim->text);
+	}
+	if (victim->text_fd != 0) {
+		close(victim->text_fd - 1);
+	}
+	memset(victim, 0, sizeof(*victim));
+
+	/* Another run may already have parsed the same bytes into the store. */
+	if (STORE_DIR[0] != '\0') {
+		hash = store_file_hash(fp);
+		mapped = store_image_map(victim, hash);
+	}
+
+	/* Read in the program. */
+	if (!mapped) {
+		capacity = 256;
+		victim->words = malloc(capacity * sizeof(uint32_t));
+		while( fscanf(fp, "%x\n", &word) == 1 ) {
+			if (victim->count == capacity) {
+				capacity *= 2;
+				victim->words = realloc(victim->words, capacity * sizeof(uint32_t));
+			}
+			victim->words[victim->count++] = word;
+		}
+		/*disassembly is filled in lazily by disassemble_pc(), or all at once for the store*/
+		victim->text = calloc((size_t)victim->count + 1, DISASM_TEXT_SIZE);
+		if (STORE_DIR[0] != '\0') {
+			store_image_save(victim, hash);
+		}
+		text_share(victim);
+	}
+	fclose(fp);
+
+	snprintf(victim->path, sizeof(victim->path), "%s", filename);
+	victim->dev = st.st_dev;
+	victim->ino = st.st_ino;
+	victim->mtime = st.st_mtime;
+	victim->size = st.st_size;
+	victim->last_use = IMAGE_CACHE_CLOCK;
+	return victim;
+}
+
+/**************************************************************/
+/* Move a parsed image's words into a sealed memfd, so this process */
+/* and the ones it forks map one copy of them as text                     */
+/**************************************************************/
+void text_share(program_image_t *image) {
+	out_buffer_t out = { (char *)image->words, (size_t)image->count * sizeof(uint32_t), 0 };
+	size_t length = out.length;
+	uint32_t *words;
+	int fd;
+
+	if (image->count == 0) {
+		return;
+	}
+	fd = memfd_create("mu-mips-text", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		return;
+	}
+	out_flush(&out, fd);
+	if (lseek(fd, 0, SEEK_CUR) != (off_t)length ||
+			ftruncate(fd, (length + MEM_PAGE_SIZE - 1) & ~(size_t)(MEM_PAGE_SIZE - 1)) != 0 ||
+			fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE) != 0) {
+		close(fd);
+		return;
+	}
+	words = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+	if (words == MAP_FAILED) {
+		close(fd);
+		return;
+	}
+	free(image->words);
+	image->words = words;
+	image->text_fd = fd + 1;
+	image->text_offset = 0;
+}
+
+/**************************************************************/
+/* Map an image's words over the start of the text region,       */
+/* copy-on-write; FALSE if they have to be copied in instead     */
+/**************************************************************/
+int map_text(const program_image_t *image) {
+	mem_region_t *text = &MEM_REGIONS[MEM_TEXT_REGION];
+	size_t length = ((size_t)image->count * sizeof(uint32_t) + MEM_PAGE_SIZE - 1) & ~(size_t)(MEM_PAGE_SIZE - 1);
+
+	if (TEXT_SHARED_LENGTH > 0 && image == CURRENT_IMAGE) {
+		return TRUE;	/* still mapped: reset_memory() only dropped the written pages */
+	}
+	if (TEXT_SHARED_LENGTH > 0) {
+		clear_region(MEM_TEXT_REGION);
+	}
+	if (image->text_fd == 0 || image->count == 0 || length > (size_t)(text->end - text->begin) + 1 ||
+			sysconf(_SC_PAGESIZE) != MEM_PAGE_SIZE) {
+		return FALSE;
+	}
+	if (mmap(text->mem, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image->text_fd - 1, image->text_offset) == MAP_FAILED) {
+		if (map_region(MEM_TEXT_REGION, text->mem) == MAP_FAILED) {
+			printf("Error: Can't map the text region\n");
+			exit(-1);
+		}
+		return FALSE;
+	}
+	/*the image pages are not marked dirty: checkpoint_save() takes them as such*/
+	TEXT_SHARED_LENGTH = length;
+	return TRUE;
+}
+
+/**************************************************************/
+/* load program into memory                                                                                      */
+/**************************************************************/
+void load_program() {                   
+	program_image_t *image;
+	uint32_t i, address;
+	int shared;
+
+	image = load_program_image(prog_file);
+	if (image == NULL) {
+		printf("Error: Can't open program file %s\n", prog_file);
+		exit(-1);
+	}
+
+	shared = map_text(image);
+	for (i = 0; i < image->count; i++) {
+		address = MEM_TEXT_BEGIN + 4*i;
+		if (!shared){
+			mem_write_32(address, image->words[i]);
+		}
+		if (!QUIET){
+			printf("writing 0x%08x into address 0x%08x (%d)\n", image->words[i], address, address);
+		}
+	}
+	PROGRAM_SIZE = image->count;
+	CURRENT_IMAGE = image;
+	if (!QUIET){
+		printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
 	}
-	PROGRAM_SIZE = i/4;
-	printf("Program loaded into memory.\n%d words written into memory.\n\n", PROGRAM_SIZE);
-	fclose(fp);
 }
 
 /************************************************************/
@@ -313,6 +1354,7 @@ void handle_pipeline()
 {
 	/*INSTRUCTION_COUNT should be incremented when instruction is done*/
 	/*Since we do not have branch/jump instructions, INSTRUCTION_COUNT should be incremented in WB stage */
+	/*Stages read only the current latches/state and write the next ones, so their order does not matter*/
 	
 	WB();
 	MEM();
@@ -326,7 +1368,11 @@ void handle_pipeline()
 /************************************************************/
 void WB()
 {
-	if (CURRENT_STATE.PC < 4194320){
+	if (MEM_WB.seq == 0){
+		return;}
+	if (MEM_WB.exception){
+		report_exception(MEM_WB.exception - 1, MEM_WB.PC - 4, MEM_WB.ALUOutput);
+		RUN_FLAG = FALSE;
 		return;}
 	
 	uint32_t instruction, opcode, function, rt, rd, output, lmd;
@@ -342,66 +1388,69 @@ void WB()
 	if(opcode == 0){
 		switch(function){
 			case 0x00: //SLL
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x02: //SRL
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x03: //SRA 
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x0C: //SYSCALL
-				if(CURRENT_STATE.REGS[2] == 0xa){
-					RUN_FLAG = FALSE;
+				switch(emulate_syscall(&CURRENT_STATE, &output)){
+					case SYSCALL_EXIT:
+						RUN_FLAG = FALSE;
+						break;
+					case SYSCALL_RESULT:
+						write_register(2, output);
+						break;
 				}
 				break;
 			case 0x10: //MFHI
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x11: //MTHI
+				write_register(REG_HI, output);
 				break;
 			case 0x12: //MFLO
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x13: //MTLO
+				write_register(REG_LO, output);
 				break;
 			case 0x18: //MULT
-				NEXT_STATE.REGS[rd] = output;
-				break;
 			case 0x19: //MULTU
-				NEXT_STATE.REGS[rd] = output;
-				break;
 			case 0x1A: //DIV 
-				NEXT_STATE.REGS[rd] = output;
-				break;
 			case 0x1B: //DIVU
-				NEXT_STATE.REGS[rd] = output;
+				write_register(REG_LO, output);
+				write_register(REG_HI, MEM_WB.ALUOutput2);
 				break;
 			case 0x20: //ADD
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x21: //ADDU 
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x22: //SUB
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x23: //SUBU
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x2A: //SLT
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
+				break;
 			case 0x24: //AND
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x25: //OR
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x26: //XOR
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 			case 0x27: //NOR
-				NEXT_STATE.REGS[rd] = output;
+				write_register(rd, output);
 				break;
 		}
 	}
@@ -409,34 +1458,39 @@ void WB()
 		switch(opcode){
 			
 			case 0x08: //ADDI
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
 				break;
 			case 0x09: //ADDIU
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
 				break;
 			case 0x0A: //SLTI
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
 				break;
 			case 0x0F: //LUI
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
 				break;
 			case 0x20: //LB
-				NEXT_STATE.REGS[rt] = lmd;
+				write_register(rt, lmd);
 				break;
 			case 0x21: //LH
-				NEXT_STATE.REGS[rt] = lmd;
+				write_register(rt, lmd);
 				break;
 			case 0x23: //LW
-				NEXT_STATE.REGS[rt] = lmd;
+				write_register(rt, lmd);
 				break;
 			case 0x0E: //XORI
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
 				break;
 			case 0x0C: //ANDI
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
 				break;
 			case 0x0D: //ORI
-				NEXT_STATE.REGS[rt] = output;
+				write_register(rt, output);
+				break;
+			case 0x10: //MFC0
+				if (((instruction >> 21) & 0x1F) == 0x00){
+					write_register(rt, output);
+				}
 				break;
 		}
 		
@@ -449,10 +1503,18 @@ void WB()
 /************************************************************/
 void MEM()
 {
-	if (CURRENT_STATE.PC < 4194316){
+	CPU_Pipeline_Reg *out = &NEXT_LATCHES->mem_wb;
+	uint32_t instruction, opcode, b, alu, output;
+
+	if (EX_MEM.seq == 0){
+		memset(out, 0, sizeof(*out));
+		return;}
+	if (CYCLE_COUNT < EX_MEM.mem_ready){
+		/*waiting on the memory model: EX, ID and IF hold too*/
+		MEMORY_STALLS++;
+		memset(out, 0, sizeof(*out));
 		return;}
 
-	uint32_t instruction, opcode, b, alu, output;
 	instruction = EX_MEM.IR;
 	opcode = (instruction & 0xFC000000) >> 26;
 	b = EX_MEM.B;
@@ -461,28 +1523,48 @@ void MEM()
 	
 	switch(opcode){
 			case 0x20: //LB
-				output = mem_read_32(alu);
+				output = mem_read_32(alu & ~3u);
+				output = (uint32_t)(int32_t)(int8_t)(output >> (8 * (alu & 3)));
 				break;
 			case 0x21: //LH
-				output = mem_read_32(alu);
+				output = mem_read_32(alu & ~3u);
+				output = (uint32_t)(int32_t)(int16_t)(output >> (8 * (alu & 2)));
 				break;
 			case 0x23: //LW
 				output = mem_read_32(alu);
 				break;
 			case 0x28: //SB
-				mem_write_32(alu,b);				
+				output = mem_read_32(alu & ~3u) & ~(0xFFu << (8 * (alu & 3)));
+				mem_write_32(alu & ~3u, output | ((b & 0xFF) << (8 * (alu & 3))));
 				break;
 			case 0x29: //SH
-				mem_write_32(alu,b);				
+				output = mem_read_32(alu & ~3u) & ~(0xFFFFu << (8 * (alu & 2)));
+				mem_write_32(alu & ~3u, output | ((b & 0xFFFF) << (8 * (alu & 2))));
 				break;
 			case 0x2B: //SW
 				mem_write_32(alu,b);				
 				break;
 		}
+	if (opcode >= 0x20){
+		if (REUSE_ENABLED){
+			reuse_access(&REUSE_DATA, alu);
+		}
+		if (TRACE_FILE != NULL){
+			trace_record(alu, opcode >= 0x28 ? TRACE_STORE : TRACE_LOAD);
+		}
+		if (INTERVAL_CYCLES != 0){
+			interval_access(alu, opcode >= 0x28);
+		}
+	}
 
-	MEM_WB.IR = instruction;
-	MEM_WB.ALUOutput = EX_MEM.ALUOutput;
-	MEM_WB.LMD = output;
+	/*only the fields set here are ever non-zero in this latch*/
+	out->IR = instruction;
+	out->PC = EX_MEM.PC;
+	out->seq = EX_MEM.seq;
+	out->ALUOutput = EX_MEM.ALUOutput;
+	out->ALUOutput2 = EX_MEM.ALUOutput2;
+	out->LMD = output;
+	out->exception = EX_MEM.exception;
 	//show_pipeline();
 }
 
@@ -491,10 +1573,16 @@ void MEM()
 /************************************************************/
 void EX()
 {
-	if (CURRENT_STATE.PC < 4194312){
+	CPU_Pipeline_Reg *out = &NEXT_LATCHES->ex_mem;
+	uint32_t instruction, a, b, immediate, opcode, function, output, output2, sa;
+
+	if (CYCLE_COUNT < EX_MEM.mem_ready){
+		*out = EX_MEM;
+		return;}
+	if (IF_EX.seq == 0){
+		memset(out, 0, sizeof(*out));
 		return;}
 
-	uint32_t instruction, a, b, immediate, opcode, function, output, sa;
 	instruction = IF_EX.IR;
 	a = IF_EX.A;
 	b = IF_EX.B;
@@ -502,8 +1590,10 @@ void EX()
 	opcode = (instruction & 0xFC000000) >> 26;
 	function = instruction & 0x0000003F;
 	output = 0;
+	output2 = 0;
 	sa = (instruction & 0x000007C0) >> 6;
 	uint64_t product, p1, p2;
+	uint32_t exception = EXC_NONE;
 	
 if(opcode == 0x00){
 		switch(function){
@@ -514,25 +1604,19 @@ if(opcode == 0x00){
 				output = b >> sa;
 				break;
 			case 0x03: //SRA 
-				if ((b & 0x80000000) == 1)
-				{
-					output =  ~(~b >> sa );
-				}
-				else{
-					output = b >> sa;
-				}
+				output = (uint32_t)((int32_t)b >> sa);
 				break;
 			case 0x10: //MFHI
 				output = CURRENT_STATE.HI;
 				break;
 			case 0x11: //MTHI
-				NEXT_STATE.HI = a;
+				output = a;
 				break;
 			case 0x12: //MFLO
 				output = CURRENT_STATE.LO;
 				break;
 			case 0x13: //MTLO
-				NEXT_STATE.LO = a;
+				output = a;
 				break;
 			case 0x18: //MULT
 				if ((a & 0x80000000) == 0x80000000){
@@ -546,42 +1630,53 @@ if(opcode == 0x00){
 					p2 = 0x00000000FFFFFFFF & b;
 				}
 				product = p1 * p2;
-				EX_MEM.ALUOutput = (product & 0X00000000FFFFFFFF);
-				EX_MEM.ALUOutput2 = (product & 0XFFFFFFFF00000000)>>32;
+				output = (product & 0X00000000FFFFFFFF);
+				output2 = (product & 0XFFFFFFFF00000000)>>32;
 				break;
 			case 0x19: //MULTU
 				product = (uint64_t)a * (uint64_t)b;
-				EX_MEM.ALUOutput = (product & 0X00000000FFFFFFFF);
-				EX_MEM.ALUOutput2 = (product & 0XFFFFFFFF00000000)>>32;
+				output = (product & 0X00000000FFFFFFFF);
+				output2 = (product & 0XFFFFFFFF00000000)>>32;
 				break;
 			case 0x1A: //DIV 
-				if(b != 0)
+				/*undefined results leave HI and LO as they are*/
+				output = CURRENT_STATE.LO;
+				output2 = CURRENT_STATE.HI;
+				if(b != 0 && !(a == 0x80000000 && b == 0xFFFFFFFF))
 				{
-					EX_MEM.ALUOutput = (int32_t)a / (int32_t)b;
-					EX_MEM.ALUOutput2 = (int32_t)a % (int32_t)b;
+					output = (int32_t)a / (int32_t)b;
+					output2 = (int32_t)a % (int32_t)b;
 				}
 				break;
 			case 0x1B: //DIVU
+				output = CURRENT_STATE.LO;
+				output2 = CURRENT_STATE.HI;
 				if(b != 0)
 				{
-					EX_MEM.ALUOutput = a / b;
-					EX_MEM.ALUOutput2 = a % b;
+					output = a / b;
+					output2 = a % b;
 				}
 				break;
 			case 0x20: //ADD
 				output = a + b;
+				if (((a ^ output) & (b ^ output)) >> 31){
+					exception = EXC_OV;
+				}
 				break;
 			case 0x21: //ADDU 
 				output = a + b;
 				break;
 			case 0x22: //SUB
 				output = a - b;
+				if (((a ^ b) & (a ^ output)) >> 31){
+					exception = EXC_OV;
+				}
 				break;
 			case 0x23: //SUBU
 				output = a - b;
 				break;
 			case 0x2A: //SLT
-				if(a < b){
+				if((int32_t)a < (int32_t)b){
 					output = 0x1;
 				}
 				else{
@@ -600,18 +1695,26 @@ if(opcode == 0x00){
 			case 0x27: //NOR
 				output = ~(a | b);
 				break;
+			default:
+				if (!instruction_known(instruction)){
+					exception = EXC_RI;
+				}
+				break;
 		}
 	}
 	else{
 		switch(opcode){
 			case 0x08: //ADDI
 				output = a + immediate;
+				if (((a ^ output) & (immediate ^ output)) >> 31){
+					exception = EXC_OV;
+				}
 				break;
 			case 0x09: //ADDIU
 				output = a + immediate;
 				break;
 			case 0x0A: //SLTI
-				if ( (  (int32_t)a - (int32_t)( (immediate & 0x8000) > 0 ? (immediate | 0xFFFF0000) : (immediate & 0x0000FFFF))) < 0){
+				if ((int32_t)a < (int32_t)immediate){
 					output = 0x1;
 				}else{
 					output = 0x0;
@@ -625,18 +1728,30 @@ if(opcode == 0x00){
 				break;
 			case 0x21: //LH
 				output = a + immediate;
+				if (output & 1){
+					exception = EXC_ADEL;
+				}
 				break;
 			case 0x23: //LW
 				output = a + immediate;
+				if (output & 3){
+					exception = EXC_ADEL;
+				}
 				break;
 			case 0x28: //SB
 				output = a + immediate;				
 				break;
 			case 0x29: //SH
 				output = a + immediate;
+				if (output & 1){
+					exception = EXC_ADES;
+				}
 				break;
 			case 0x2B: //SW
 				output = a + immediate;
+				if (output & 3){
+					exception = EXC_ADES;
+				}
 				break;
 			case 0x0E: //XORI
 				output = a ^ (immediate & 0x0000FFFF);
@@ -647,12 +1762,45 @@ if(opcode == 0x00){
 			case 0x0D: //ORI
 				output = a | (immediate & 0x0000FFFF);
 				break;
+			case 0x10: //COP0
+				if (cop0_mnemonic(instruction) == NULL){
+					exception = EXC_RI;
+				}
+				else if (((instruction >> 21) & 0x1F) == 0x00){ //MFC0
+					output = cop0_read(&CURRENT_STATE, (instruction >> 11) & 0x1F);
+				}
+				else if (((instruction >> 21) & 0x1F) == 0x04){ //MTC0
+					write_cop0((instruction >> 11) & 0x1F, b);
+				}
+				else{ //ERET
+					write_cop0(COP0_STATUS, CURRENT_STATE.COP0[COP0_STATUS] & ~STATUS_EXL);
+					REDIRECT_PC = CURRENT_STATE.COP0[COP0_EPC];
+					REDIRECT_PENDING = TRUE;
+				}
+				break;
+			default:
+				if (!instruction_known(instruction)){
+					exception = EXC_RI;
+				}
+				break;
 		}
 	}
+	if (exception != EXC_NONE){
+		pipeline_exception(exception, output, out);
+		return;
+	}
 	//passing through the pipelined, storing all values in the temporary registers
-	EX_MEM.IR = instruction;
-	EX_MEM.B = b;
-	EX_MEM.ALUOutput = output;
+	out->IR = instruction;
+	out->PC = IF_EX.PC;
+	out->seq = IF_EX.seq;
+	out->B = b;
+	out->ALUOutput = output;
+	out->ALUOutput2 = output2;
+	out->exception = 0;
+	out->mem_ready = 0;
+	if (opcode >= 0x20 && (MEMORY_MODEL != NULL || PREFETCHER != NULL)){
+		out->mem_ready = memory_request(IF_EX.PC - 4, output, opcode >= 0x28);
+	}
 	//show_pipeline();
 }
 
@@ -661,8 +1809,14 @@ if(opcode == 0x00){
 /************************************************************/
 void ID()
 {
+	CPU_Pipeline_Reg *out = &NEXT_LATCHES->if_ex;
 	uint32_t instruction, rs, rt, immediate;
-	if (CURRENT_STATE.PC < 4194308){
+
+	if (CYCLE_COUNT < EX_MEM.mem_ready){
+		*out = IF_EX;
+		return;}
+	if (ID_IF.seq == 0){
+		memset(out, 0, sizeof(*out));
 		return;}
 	instruction = ID_IF.IR;
 	
@@ -676,10 +1830,12 @@ void ID()
 		immediate = immediate + 0xFFFF0000;
 	}
 	
-	IF_EX.A=CURRENT_STATE.REGS[rs];
-	IF_EX.B=CURRENT_STATE.REGS[rt];
-	IF_EX.IR = instruction;
-	IF_EX.imm = immediate;
+	out->A = CURRENT_STATE.REGS[rs];
+	out->B = CURRENT_STATE.REGS[rt];
+	out->IR = instruction;
+	out->PC = ID_IF.PC;
+	out->seq = ID_IF.seq;
+	out->imm = immediate;
 	//show_pipeline();
 }
 
@@ -688,14 +1844,33 @@ void ID()
 /************************************************************/
 void IF()
 {
-	if (ID_IF.IR ==	0xc){
-		show_pipeline();
+	CPU_Pipeline_Reg *out = &NEXT_LATCHES->id_if;
+
+	if (CYCLE_COUNT < EX_MEM.mem_ready){
+		*out = ID_IF;
+		return;}
+	/*a SYSCALL may change $v0 or memory: fetch waits until it writes back*/
+	if (SYSCALL_SEQ != 0){
+		if (MEM_WB.seq == SYSCALL_SEQ){
+			SYSCALL_SEQ = 0;
+		}
+		FETCH_STALLS++;
+		memset(out, 0, sizeof(*out));
 		return;}
-	ID_IF.IR = mem_read_32(CURRENT_STATE.PC);
-	NEXT_STATE.PC = CURRENT_STATE.PC + 4;
-	ID_IF.PC = NEXT_STATE.PC;
+	NEXT_STATE.PC = CURRENT_STATE.PC + 4;	/*commit_state() always copies PC*/
+	out->IR = mem_read_32(CURRENT_STATE.PC);
+	out->PC = CURRENT_STATE.PC + 4;
+	out->seq = ++FETCH_SEQ;
+	if ((out->IR & 0xFC00003F) == 0x0C){
+		SYSCALL_SEQ = FETCH_SEQ;
+	}
+	if (REUSE_ENABLED){
+		reuse_access(&REUSE_INST, CURRENT_STATE.PC);
+	}
+	if (TRACE_FILE != NULL){
+		trace_record(CURRENT_STATE.PC, TRACE_FETCH);
+	}
 	INSTRUCTION_COUNT++;
-	show_pipeline();
 }
 
 
@@ -704,578 +1879,5459 @@ void IF()
 /************************************************************/
 void initialize() { 
 	init_memory();
+	syscall_reset();
+	mmio_reset();
 	CURRENT_STATE.PC = MEM_TEXT_BEGIN;
 	NEXT_STATE = CURRENT_STATE;
 	RUN_FLAG = TRUE;
 }
 
 /************************************************************/
-/* Print the program loaded into memory (in MIPS assembly format)    */ 
+/* Copy <length> guest bytes at <address> into <buffer>; FALSE  */
+/* if the range is not all mapped.                                                   */
 /************************************************************/
-void print_program(){
-	uint32_t instruction, opcode, function, rs, rt, rd, sa, immediate, target;
-	
-	instruction = mem_read_32(CURRENT_STATE.PC);
-	
-	opcode = (instruction & 0xFC000000) >> 26;
-	function = instruction & 0x0000003F;
-	rs = (instruction & 0x03E00000) >> 21;
-	rt = (instruction & 0x001F0000) >> 16;
-	rd = (instruction & 0x0000F800) >> 11;
-	sa = (instruction & 0x000007C0) >> 6;
-	immediate = instruction & 0x0000FFFF;
-	target = instruction & 0x03FFFFFF;
-	int i=0;
-	
-	while (function != 0x0C || opcode !=0x00){
-		opcode = (instruction & 0xFC000000) >> 26;
-		function = instruction & 0x0000003F;
-		rs = (instruction & 0x03E00000) >> 21;
-		rt = (instruction & 0x001F0000) >> 16;
-		rd = (instruction & 0x0000F800) >> 11;
-		sa = (instruction & 0x000007C0) >> 6;
-		immediate = instruction & 0x0000FFFF;
-		target = instruction & 0x03FFFFFF;
-	if(opcode == 0x00){
-		/*R format instructions here*/
-		
-		switch(function){
-			case 0x00:
-				printf("SLL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x02:
-				printf("SRL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x03:
-				printf("SRA $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x08:
-				printf("JR $r%u\n", rs);
-				break;
-			case 0x09:
-				if(rd == 31){
-					printf("JALR $r%u\n", rs);
-				}
-				else{
-					printf("JALR $r%u, $r%u\n", rd, rs);
-				}
-				break;
-			case 0x0C:
-				printf("SYSCALL\n");
-				break;
-			case 0x10:
-				printf("MFHI $r%u\n", rd);
-				break;
-			case 0x11:
-				printf("MTHI $r%u\n", rs);
-				break;
-			case 0x12:
-				printf("MFLO $r%u\n", rd);
-				break;
-			case 0x13:
-				printf("MTLO $r%u\n", rs);
-				break;
-			case 0x18:
-				printf("MULT $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x19:
-				printf("MULTU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1A:
-				printf("DIV $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1B:
-				printf("DIVU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x20:
-				printf("ADD $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x21:
-				printf("ADDU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x22:
-				printf("SUB $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x23:
-				printf("SUBU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x24:
-				printf("AND $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x25:
-				printf("OR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x26:
-				printf("XOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x27:
-				printf("NOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x2A:
-				printf("SLT $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			default:
-				printf("Instruction is not implemented!\n");
-				break;
+int guest_copy_in(char *buffer, uint32_t address, uint32_t length){
+	int region;
+
+	if (length == 0){
+		return TRUE;
+	}
+	region = mem_region_index(address, length);
+	if (region >= 0){
+		memcpy(buffer, MEM_REGIONS[region].mem + (address - MEM_REGIONS[region].begin), length);
+		return TRUE;
+	}
+	for (; length > 0; length--, address++){
+		region = mem_region_index(address, 1);
+		if (region < 0){
+			return FALSE;
 		}
+		*buffer++ = MEM_REGIONS[region].mem[address - MEM_REGIONS[region].begin];
 	}
-	else{
-		switch(opcode){
-			case 0x01:
-				if(rt == 0){
-					printf("BLTZ $r%u, 0x%x\n", rs, immediate<<2);
-				}
-				else if(rt == 1){
-					printf("BGEZ $r%u, 0x%x\n", rs, immediate<<2);
-				}
-				break;
-			case 0x02:
-				printf("J 0x%x\n", (CURRENT_STATE.PC & 0xF0000000) | (target<<2));
-				break;
-			case 0x03:
-				printf("JAL 0x%x\n", (CURRENT_STATE.PC & 0xF0000000) | (target<<2));
-				break;
-			case 0x04:
-				printf("BEQ $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x05:
-				printf("BNE $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x06:
-				printf("BLEZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x07:
-				printf("BGTZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x08:
-				printf("ADDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x09:
-				printf("ADDIU $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0A:
-				printf("SLTI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0C:
-				printf("ANDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0D:
-				printf("ORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0E:
-				printf("XORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0F:
-				printf("LUI $r%u, 0x%x\n", rt, immediate);
-				break;
-			case 0x20:
-				printf("LB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x21:
-				printf("LH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x23:
-				printf("LW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x28:
-				printf("SB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x29:
-				printf("SH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x2B:
-				printf("SW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			default:
-				printf("Instruction is not implemented!\n");
-				break;
+	return TRUE;
+}
+
+/************************************************************/
+/* Copy <buffer> into guest memory at <address>                          */
+/************************************************************/
+int guest_copy_out(uint32_t address, const char *buffer, uint32_t length){
+	int region;
+
+	if (length == 0){
+		return TRUE;
+	}
+	region = mem_region_index(address, length);
+	if (region >= 0){
+		memcpy(MEM_REGIONS[region].mem + (address - MEM_REGIONS[region].begin), buffer, length);
+		mark_dirty(region, address - MEM_REGIONS[region].begin, length);
+		return TRUE;
+	}
+	for (; length > 0; length--, address++){
+		region = mem_region_index(address, 1);
+		if (region < 0){
+			return FALSE;
 		}
+		MEM_REGIONS[region].mem[address - MEM_REGIONS[region].begin] = *buffer++;
+		mark_dirty(region, address - MEM_REGIONS[region].begin, 1);
 	}
-	i++;
-	instruction = mem_read_32(CURRENT_STATE.PC + (4*i));
-	
+	return TRUE;
+}
+
+/************************************************************/
+/* Read a NUL-terminated guest string (truncated to <size> - 1)   */
+/************************************************************/
+int guest_string(uint32_t address, char *buffer, uint32_t size){
+	uint32_t i;
+	int region = -1;
+
+	for (i = 0; i + 1 < size; i++, address++){
+		if (region < 0 || address < MEM_REGIONS[region].begin || address > MEM_REGIONS[region].end){
+			region = mem_region_index(address, 1);
+			if (region < 0){
+				buffer[i] = '\0';
+				return FALSE;
+			}
+		}
+		buffer[i] = MEM_REGIONS[region].mem[address - MEM_REGIONS[region].begin];
+		if (buffer[i] == '\0'){
+			return TRUE;
+		}
 	}
+	buffer[i] = '\0';
+	return TRUE;
 }
 
 /************************************************************/
-/* Print the current pipeline                                                                                    */ 
+/* Console output of the program: stdout is buffered, stderr is  */
+/* written through after flushing it.                                               */
 /************************************************************/
-void show_pipeline(){
-	uint32_t instruction, opcode, function, rs, rt, rd, sa, immediate, target;
-	
-	char if_id[64];
-	char id_ex[64];
-	char *string1 = if_id;
-	char *string2 = id_ex;
-		
-	instruction = ID_IF.IR;
-	opcode = (instruction & 0xFC000000) >> 26;
-	function = instruction & 0x0000003F;
-	rs = (instruction & 0x03E00000) >> 21;
-	rt = (instruction & 0x001F0000) >> 16;
-	rd = (instruction & 0x0000F800) >> 11;
-	sa = (instruction & 0x000007C0) >> 6;
-	immediate = instruction & 0x0000FFFF;
-	target = instruction & 0x03FFFFFF;
-	
-	if(opcode == 0x00){
-		/*R format instructions here*/
-		
-		switch(function){
-			case 0x00:
-				snprintf(if_id,64,"SLL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x02:
-				snprintf(if_id,64,"SRL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x03:
-				snprintf(if_id,64,"SRA $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x08:
-				snprintf(if_id,64,"JR $r%u\n", rs);
-				break;
-			case 0x09:
-				if(rd == 31){
-					snprintf(if_id,64,"JALR $r%u\n", rs);
-				}
-				else{
-					snprintf(if_id,64,"JALR $r%u, $r%u\n", rd, rs);
-				}
-				break;
-			case 0x0C:
-				snprintf(if_id,64,"SYSCALL\n");
-				break;
-			case 0x10:
-				snprintf(if_id,64,"MFHI $r%u\n", rd);
-				break;
-			case 0x11:
-				snprintf(if_id,64,"MTHI $r%u\n", rs);
-				break;
-			case 0x12:
-				snprintf(if_id,64,"MFLO $r%u\n", rd);
-				break;
-			case 0x13:
-				snprintf(if_id,64,"MTLO $r%u\n", rs);
-				break;
-			case 0x18:
-				snprintf(if_id,64,"MULT $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x19:
-				snprintf(if_id,64,"MULTU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1A:
-				snprintf(if_id,64,"DIV $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1B:
-				snprintf(if_id,64,"DIVU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x20:
-				snprintf(if_id,64,"ADD $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x21:
-				snprintf(if_id,64,"ADDU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x22:
-				snprintf(if_id,64,"SUB $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x23:
-				snprintf(if_id,64,"SUBU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x24:
-				snprintf(if_id,64,"AND $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x25:
-				snprintf(if_id,64,"OR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x26:
-				snprintf(if_id,64,"XOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x27:
-				snprintf(if_id,64,"NOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x2A:
-				snprintf(if_id,64,"SLT $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			default:
-				snprintf(if_id,64,"Instruction is not implemented!\n");
-				break;
+void guest_output(int fd, const char *data, uint32_t length){
+	uint32_t record[2] = { fd, length };
+
+	if (MEMO_RECORDING){
+		out_append(&MEMO_OUTPUT, (const char *)record, sizeof(record));
+		out_append(&MEMO_OUTPUT, data, length);
+	}
+	if (GUEST_SILENT){
+		return;
+	}
+	if (fd == 1){
+		out_append(&GUEST_OUTPUT, data, length);
+		if (GUEST_OUTPUT.length >= GUEST_OUTPUT_FLUSH){
+			guest_flush();
 		}
+		return;
 	}
-	else{
-		switch(opcode){
-			case 0x01:
-				if(rt == 0){
-					snprintf(if_id,64,"BLTZ $r%u, 0x%x\n", rs, immediate<<2);
+	guest_flush();
+	fflush(stderr);
+	if (write(STDERR_FILENO, data, length) < 0){
+		perror("write");
+	}
+}
+
+/************************************************************/
+/* Write out buffered console output of the program                    */
+/************************************************************/
+void guest_flush(){
+	if (GUEST_OUTPUT.length > 0){
+		out_flush(&GUEST_OUTPUT, STDOUT_FILENO);
+	}
+}
+
+/************************************************************/
+/* Open <path> (relative, no "..") inside the sandbox directory;   */
+/* returns the guest descriptor or -1.  The path is walked one      */
+/* component at a time without following symlinks, so neither a     */
+/* linked file nor a linked directory leads out of the sandbox.     */
+/************************************************************/
+int guest_open(const char *path, uint32_t flags, uint32_t mode){
+	int i, dir, fd, host_flags;
+	size_t length;
+	char name[256];
+
+	if (SANDBOX_FD < 0 || path[0] == '/' || path[0] == '\0'){
+		return -1;
+	}
+	/*SPIM flags: 0 read, 1 write (create/truncate), 9 append*/
+	switch (flags){
+		case 0: host_flags = O_RDONLY; break;
+		case 1: host_flags = O_WRONLY | O_CREAT | O_TRUNC; break;
+		case 9: host_flags = O_WRONLY | O_CREAT | O_APPEND; break;
+		default: return -1;
+	}
+	for (i = 0; i < GUEST_MAX_FILES && GUEST_FILES[i] != 0; i++);
+	if (i == GUEST_MAX_FILES){
+		return -1;
+	}
+	dir = SANDBOX_FD;
+	fd = -1;
+	for (;;){
+		length = strcspn(path, "/");
+		if (length >= sizeof(name) || (length == 2 && strncmp(path, "..", 2) == 0)){
+			break;
+		}
+		memcpy(name, path, length);
+		name[length] = '\0';
+		path += length;
+		path += strspn(path, "/");
+		if (*path == '\0'){
+			fd = openat(dir, name, host_flags | O_NOFOLLOW | O_CLOEXEC, mode ? mode & 0777 : 0644);
+			break;
+		}
+		fd = openat(dir, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if (dir != SANDBOX_FD){
+			close(dir);
+		}
+		dir = fd;
+		fd = -1;
+		if (dir < 0){
+			return -1;
+		}
+	}
+	if (dir != SANDBOX_FD){
+		close(dir);
+	}
+	if (fd < 0){
+		return -1;
+	}
+	GUEST_FILES[i] = fd + 1;
+	return i + 3;
+}
+
+/************************************************************/
+/* Perform the SPIM service selected by $v0 in <state>.  Returns  */
+/* SYSCALL_RESULT with the new $v0 in <result>, SYSCALL_EXIT, or  */
+/* SYSCALL_DONE.  With GUEST_SILENT (intervals replayed from a     */
+/* checkpoint) nothing touches the host: output is dropped and      */
+/* input reads as end of file.                                                        */
+/************************************************************/
+int emulate_syscall(const CPU_State *state, uint32_t *result){
+	static char *buffer;
+	uint32_t service = state->REGS[2], a0 = state->REGS[4], a1 = state->REGS[5], a2 = state->REGS[6];
+	uint32_t length;
+	ssize_t n;
+	int fd, c;
+	char text[32];
+
+	if (buffer == NULL){
+		buffer = malloc(GUEST_MAX_STRING);
+	}
+	if (service >= SYS_ROI_BEGIN && service <= SYS_CHECKPOINT){
+		magic_syscall(state, service);
+		return SYSCALL_DONE;
+	}
+	SYSCALL_COUNTS[(service <= SYS_MAX && SYSCALL_NAMES[service] != NULL) ? service : 0]++;
+	if (service == SYS_READ_INT || service == SYS_READ_STRING || service == SYS_READ_CHAR || service == SYS_OPEN ||
+			service == SYS_READ || service == SYS_CLOSE || (service == SYS_WRITE && a0 != 1 && a0 != 2)){
+		MEMO_TAINTED = TRUE;	/* depends on the host: not memoized */
+	}
+	switch (service){
+		case SYS_PRINT_INT:
+			length = snprintf(text, sizeof(text), "%d", (int32_t)a0);
+			guest_output(1, text, length);
+			return SYSCALL_DONE;
+		case SYS_PRINT_STRING:
+			guest_string(a0, buffer, GUEST_MAX_STRING);
+			guest_output(1, buffer, strlen(buffer));
+			return SYSCALL_DONE;
+		case SYS_PRINT_CHAR:
+			text[0] = (char)a0;
+			guest_output(1, text, 1);
+			return SYSCALL_DONE;
+		case SYS_READ_INT:
+			*result = 0;
+			guest_flush();
+			if (!GUEST_SILENT && fgets(text, sizeof(text), stdin) != NULL){
+				*result = (uint32_t)strtol(text, NULL, 0);
+			}
+			return SYSCALL_RESULT;
+		case SYS_READ_STRING:
+			/*like fgets: at most a1 - 1 characters, newline kept, always terminated*/
+			if ((int32_t)a1 <= 0){
+				return SYSCALL_DONE;
+			}
+			length = a1 < GUEST_MAX_STRING ? a1 : GUEST_MAX_STRING;
+			guest_flush();
+			if (GUEST_SILENT || fgets(buffer, length, stdin) == NULL){
+				buffer[0] = '\0';
+			}
+			guest_copy_out(a0, buffer, strlen(buffer) + 1);
+			return SYSCALL_DONE;
+		case SYS_READ_CHAR:
+			guest_flush();
+			c = GUEST_SILENT ? EOF : getchar();
+			*result = (c == EOF) ? 0 : (uint32_t)c;
+			return SYSCALL_RESULT;
+		case SYS_SBRK:
+			/*word-align the break; the old break is the new block*/
+			*result = HEAP_BREAK;
+			length = (a0 + 3) & ~3u;
+			if ((int32_t)a0 < 0 || length > MEM_HEAP_END - HEAP_BREAK){
+				*result = 0;
+				return SYSCALL_RESULT;
+			}
+			HEAP_BREAK += length;
+			return SYSCALL_RESULT;
+		case SYS_EXIT:
+			GUEST_EXIT_CODE = 0;
+			guest_flush();
+			return SYSCALL_EXIT;
+		case SYS_EXIT2:
+			GUEST_EXIT_CODE = a0;
+			guest_flush();
+			return SYSCALL_EXIT;
+		case SYS_OPEN:
+			*result = (uint32_t)-1;
+			if (!GUEST_SILENT && guest_string(a0, buffer, GUEST_MAX_STRING)){
+				*result = (uint32_t)guest_open(buffer, a1, a2);
+			}
+			return SYSCALL_RESULT;
+		case SYS_READ:
+			*result = (uint32_t)-1;
+			length = a2 < GUEST_MAX_STRING ? a2 : GUEST_MAX_STRING;
+			if (GUEST_SILENT){
+				*result = 0;
+			}else if (a0 == 0){
+				guest_flush();
+				n = read(STDIN_FILENO, buffer, length);
+				if (n >= 0 && guest_copy_out(a1, buffer, n)){
+					*result = n;
 				}
-				else if(rt == 1){
-					snprintf(if_id,64,"BGEZ $r%u, 0x%x\n", rs, immediate<<2);
+			}else if (a0 >= 3 && a0 - 3 < GUEST_MAX_FILES && GUEST_FILES[a0 - 3] != 0){
+				n = read(GUEST_FILES[a0 - 3] - 1, buffer, length);
+				if (n >= 0 && guest_copy_out(a1, buffer, n)){
+					*result = n;
 				}
-				break;
-			case 0x02:
-				snprintf(if_id,64,"J 0x%x\n", (CURRENT_STATE.PC & 0xF0000000) | (target<<2));
-				break;
-			case 0x03:
-				snprintf(if_id,64,"JAL 0x%x\n", (CURRENT_STATE.PC & 0xF0000000) | (target<<2));
-				break;
-			case 0x04:
-				snprintf(if_id,64,"BEQ $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x05:
-				snprintf(if_id,64,"BNE $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x06:
-				snprintf(if_id,64,"BLEZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x07:
-				snprintf(if_id,64,"BGTZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x08:
-				snprintf(if_id,64,"ADDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x09:
-				snprintf(if_id,64,"ADDIU $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0A:
-				snprintf(if_id,64,"SLTI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0C:
-				snprintf(if_id,64,"ANDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0D:
-				snprintf(if_id,64,"ORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0E:
-				snprintf(if_id,64,"XORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0F:
-				snprintf(if_id,64,"LUI $r%u, 0x%x\n", rt, immediate);
-				break;
-			case 0x20:
-				snprintf(if_id,64,"LB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x21:
-				snprintf(if_id,64,"LH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x23:
-				snprintf(if_id,64,"LW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x28:
-				snprintf(if_id,64,"SB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x29:
-				snprintf(if_id,64,"SH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x2B:
-				snprintf(if_id,64,"SW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			default:
-				snprintf(if_id,64,"Instruction is not implemented!\n");
-				break;
+			}
+			return SYSCALL_RESULT;
+		case SYS_WRITE:
+			*result = (uint32_t)-1;
+			length = a2 < GUEST_MAX_STRING ? a2 : GUEST_MAX_STRING;
+			if (!guest_copy_in(buffer, a1, length)){
+				return SYSCALL_RESULT;
+			}
+			if (a0 == 1 || a0 == 2){
+				guest_output(a0, buffer, length);
+				*result = length;
+			}else if (GUEST_SILENT){
+				*result = length;
+			}else if (a0 >= 3 && a0 - 3 < GUEST_MAX_FILES && GUEST_FILES[a0 - 3] != 0){
+				n = write(GUEST_FILES[a0 - 3] - 1, buffer, length);
+				if (n >= 0){
+					*result = n;
+				}
+			}
+			return SYSCALL_RESULT;
+		case SYS_CLOSE:
+			fd = (int)a0 - 3;
+			if (!GUEST_SILENT && fd >= 0 && fd < GUEST_MAX_FILES && GUEST_FILES[fd] != 0){
+				close(GUEST_FILES[fd] - 1);
+				GUEST_FILES[fd] = 0;
+			}
+			return SYSCALL_DONE;
+		default:
+			return SYSCALL_DONE;
+	}
+}
+
+/************************************************************/
+/* Forget the heap, open files and counters of the last run            */
+/************************************************************/
+void syscall_reset(){
+	int i;
+
+	guest_flush();
+	for (i = 0; i < GUEST_MAX_FILES; i++){
+		if (GUEST_FILES[i] != 0){
+			close(GUEST_FILES[i] - 1);
+			GUEST_FILES[i] = 0;
+		}
+	}
+	memset(SYSCALL_COUNTS, 0, sizeof(SYSCALL_COUNTS));
+	HEAP_BREAK = MEM_HEAP_BEGIN;
+	GUEST_EXIT_CODE = 0;
+}
+
+/************************************************************/
+/* Let the program open files below <directory>                            */
+/************************************************************/
+int set_sandbox(const char *directory){
+	int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0){
+		perror(directory);
+		return FALSE;
+	}
+	if (SANDBOX_FD >= 0){
+		close(SANDBOX_FD);
+	}
+	SANDBOX_FD = fd;
+	return TRUE;
+}
+
+/************************************************************/
+/* Fill the page table: every RAM page, then the device pages       */
+/* over the top of KDATA                                                                     */
+/************************************************************/
+void map_pages(){
+	uint32_t page, last, i;
+
+	for (i = 0; i < NUM_MEM_REGION; i++){
+		last = MEM_REGIONS[i].end >> PAGE_SHIFT;
+		for (page = MEM_REGIONS[i].begin >> PAGE_SHIFT; page <= last; page++){
+			PAGE_TABLE[page] = (uintptr_t)(MEM_REGIONS[i].mem + ((page << PAGE_SHIFT) - MEM_REGIONS[i].begin)) | i;
+		}
+	}
+	for (i = 0; i < NUM_MMIO_DEVICES; i++){
+		for (page = 0; page < MMIO_DEVICES[i]->pages; page++){
+			PAGE_TABLE[(MMIO_DEVICES[i]->base >> PAGE_SHIFT) + page] = PAGE_DEVICE | i;
+		}
+	}
+}
+
+/************************************************************/
+/* Word read/write of a device page (entry from PAGE_TABLE);        */
+/* unmapped pages read as zero and ignore writes                        */
+/************************************************************/
+uint32_t mmio_read(uintptr_t entry, uint32_t address){
+	mmio_device_t *device;
+
+	if (!(entry & PAGE_DEVICE)){
+		return 0;
+	}
+	device = MMIO_DEVICES[entry & ~(uintptr_t)PAGE_DEVICE];
+	device->reads++;
+	MEMO_TAINTED = TRUE;
+	return device->read(device, (address - device->base) & ~3u);
+}
+
+void mmio_write(uintptr_t entry, uint32_t address, uint32_t value){
+	mmio_device_t *device;
+
+	if (!(entry & PAGE_DEVICE)){
+		return;
+	}
+	device = MMIO_DEVICES[entry & ~(uintptr_t)PAGE_DEVICE];
+	device->writes++;
+	MEMO_TAINTED = TRUE;
+	device->write(device, (address - device->base) & ~3u, value);
+}
+
+/************************************************************/
+/* Put every device back in its power-on state                             */
+/************************************************************/
+void mmio_reset(){
+	uint32_t i;
+
+	for (i = 0; i < NUM_MMIO_DEVICES; i++){
+		MMIO_DEVICES[i]->reads = 0;
+		MMIO_DEVICES[i]->writes = 0;
+		MMIO_DEVICES[i]->reset(MMIO_DEVICES[i]);
+	}
+}
+
+/************************************************************/
+/* UART: transmitted bytes join the program's console output;      */
+/* received bytes come from the file given to "uart", if any          */
+/************************************************************/
+void uart_reset(mmio_device_t *device){
+	uart_device_t *uart = (uart_device_t *)device;
+
+	uart->rx_control = 0;
+	uart->tx_control = DEVICE_READY;
+	uart->bytes_in = 0;
+	uart->bytes_out = 0;
+	if (uart->input_fd >= 0){
+		lseek(uart->input_fd, 0, SEEK_SET);
+	}
+	uart->input_next = 0;
+	uart->input_length = 0;
+}
+
+/************************************************************/
+/* Make sure a received byte is waiting if the input has one          */
+/************************************************************/
+int uart_fill(uart_device_t *uart){
+	ssize_t n;
+
+	if (uart->input_next < uart->input_length){
+		return TRUE;
+	}
+	if (uart->input_fd < 0 || GUEST_SILENT){
+		return FALSE;
+	}
+	n = read(uart->input_fd, uart->input, sizeof(uart->input));
+	if (n <= 0){
+		return FALSE;
+	}
+	uart->input_next = 0;
+	uart->input_length = n;
+	return TRUE;
+}
+
+uint32_t uart_read(mmio_device_t *device, uint32_t offset){
+	uart_device_t *uart = (uart_device_t *)device;
+
+	switch (offset){
+		case UART_RX_CONTROL:
+			return (uart->rx_control & DEVICE_INTERRUPT_ENABLE) | (uart_fill(uart) ? DEVICE_READY : 0);
+		case UART_RX_DATA:
+			if (!uart_fill(uart)){
+				return 0;
+			}
+			uart->bytes_in++;
+			return uart->input[uart->input_next++];
+		case UART_TX_CONTROL:
+			return uart->tx_control;
+		default:
+			return 0;
+	}
+}
+
+void uart_write(mmio_device_t *device, uint32_t offset, uint32_t value){
+	uart_device_t *uart = (uart_device_t *)device;
+	char c = (char)value;
+
+	switch (offset){
+		case UART_RX_CONTROL:
+			uart->rx_control = value & DEVICE_INTERRUPT_ENABLE;
+			break;
+		case UART_TX_CONTROL:
+			uart->tx_control = DEVICE_READY | (value & DEVICE_INTERRUPT_ENABLE);
+			break;
+		case UART_TX_DATA:
+			uart->bytes_out++;
+			guest_output(1, &c, 1);
+			break;
+	}
+}
+
+/************************************************************/
+/* Feed <filename> to the UART receiver                                        */
+/************************************************************/
+int uart_input(const char *filename){
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0){
+		perror(filename);
+		return FALSE;
+	}
+	if (UART.input_fd >= 0){
+		close(UART.input_fd);
+	}
+	UART.input_fd = fd;
+	UART.input_next = 0;
+	UART.input_length = 0;
+	return TRUE;
+}
+
+/************************************************************/
+/* Timer: counts simulated cycles; expires once the count reaches  */
+/* the compare value written last                                                   */
+/************************************************************/
+void timer_reset(mmio_device_t *device){
+	timer_device_t *timer = (timer_device_t *)device;
+
+	timer->origin = 0;	/*reset() zeroes CYCLE_COUNT*/
+	timer->compare = 0;
+	timer->control = 0;
+	timer->armed = FALSE;
+	timer->expirations = 0;
+}
+
+int timer_expired(timer_device_t *timer){
+	if (timer->armed && (int32_t)(CYCLE_COUNT - timer->origin - timer->compare) >= 0){
+		timer->armed = FALSE;
+		timer->control |= TIMER_EXPIRED;
+		timer->expirations++;
+	}
+	return timer->control & TIMER_EXPIRED;
+}
+
+uint32_t timer_read(mmio_device_t *device, uint32_t offset){
+	timer_device_t *timer = (timer_device_t *)device;
+
+	switch (offset){
+		case TIMER_COUNT:
+			return CYCLE_COUNT - timer->origin;
+		case TIMER_COMPARE:
+			return timer->compare;
+		case TIMER_CONTROL:
+			timer_expired(timer);
+			return timer->control;
+		default:
+			return 0;
+	}
+}
+
+void timer_write(mmio_device_t *device, uint32_t offset, uint32_t value){
+	timer_device_t *timer = (timer_device_t *)device;
+
+	switch (offset){
+		case TIMER_COUNT:
+			timer->origin = CYCLE_COUNT - value;
+			break;
+		case TIMER_COMPARE:
+			timer->compare = value;
+			timer->control &= ~TIMER_EXPIRED;
+			timer->armed = TRUE;
+			break;
+		case TIMER_CONTROL:
+			timer->control = (timer->control & TIMER_EXPIRED) | (value & DEVICE_INTERRUPT_ENABLE);
+			if (value & TIMER_EXPIRED){
+				timer->control &= ~TIMER_EXPIRED;
+				timer->armed = FALSE;
+			}
+			break;
+	}
+}
+
+/************************************************************/
+/* Issue a load or store from EX to the prefetch buffer and memory */
+/* model; returns the cycle MEM may complete it, 0 for a posted    */
+/* store                                                                                               */
+/************************************************************/
+uint32_t memory_request(uint32_t pc, uint32_t address, int write){
+	uint32_t cycle = CYCLE_COUNT + 1, ready = cycle;
+	int hit = FALSE;
+
+	if (PREFETCHER != NULL && !write){
+		PREFETCH_LOADS++;
+		hit = prefetch_lookup(address, cycle, &ready);
+	}
+	if (!hit && MEMORY_MODEL != NULL){
+		ready = MEMORY_MODEL->access(MEMORY_MODEL, address, write, cycle);
+	}
+	if (PREFETCHER != NULL && !write){
+		PREFETCHER->observe(PREFETCHER, pc, address, hit);
+	}
+	return write ? 0 : ready;
+}
+
+/************************************************************/
+/* DRAM model: clear banks, bus and statistics                               */
+/************************************************************/
+void dram_reset(memory_model_t *model){
+	dram_model_t *dram = (dram_model_t *)model;
+
+	dram_idle(model);
+	dram->reads = dram->writes = 0;
+	dram->row_hits = dram->row_misses = dram->row_conflicts = 0;
+	dram->bank_waits = dram->bus_waits = 0;
+	dram->bus_busy = dram->latency_sum = 0;
+	dram->first_cycle = dram->last_cycle = dram->max_latency = 0;
+	memset(dram->read_latency, 0, sizeof(dram->read_latency));
+	memset(dram->write_latency, 0, sizeof(dram->write_latency));
+}
+
+/************************************************************/
+/* DRAM model: precharge every bank and free the bus                    */
+/************************************************************/
+void dram_idle(memory_model_t *model){
+	dram_model_t *dram = (dram_model_t *)model;
+
+	memset(dram->open_row, 0, sizeof(dram->open_row));
+	memset(dram->bank_ready, 0, sizeof(dram->bank_ready));
+	dram->bus_ready = 0;
+}
+
+/************************************************************/
+/* DRAM model: a request arriving at <cycle>.  A row hit needs     */
+/* only tCAS, an idle bank tRCD + tCAS, and a conflict with another */
+/* open row tRP + tRCD + tCAS; requests queue behind a busy bank  */
+/* and share the data bus for tBURST.  Requests to different banks */
+/* overlap, so posted stores run alongside later loads.                */
+/************************************************************/
+uint32_t dram_access(memory_model_t *model, uint32_t address, int write, uint32_t cycle){
+	dram_model_t *dram = (dram_model_t *)model;
+	uint32_t bank = address / dram->row_bytes % dram->banks;
+	uint32_t row = address / dram->row_bytes / dram->banks + 1;
+	uint32_t start = cycle, data, done, latency;
+
+	if (dram->bank_ready[bank] > start){
+		dram->bank_waits += dram->bank_ready[bank] - start;
+		start = dram->bank_ready[bank];
+	}
+	if (dram->open_row[bank] == row){
+		dram->row_hits++;
+		data = start + dram->t_cas;
+	}
+	else if (dram->open_row[bank] == 0){
+		dram->row_misses++;
+		data = start + dram->t_rcd + dram->t_cas;
+	}
+	else{
+		dram->row_conflicts++;
+		data = start + dram->t_rp + dram->t_rcd + dram->t_cas;
+	}
+	if (dram->bus_ready > data){
+		dram->bus_waits += dram->bus_ready - data;
+		data = dram->bus_ready;
+	}
+	done = data + dram->t_burst;
+	dram->bus_ready = done;
+	dram->bus_busy += dram->t_burst;
+	if (dram->open_page){
+		dram->open_row[bank] = row;
+		dram->bank_ready[bank] = done;
+	}
+	else{
+		dram->open_row[bank] = 0;
+		dram->bank_ready[bank] = done + dram->t_rp;
+	}
+
+	latency = done - cycle;
+	if (dram->reads + dram->writes == 0){
+		dram->first_cycle = cycle;
+	}
+	dram->last_cycle = done;
+	if (write){
+		dram->writes++;
+		dram->write_latency[latency / DRAM_HISTOGRAM_WIDTH < DRAM_HISTOGRAM_BUCKETS ? latency / DRAM_HISTOGRAM_WIDTH : DRAM_HISTOGRAM_BUCKETS - 1]++;
+	}
+	else{
+		dram->reads++;
+		dram->read_latency[latency / DRAM_HISTOGRAM_WIDTH < DRAM_HISTOGRAM_BUCKETS ? latency / DRAM_HISTOGRAM_WIDTH : DRAM_HISTOGRAM_BUCKETS - 1]++;
+	}
+	dram->latency_sum += latency;
+	if (latency > dram->max_latency){
+		dram->max_latency = latency;
+	}
+	return done;
+}
+
+/************************************************************/
+/* Print the non-empty buckets of a latency histogram                   */
+/************************************************************/
+void dram_histogram(const char *title, const uint64_t *buckets, uint64_t count){
+	uint32_t i;
+	uint64_t most = 0;
+
+	if (count == 0){
+		return;
+	}
+	for (i = 0; i < DRAM_HISTOGRAM_BUCKETS; i++){
+		if (buckets[i] > most){
+			most = buckets[i];
+		}
+	}
+	printf("%s latency (cycles):\n", title);
+	for (i = 0; i < DRAM_HISTOGRAM_BUCKETS; i++){
+		if (buckets[i] == 0){
+			continue;
+		}
+		if (i + 1 < DRAM_HISTOGRAM_BUCKETS){
+			printf("  %4u-%-4u", i * DRAM_HISTOGRAM_WIDTH, (i + 1) * DRAM_HISTOGRAM_WIDTH - 1);
+		}
+		else{
+			printf("  %4u+    ", i * DRAM_HISTOGRAM_WIDTH);
+		}
+		printf(" %10llu %6.2f%% %.*s\n", (unsigned long long)buckets[i], 100.0 * buckets[i] / count,
+			(int)(40 * buckets[i] / most), "########################################");
+	}
+}
+
+/************************************************************/
+/* DRAM model statistics                                                                   */
+/************************************************************/
+void dram_report(memory_model_t *model){
+	dram_model_t *dram = (dram_model_t *)model;
+	uint64_t requests = dram->reads + dram->writes;
+	uint32_t window = dram->last_cycle - dram->first_cycle;
+
+	printf("Banks / row bytes\t: %u / %u\n", dram->banks, dram->row_bytes);
+	printf("tCAS/tRCD/tRP/tBURST\t: %u/%u/%u/%u\n", dram->t_cas, dram->t_rcd, dram->t_rp, dram->t_burst);
+	printf("Reads / writes\t: %llu / %llu\n", (unsigned long long)dram->reads, (unsigned long long)dram->writes);
+	if (requests == 0){
+		return;
+	}
+	printf("Row hits\t: %llu (%.2f%%)\n", (unsigned long long)dram->row_hits, 100.0 * dram->row_hits / requests);
+	printf("Row misses\t: %llu (%.2f%%)\n", (unsigned long long)dram->row_misses, 100.0 * dram->row_misses / requests);
+	printf("Row conflicts\t: %llu (%.2f%%)\n", (unsigned long long)dram->row_conflicts, 100.0 * dram->row_conflicts / requests);
+	printf("Bank / bus queueing\t: %llu / %llu cycles\n", (unsigned long long)dram->bank_waits, (unsigned long long)dram->bus_waits);
+	printf("Latency avg / max\t: %.2f / %u cycles\n", (double)dram->latency_sum / requests, dram->max_latency);
+	printf("Bandwidth\t: %.4f bytes/cycle over %u cycles, bus %.2f%% busy\n",
+		window ? 4.0 * requests / window : 0.0, window, window ? 100.0 * dram->bus_busy / window : 0.0);
+	dram_histogram("Read", dram->read_latency, dram->reads);
+	dram_histogram("Write", dram->write_latency, dram->writes);
+}
+
+/************************************************************/
+/* dram open|closed [banks] [row bytes] | dram off |                     */
+/* dram timing <tCAS> <tRCD> <tRP> [tBURST]                                 */
+/************************************************************/
+int dram_command(int argc, char **argv){
+	dram_model_t *dram;
+	uint32_t i, values[4];
+
+	if (argc == 2 && strcmp(argv[1], "off") == 0){
+		MEMORY_MODEL = NULL;
+		return CMD_OK;
+	}
+	if (argc >= 4 && argc <= 6 && strcmp(argv[1], "timing") == 0){
+		if (MEMORY_MODEL == NULL){
+			printf("No memory model selected\n");
+			return CMD_ERROR;
+		}
+		dram = (dram_model_t *)MEMORY_MODEL;
+		values[3] = dram->t_burst;
+		for (i = 2; i < (uint32_t)argc; i++){
+			if (!parse_value(argv[i], 10, &values[i - 2]) || values[i - 2] > 1000){
+				printf("Bad timing: %s\n", argv[i]);
+				return CMD_ERROR;
+			}
+		}
+		if (values[3] == 0){
+			printf("tBURST must be at least one cycle\n");
+			return CMD_ERROR;
+		}
+		dram->t_cas = values[0];
+		dram->t_rcd = values[1];
+		dram->t_rp = values[2];
+		dram->t_burst = values[3];
+		return CMD_OK;
+	}
+	if (argc < 2 || argc > 4){
+		printf("Usage: dram open|closed [banks] [row bytes] | dram off | dram timing <tCAS> <tRCD> <tRP> [tBURST]\n");
+		return CMD_ERROR;
+	}
+	for (i = 0; i < NUM_MEMORY_MODELS; i++){
+		if (strcmp(argv[1], MEMORY_MODELS[i]->name) == 0){
+			break;
+		}
+	}
+	if (i == NUM_MEMORY_MODELS){
+		printf("Unknown memory model: %s (models:", argv[1]);
+		for (i = 0; i < NUM_MEMORY_MODELS; i++){
+			printf(" %s", MEMORY_MODELS[i]->name);
+		}
+		printf(" off)\n");
+		return CMD_ERROR;
+	}
+	dram = (dram_model_t *)MEMORY_MODELS[i];
+	values[0] = dram->banks;
+	values[1] = dram->row_bytes;
+	if (argc > 2 && (!parse_value(argv[2], 10, &values[0]) || values[0] == 0 || values[0] > DRAM_MAX_BANKS)){
+		printf("Banks must be 1..%d\n", DRAM_MAX_BANKS);
+		return CMD_ERROR;
+	}
+	if (argc > 3 && (!parse_value(argv[3], 10, &values[1]) || values[1] < 4 || (values[1] & (values[1] - 1)) != 0)){
+		printf("Row bytes must be a power of two, at least 4\n");
+		return CMD_ERROR;
+	}
+	dram->banks = values[0];
+	dram->row_bytes = values[1];
+	MEMORY_MODEL = &dram->base;
+	MEMORY_MODEL->reset(MEMORY_MODEL);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Empty the prefetch buffer, clear the statistics and retrain       */
+/************************************************************/
+void prefetch_reset(){
+	prefetch_idle();
+	PREFETCH_LOADS = PREFETCH_HITS = 0;
+	PREFETCH_ISSUED = PREFETCH_USEFUL = PREFETCH_LATE = PREFETCH_USELESS = 0;
+	if (PREFETCHER != NULL){
+		PREFETCHER->reset(PREFETCHER);
+	}
+}
+
+/************************************************************/
+/* Drop the buffered lines: the cycle count restarts                    */
+/************************************************************/
+void prefetch_idle(){
+	memset(PREFETCH_LINES, 0, sizeof(PREFETCH_LINES));
+	PREFETCH_VICTIM = 0;
+}
+
+/************************************************************/
+/* Look for the line of a demand load in the prefetch buffer          */
+/************************************************************/
+int prefetch_lookup(uint32_t address, uint32_t cycle, uint32_t *ready){
+	uint32_t line = address / PREFETCH_LINE_BYTES + 1, i;
+	prefetch_line_t *entry;
+
+	for (i = 0; i < PREFETCH_BUFFER_LINES; i++){
+		entry = &PREFETCH_LINES[i];
+		if (entry->line != line){
+			continue;
+		}
+		PREFETCH_HITS++;
+		if (!entry->used){
+			entry->used = TRUE;
+			PREFETCH_USEFUL++;
+			if (entry->ready > cycle){
+				PREFETCH_LATE++;
+			}
+		}
+		*ready = entry->ready > cycle ? entry->ready : cycle;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Fetch the line holding <address> into the prefetch buffer unless */
+/* it is already there; a line costs one memory-model request       */
+/************************************************************/
+void prefetch_issue(uint32_t address){
+	uint32_t line = address / PREFETCH_LINE_BYTES + 1, i;
+	prefetch_line_t *victim;
+
+	for (i = 0; i < PREFETCH_BUFFER_LINES; i++){
+		if (PREFETCH_LINES[i].line == line){
+			return;
+		}
+	}
+	victim = &PREFETCH_LINES[PREFETCH_VICTIM];
+	PREFETCH_VICTIM = (PREFETCH_VICTIM + 1) % PREFETCH_BUFFER_LINES;
+	if (victim->line != 0 && !victim->used){
+		PREFETCH_USELESS++;
+	}
+	victim->line = line;
+	victim->used = FALSE;
+	victim->ready = CYCLE_COUNT + 1;
+	if (MEMORY_MODEL != NULL){
+		victim->ready = MEMORY_MODEL->access(MEMORY_MODEL, address & ~(PREFETCH_LINE_BYTES - 1), FALSE, CYCLE_COUNT + 1);
+	}
+	PREFETCH_ISSUED++;
+}
+
+/************************************************************/
+/* Next-line prefetcher: on entering a line, fetch the <degree>     */
+/* lines after it                                                                                  */
+/************************************************************/
+void next_line_reset(prefetcher_t *prefetcher){
+	((next_line_prefetcher_t *)prefetcher)->last_line = 0;
+}
+
+void next_line_observe(prefetcher_t *prefetcher, uint32_t pc, uint32_t address, int hit){
+	next_line_prefetcher_t *next = (next_line_prefetcher_t *)prefetcher;
+	uint32_t line = address / PREFETCH_LINE_BYTES + 1, i;
+
+	if (line == next->last_line){
+		return;
+	}
+	next->last_line = line;
+	for (i = 1; i <= prefetcher->degree; i++){
+		prefetch_issue(address + i * PREFETCH_LINE_BYTES);
+	}
+}
+
+/************************************************************/
+/* Stride prefetcher: each load PC remembers its last address and  */
+/* stride; after the same stride twice running, fetch <degree>       */
+/* strides ahead (lines ahead for strides under a line)                */
+/************************************************************/
+void stride_reset(prefetcher_t *prefetcher){
+	stride_prefetcher_t *stride = (stride_prefetcher_t *)prefetcher;
+
+	memset(stride->table, 0, sizeof(stride->table));
+}
+
+void stride_observe(prefetcher_t *prefetcher, uint32_t pc, uint32_t address, int hit){
+	stride_entry_t *entry = &((stride_prefetcher_t *)prefetcher)->table[(pc >> 2) % STRIDE_TABLE_SIZE];
+	uint32_t stride, step, i;
+
+	if (entry->pc != pc){
+		*entry = (stride_entry_t){ .pc = pc, .last = address };
+		return;
+	}
+	stride = address - entry->last;
+	entry->last = address;
+	if (stride != 0 && stride == entry->stride){
+		if (entry->confidence < 3){
+			entry->confidence++;
+		}
+	}
+	else if (entry->confidence > 0){
+		entry->confidence--;
+	}
+	else{
+		entry->stride = stride;
+	}
+	if (entry->confidence < 2){
+		return;
+	}
+	step = entry->stride;
+	if ((int32_t)step > -PREFETCH_LINE_BYTES && (int32_t)step < PREFETCH_LINE_BYTES){
+		step = (int32_t)step < 0 ? -PREFETCH_LINE_BYTES : PREFETCH_LINE_BYTES;
+	}
+	for (i = 1; i <= prefetcher->degree; i++){
+		prefetch_issue(address + i * step);
+	}
+}
+
+/************************************************************/
+/* Stream buffers: a load outside every stream starts one (LRU) at */
+/* the next line; a load within <degree> lines of a stream's head    */
+/* keeps that stream <degree> lines ahead.  Streams run upward.   */
+/************************************************************/
+void stream_reset(prefetcher_t *prefetcher){
+	stream_prefetcher_t *stream = (stream_prefetcher_t *)prefetcher;
+
+	memset(stream->streams, 0, sizeof(stream->streams));
+	stream->clock = 0;
+	stream->allocations = 0;
+}
+
+void stream_observe(prefetcher_t *prefetcher, uint32_t pc, uint32_t address, int hit){
+	stream_prefetcher_t *stream = (stream_prefetcher_t *)prefetcher;
+	uint32_t line = address / PREFETCH_LINE_BYTES, i, found = STREAM_COUNT, oldest = 0;
+
+	stream->clock++;
+	for (i = 0; i < STREAM_COUNT; i++){
+		if (stream->streams[i].head != 0 && line < stream->streams[i].head
+			&& line + prefetcher->degree + 1 >= stream->streams[i].head){
+			found = i;
+			break;
+		}
+		if (stream->streams[i].last_use < stream->streams[oldest].last_use){
+			oldest = i;
+		}
+	}
+	if (found == STREAM_COUNT){
+		if (hit){
+			return;
+		}
+		found = oldest;
+		stream->streams[found].head = line + 1;
+		stream->allocations++;
+	}
+	stream->streams[found].last_use = stream->clock;
+	while (stream->streams[found].head <= line + prefetcher->degree){
+		prefetch_issue(stream->streams[found].head * PREFETCH_LINE_BYTES);
+		stream->streams[found].head++;
+	}
+}
+
+/************************************************************/
+/* Prefetcher statistics: coverage is the share of demand loads     */
+/* served from the buffer, accuracy the share of prefetched lines   */
+/* that a load used                                                                              */
+/************************************************************/
+void prefetch_report(){
+	uint32_t i;
+	uint64_t unused = 0;
+
+	for (i = 0; i < PREFETCH_BUFFER_LINES; i++){
+		unused += PREFETCH_LINES[i].line != 0 && !PREFETCH_LINES[i].used;
+	}
+	printf("Prefetcher\t: %s (%s), degree %u\n", PREFETCHER->name, PREFETCHER->description, PREFETCHER->degree);
+	printf("Demand loads\t: %llu\n", (unsigned long long)PREFETCH_LOADS);
+	printf("Prefetch buffer hits\t: %llu (coverage %.2f%%)\n", (unsigned long long)PREFETCH_HITS,
+		PREFETCH_LOADS ? 100.0 * PREFETCH_HITS / PREFETCH_LOADS : 0.0);
+	printf("Prefetches issued\t: %llu\n", (unsigned long long)PREFETCH_ISSUED);
+	printf("Prefetches used\t: %llu (accuracy %.2f%%), %llu late\n", (unsigned long long)PREFETCH_USEFUL,
+		PREFETCH_ISSUED ? 100.0 * PREFETCH_USEFUL / PREFETCH_ISSUED : 0.0, (unsigned long long)PREFETCH_LATE);
+	printf("Useless prefetches\t: %llu replaced, %llu still unused (%llu bytes)\n", (unsigned long long)PREFETCH_USELESS,
+		(unsigned long long)unused, (unsigned long long)(PREFETCH_USELESS + unused) * PREFETCH_LINE_BYTES);
+	if (PREFETCHER == &STREAM_PREFETCHER.base){
+		printf("Streams started\t: %llu\n", (unsigned long long)STREAM_PREFETCHER.allocations);
+	}
+}
+
+/************************************************************/
+/* prefetch next|stride|stream [degree] | prefetch off                    */
+/************************************************************/
+int prefetch_command(int argc, char **argv){
+	uint32_t i, degree;
+
+	if (argc == 2 && strcmp(argv[1], "off") == 0){
+		PREFETCHER = NULL;
+		prefetch_reset();
+		return CMD_OK;
+	}
+	if (argc < 2 || argc > 3){
+		printf("Usage: prefetch next|stride|stream [degree] | prefetch off\n");
+		return CMD_ERROR;
+	}
+	for (i = 0; i < NUM_PREFETCHERS; i++){
+		if (strcmp(argv[1], PREFETCHERS[i]->name) == 0){
+			break;
+		}
+	}
+	if (i == NUM_PREFETCHERS){
+		printf("Unknown prefetcher: %s (prefetchers:", argv[1]);
+		for (i = 0; i < NUM_PREFETCHERS; i++){
+			printf(" %s", PREFETCHERS[i]->name);
+		}
+		printf(" off)\n");
+		return CMD_ERROR;
+	}
+	degree = PREFETCHERS[i]->degree;
+	if (argc == 3 && (!parse_value(argv[2], 10, &degree) || degree == 0 || degree > PREFETCH_MAX_DEGREE)){
+		printf("Degree must be 1..%d\n", PREFETCH_MAX_DEGREE);
+		return CMD_ERROR;
+	}
+	PREFETCHER = PREFETCHERS[i];
+	PREFETCHER->degree = degree;
+	prefetch_reset();
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Forget every access and free the analyzer's tables                     */
+/************************************************************/
+void reuse_reset(reuse_t *reuse){
+	free(reuse->table_line);
+	free(reuse->table_time);
+	free(reuse->tree);
+	free(reuse->time_slot);
+	free(reuse->histogram);
+	*reuse = (reuse_t){ .name = reuse->name };
+}
+
+/************************************************************/
+/* Renumber the live access times 1..n in order and rebuild the    */
+/* Fenwick tree, with room for as many accesses again                 */
+/************************************************************/
+void reuse_compact(reuse_t *reuse){
+	uint32_t capacity = reuse->table_count * 4 > REUSE_MIN_TIMES ? reuse->table_count * 4 : REUSE_MIN_TIMES;
+	uint32_t *time_slot = calloc(capacity, sizeof(uint32_t));
+	uint32_t *tree = calloc(capacity, sizeof(uint32_t));
+	uint32_t time, now = 0, parent;
+
+	if (time_slot == NULL || tree == NULL){
+		printf("Out of memory for reuse analysis\n");
+		exit(1);
+	}
+	for (time = 1; time <= reuse->now; time++){
+		if (reuse->time_slot[time] != 0){
+			now++;
+			reuse->table_time[reuse->time_slot[time] - 1] = now;
+			time_slot[now] = reuse->time_slot[time];
+		}
+	}
+	/* linear-time build of a tree of ones over 1..now */
+	for (time = 1; time < capacity; time++){
+		tree[time] += time <= now;
+		parent = time + (time & -time);
+		if (parent < capacity){
+			tree[parent] += tree[time];
+		}
+	}
+	free(reuse->time_slot);
+	free(reuse->tree);
+	reuse->time_slot = time_slot;
+	reuse->tree = tree;
+	reuse->capacity = capacity;
+	reuse->now = now;
+}
+
+/************************************************************/
+/* Double the line table, keeping time_slot pointing at each line  */
+/************************************************************/
+void reuse_grow_table(reuse_t *reuse){
+	uint32_t size = reuse->table_size ? reuse->table_size * 2 : REUSE_MIN_TABLE;
+	uint32_t *lines = calloc(size, sizeof(uint32_t)), *times = calloc(size, sizeof(uint32_t));
+	uint32_t i, slot;
+
+	if (lines == NULL || times == NULL){
+		printf("Out of memory for reuse analysis\n");
+		exit(1);
+	}
+	for (i = 0; i < reuse->table_size; i++){
+		if (reuse->table_line[i] == 0){
+			continue;
+		}
+		slot = reuse->table_line[i] * 2654435761u & (size - 1);
+		while (lines[slot] != 0){
+			slot = (slot + 1) & (size - 1);
+		}
+		lines[slot] = reuse->table_line[i];
+		times[slot] = reuse->table_time[i];
+		reuse->time_slot[times[slot]] = slot + 1;
+	}
+	free(reuse->table_line);
+	free(reuse->table_time);
+	reuse->table_line = lines;
+	reuse->table_time = times;
+	reuse->table_size = size;
+}
+
+/************************************************************/
+/* Record an access: its distance is the number of lines whose     */
+/* last access came after this line's                                             */
+/************************************************************/
+void reuse_access(reuse_t *reuse, uint32_t address){
+	uint32_t line = (address >> REUSE_LINE_SHIFT) + 1, slot, then, time, distance, size;
+
+	if (reuse->now + 1 >= reuse->capacity){
+		reuse_compact(reuse);
+	}
+	if (2 * (reuse->table_count + 1) > reuse->table_size){
+		reuse_grow_table(reuse);
+	}
+	slot = line * 2654435761u & (reuse->table_size - 1);
+	while (reuse->table_line[slot] != 0 && reuse->table_line[slot] != line){
+		slot = (slot + 1) & (reuse->table_size - 1);
+	}
+	reuse->accesses++;
+	if (reuse->table_line[slot] == line){
+		then = reuse->table_time[slot];
+		distance = reuse->table_count;
+		for (time = then; time > 0; time -= time & -time){
+			distance -= reuse->tree[time];
+		}
+		for (time = then; time < reuse->capacity; time += time & -time){
+			reuse->tree[time]--;
+		}
+		reuse->time_slot[then] = 0;
+		if (distance >= reuse->histogram_size){
+			size = reuse->histogram_size ? reuse->histogram_size : 1024;
+			while (size <= distance){
+				size *= 2;
+			}
+			reuse->histogram = realloc(reuse->histogram, size * sizeof(uint64_t));
+			if (reuse->histogram == NULL){
+				printf("Out of memory for reuse analysis\n");
+				exit(1);
+			}
+			memset(reuse->histogram + reuse->histogram_size, 0, (size - reuse->histogram_size) * sizeof(uint64_t));
+			reuse->histogram_size = size;
+		}
+		reuse->histogram[distance]++;
+	}
+	else{
+		reuse->table_line[slot] = line;
+		reuse->table_count++;
+		reuse->cold++;
+	}
+	reuse->now++;
+	reuse->table_time[slot] = reuse->now;
+	reuse->time_slot[reuse->now] = slot + 1;
+	for (time = reuse->now; time < reuse->capacity; time += time & -time){
+		reuse->tree[time]++;
+	}
+}
+
+/************************************************************/
+/* Misses of a fully associative LRU cache of <lines> lines            */
+/************************************************************/
+uint64_t reuse_misses(const reuse_t *reuse, uint64_t lines){
+	uint64_t misses = reuse->cold;
+	uint32_t distance;
+
+	for (distance = lines < reuse->histogram_size ? lines : reuse->histogram_size; distance < reuse->histogram_size; distance++){
+		misses += reuse->histogram[distance];
+	}
+	return misses;
+}
+
+/************************************************************/
+/* Miss-ratio curves at power-of-two sizes, up to the size that      */
+/* holds every line                                                                               */
+/************************************************************/
+void reuse_report(){
+	reuse_t *both[2] = { &REUSE_DATA, &REUSE_INST };
+	uint64_t lines, misses;
+	uint32_t i, done;
+
+	printf("Reuse analysis\t: %u-byte lines, fully associative LRU\n", 1u << REUSE_LINE_SHIFT);
+	for (i = 0; i < 2; i++){
+		printf("%s accesses\t: %llu, %llu distinct lines\n", both[i]->name,
+			(unsigned long long)both[i]->accesses, (unsigned long long)both[i]->cold);
+	}
+	printf("%12s %14s %14s\n", "cache size", "data miss", "inst miss");
+	for (lines = 1; ; lines *= 2){
+		done = TRUE;
+		printf("%10lluB ", (unsigned long long)lines << REUSE_LINE_SHIFT);
+		for (i = 0; i < 2; i++){
+			misses = reuse_misses(both[i], lines);
+			printf(" %13.4f%%", both[i]->accesses ? 100.0 * misses / both[i]->accesses : 0.0);
+			done &= misses == both[i]->cold;
+		}
+		printf("\n");
+		if (done){
+			break;
+		}
+	}
+}
+
+/************************************************************/
+/* Write the miss counts of every cache size, one line per size    */
+/************************************************************/
+int reuse_curve(const char *filename){
+	FILE *fp = fopen(filename, "w");
+	uint32_t lines, last = REUSE_DATA.histogram_size > REUSE_INST.histogram_size ? REUSE_DATA.histogram_size : REUSE_INST.histogram_size;
+	uint64_t data = reuse_misses(&REUSE_DATA, 1), inst = reuse_misses(&REUSE_INST, 1);
+
+	if (fp == NULL){
+		perror(filename);
+		return FALSE;
+	}
+	fprintf(fp, "# lines bytes data_misses data_miss_ratio inst_misses inst_miss_ratio\n");
+	for (lines = 1; lines <= last + 1; lines++){
+		fprintf(fp, "%u %llu %llu %.6f %llu %.6f\n", lines, (unsigned long long)lines << REUSE_LINE_SHIFT,
+			(unsigned long long)data, REUSE_DATA.accesses ? (double)data / REUSE_DATA.accesses : 0.0,
+			(unsigned long long)inst, REUSE_INST.accesses ? (double)inst / REUSE_INST.accesses : 0.0);
+		/* a cache one line larger also hits the accesses at distance <lines> */
+		if (lines < REUSE_DATA.histogram_size){
+			data -= REUSE_DATA.histogram[lines];
+		}
+		if (lines < REUSE_INST.histogram_size){
+			inst -= REUSE_INST.histogram[lines];
+		}
+	}
+	fclose(fp);
+	return TRUE;
+}
+
+/************************************************************/
+/* reuse on [line bytes] | reuse off | reuse curve <file>                     */
+/************************************************************/
+int reuse_command(int argc, char **argv){
+	uint32_t bytes = 1u << REUSE_LINE_SHIFT;
+
+	if (argc == 3 && strcmp(argv[1], "curve") == 0){
+		return reuse_curve(argv[2]) ? CMD_OK : CMD_ERROR;
+	}
+	if (argc == 2 && strcmp(argv[1], "off") == 0){
+		REUSE_ENABLED = FALSE;
+		return CMD_OK;
+	}
+	if (argc < 2 || argc > 3 || strcmp(argv[1], "on") != 0){
+		printf("Usage: reuse on [line bytes] | reuse off | reuse curve <file>\n");
+		return CMD_ERROR;
+	}
+	if (argc == 3 && (!parse_value(argv[2], 10, &bytes) || bytes < 4 || bytes > MEM_PAGE_SIZE || (bytes & (bytes - 1)) != 0)){
+		printf("Line bytes must be a power of two, 4..%d\n", MEM_PAGE_SIZE);
+		return CMD_ERROR;
+	}
+	REUSE_LINE_SHIFT = __builtin_ctz(bytes);
+	REUSE_ENABLED = TRUE;
+	reuse_reset(&REUSE_DATA);
+	reuse_reset(&REUSE_INST);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Append one access to the trace                                                    */
+/************************************************************/
+void trace_record(uint32_t address, uint32_t kind){
+	TRACE_RECORDS[TRACE_COUNT++] = (trace_record_t){ address, kind };
+	if (TRACE_COUNT == TRACE_BUFFER_RECORDS){
+		trace_flush();
+	}
+}
+
+/************************************************************/
+/* Write the buffered records                                                            */
+/************************************************************/
+void trace_flush(){
+	if (TRACE_COUNT > 0 && fwrite(TRACE_RECORDS, sizeof(trace_record_t), TRACE_COUNT, TRACE_FILE) != TRACE_COUNT){
+		perror("trace");
+	}
+	TRACE_TOTAL += TRACE_COUNT;
+	TRACE_COUNT = 0;
+}
+
+/************************************************************/
+/* Start tracing to <filename>, ending any trace in progress           */
+/************************************************************/
+int trace_open(const char *filename){
+	trace_close();
+	TRACE_FILE = fopen(filename, "wb");
+	if (TRACE_FILE == NULL){
+		perror(filename);
+		return FALSE;
+	}
+	fwrite(TRACE_MAGIC, 1, 8, TRACE_FILE);
+	TRACE_COUNT = 0;
+	TRACE_TOTAL = 0;
+	return TRUE;
+}
+
+/************************************************************/
+/* Flush and close the trace                                                             */
+/************************************************************/
+void trace_close(){
+	if (TRACE_FILE == NULL){
+		return;
+	}
+	trace_flush();
+	fclose(TRACE_FILE);
+	TRACE_FILE = NULL;
+	if (!QUIET){
+		printf("Traced %llu accesses\n", (unsigned long long)TRACE_TOTAL);
+	}
+}
+
+/************************************************************/
+/* trace <file> | trace off                                                                 */
+/************************************************************/
+int trace_command(int argc, char **argv){
+	if (argc != 2){
+		printf("Usage: trace <file> | trace off\n");
+		return CMD_ERROR;
+	}
+	if (strcmp(argv[1], "off") == 0){
+		trace_close();
+		return CMD_OK;
+	}
+	return trace_open(argv[1]) ? CMD_OK : CMD_ERROR;
+}
+
+/************************************************************/
+/* Write a COP0 register of the next state (pipeline)                  */
+/************************************************************/
+void write_cop0(uint32_t reg, uint32_t value){
+	cop0_write(&NEXT_STATE, reg, value);
+	STATE_DIRTY |= 1ull << REG_COP0;
+}
+
+/************************************************************/
+/* MFC0: Cause shows the interrupt lines as they are now             */
+/************************************************************/
+uint32_t cop0_read(const CPU_State *state, uint32_t reg){
+	if (reg == COP0_CAUSE){
+		return (state->COP0[COP0_CAUSE] & ~CAUSE_IP) | interrupt_lines();
+	}
+	return state->COP0[reg];
+}
+
+/************************************************************/
+/* MTC0: only Status and EPC are writable                                     */
+/************************************************************/
+void cop0_write(CPU_State *state, uint32_t reg, uint32_t value){
+	if (reg == COP0_STATUS){
+		state->COP0[COP0_STATUS] = value & (STATUS_IE | STATUS_EXL | STATUS_IM);
+	}else if (reg == COP0_EPC){
+		state->COP0[COP0_EPC] = value;
+	}
+}
+
+/************************************************************/
+/* Interrupt requests of the devices, as Cause.IP bits                   */
+/************************************************************/
+uint32_t interrupt_lines(){
+	uint32_t lines = 0;
+
+	if (((UART.rx_control & DEVICE_INTERRUPT_ENABLE) && uart_fill(&UART)) ||
+			(UART.tx_control & DEVICE_INTERRUPT_ENABLE)){
+		lines |= CAUSE_IP_UART;
+	}
+	if ((TIMER.control & DEVICE_INTERRUPT_ENABLE) && timer_expired(&TIMER)){
+		lines |= CAUSE_IP_TIMER;
+	}
+	return lines;
+}
+
+/************************************************************/
+/* Enter the handler for exception <code> raised by the instruction */
+/* at <pc>; returns the vector to continue at                                  */
+/************************************************************/
+uint32_t enter_exception(CPU_State *state, uint32_t code, uint32_t pc, uint32_t badvaddr){
+	state->COP0[COP0_CAUSE] = (state->COP0[COP0_CAUSE] & ~CAUSE_EXCCODE) | (code << 2);
+	state->COP0[COP0_EPC] = pc;
+	if (code == EXC_ADEL || code == EXC_ADES){
+		state->COP0[COP0_BADVADDR] = badvaddr;
+	}
+	state->COP0[COP0_STATUS] |= STATUS_EXL;
+	EXCEPTION_COUNTS[code]++;
+	HANDLER_CAUSE = code;
+	return EXCEPTION_VECTOR;
+}
+
+/************************************************************/
+/* Exception with no kernel loaded to handle it                               */
+/************************************************************/
+void report_exception(uint32_t code, uint32_t pc, uint32_t badvaddr){
+	EXCEPTION_COUNTS[code]++;
+	MEMO_TAINTED = TRUE;
+	if (GUEST_SILENT){
+		return;
+	}
+	guest_flush();
+	if (code == EXC_ADEL || code == EXC_ADES){
+		printf("Unhandled exception: %s at 0x%08x (address 0x%08x)\n\n", EXCEPTION_NAMES[code], pc, badvaddr);
+	}else{
+		printf("Unhandled exception: %s at 0x%08x\n\n", EXCEPTION_NAMES[code], pc);
+	}
+}
+
+/************************************************************/
+/* EX found an exception in the instruction in IF_EX: vector to the  */
+/* kernel, or without one let it reach WB as a no-op and stop there. */
+/* Younger instructions are squashed at the clock edge.                 */
+/************************************************************/
+void pipeline_exception(uint32_t code, uint32_t badvaddr, CPU_Pipeline_Reg *out){
+	uint32_t pc = IF_EX.PC - 4;
+
+	memset(out, 0, sizeof(*out));
+	if (KERNEL_SIZE == 0){
+		*out = (CPU_Pipeline_Reg){ .PC = IF_EX.PC, .seq = IF_EX.seq, .ALUOutput = badvaddr, .exception = code + 1 };
+		REDIRECT_PC = pc;
+		REDIRECT_HOLD = IF_EX.seq;
+	}else{
+		REDIRECT_PC = enter_exception(&NEXT_STATE, code, pc, badvaddr);
+		STATE_DIRTY |= 1ull << REG_COP0;
+	}
+	REDIRECT_PENDING = TRUE;
+}
+
+/************************************************************/
+/* Drop an instruction from a latch of the next bank                     */
+/************************************************************/
+void squash_latch(CPU_Pipeline_Reg *latch){
+	if (latch->seq == 0){
+		return;
+	}
+	INSTRUCTION_COUNT--;
+	SQUASHED_INSTRUCTIONS++;
+	if (latch->seq == SYSCALL_SEQ){
+		SYSCALL_SEQ = 0;
+	}
+	memset(latch, 0, sizeof(*latch));
+}
+
+/************************************************************/
+/* Clock edge work for COP0, only while a redirect is pending or      */
+/* Status has IE/EXL set: count handler cycles, take an interrupt,  */
+/* and squash the instructions fetched and decoded this cycle for a */
+/* redirect.                                                                                       */
+/************************************************************/
+void cop0_edge(){
+	uint32_t status = NEXT_STATE.COP0[COP0_STATUS], pending;
+
+	if (CURRENT_STATE.COP0[COP0_STATUS] & STATUS_EXL){
+		HANDLER_CYCLES[HANDLER_CAUSE]++;
+	}
+	if (!REDIRECT_PENDING && (status & (STATUS_IE | STATUS_EXL)) == STATUS_IE && (status & STATUS_IM) != 0){
+		pending = interrupt_lines();
+		if (pending & status & STATUS_IM){
+			/*the oldest instruction not yet past EX resumes after the handler*/
+			REDIRECT_PC = NEXT_STATE.PC;
+			if (NEXT_LATCHES->id_if.seq != 0){
+				REDIRECT_PC = NEXT_LATCHES->id_if.PC - 4;
+			}
+			if (NEXT_LATCHES->if_ex.seq != 0){
+				REDIRECT_PC = NEXT_LATCHES->if_ex.PC - 4;
+			}
+			NEXT_STATE.COP0[COP0_CAUSE] = (NEXT_STATE.COP0[COP0_CAUSE] & ~CAUSE_IP) | pending;
+			REDIRECT_PC = enter_exception(&NEXT_STATE, EXC_INT, REDIRECT_PC, 0);
+			STATE_DIRTY |= 1ull << REG_COP0;
+			REDIRECT_PENDING = TRUE;
+		}
+	}
+	if (REDIRECT_PENDING){
+		squash_latch(&NEXT_LATCHES->if_ex);
+		squash_latch(&NEXT_LATCHES->id_if);
+		write_register(REG_PC, REDIRECT_PC);
+		if (REDIRECT_HOLD != 0){
+			SYSCALL_SEQ = REDIRECT_HOLD;
+			REDIRECT_HOLD = 0;
+		}
+		REDIRECT_PENDING = FALSE;
+	}
+}
+
+/************************************************************/
+/* Load the kernel image (same format as programs) at the          */
+/* exception vector                                                                         */
+/************************************************************/
+void load_kernel(){
+	program_image_t *image;
+	uint32_t i;
+
+	KERNEL_SIZE = 0;
+	if (kernel_file[0] == '\0'){
+		return;
+	}
+	image = load_program_image(kernel_file);
+	if (image == NULL){
+		printf("Error: Can't open kernel file %s\n", kernel_file);
+		kernel_file[0] = '\0';
+		return;
+	}
+	for (i = 0; i < image->count; i++){
+		mem_write_32(EXCEPTION_VECTOR + 4*i, image->words[i]);
+	}
+	KERNEL_SIZE = image->count;
+	if (!QUIET){
+		printf("Kernel loaded at 0x%08x.\n%d words written into memory.\n\n", EXCEPTION_VECTOR, KERNEL_SIZE);
+	}
+}
+
+/************************************************************/
+/* Functional (ISA-level) model: execute the instruction at      */
+/* state->PC in one step.  Branches and jumps take effect          */
+/* immediately (no delay slot).                                                          */
+/************************************************************/
+int functional_step(CPU_State *state){
+	return functional_retire(state, NULL);
+}
+
+/************************************************************/
+/* functional_step, also describing the retired instruction in      */
+/* <record> (when not NULL) for a decoupled timing model.           */
+/************************************************************/
+int functional_retire(CPU_State *state, retire_record_t *record){
+	uint32_t instruction, opcode, function, rs, rt, rd, sa, immediate, simm, a, b, address, word;
+	uint32_t npc = state->PC + 4, exception = EXC_NONE;
+	uint64_t product;
+	int status = FUNC_OK;
+
+	instruction = mem_read_32(state->PC);
+	opcode = (instruction & 0xFC000000) >> 26;
+	function = instruction & 0x0000003F;
+	rs = (instruction & 0x03E00000) >> 21;
+	rt = (instruction & 0x001F0000) >> 16;
+	rd = (instruction & 0x0000F800) >> 11;
+	sa = (instruction & 0x000007C0) >> 6;
+	immediate = instruction & 0x0000FFFF;
+	simm = (immediate & 0x8000) ? (immediate | 0xFFFF0000) : immediate;
+	a = state->REGS[rs];
+	b = state->REGS[rt];
+	address = a + simm;
+	if (record != NULL){
+		record->pc = state->PC;
+		record->instruction = instruction;
+		record->a = a;
+		record->b = b;
+		record->address = (opcode >= 0x20) ? address : 0;
+	}
+
+	if(opcode == 0x00){
+		switch(function){
+			case 0x00: state->REGS[rd] = b << sa; break;	//SLL
+			case 0x02: state->REGS[rd] = b >> sa; break;	//SRL
+			case 0x03: state->REGS[rd] = (uint32_t)((int32_t)b >> sa); break;	//SRA
+			case 0x08: npc = a; break;	//JR
+			case 0x09: state->REGS[rd] = state->PC + 4; npc = a; break;	//JALR
+			case 0x0C:	//SYSCALL
+				switch (emulate_syscall(state, &word)){
+					case SYSCALL_EXIT: status = FUNC_EXIT; break;
+					case SYSCALL_RESULT: state->REGS[2] = word; break;
+				}
+				break;
+			case 0x10: state->REGS[rd] = state->HI; break;	//MFHI
+			case 0x11: state->HI = a; break;	//MTHI
+			case 0x12: state->REGS[rd] = state->LO; break;	//MFLO
+			case 0x13: state->LO = a; break;	//MTLO
+			case 0x18:	//MULT
+				product = (uint64_t)((int64_t)(int32_t)a * (int64_t)(int32_t)b);
+				state->LO = (uint32_t)product;
+				state->HI = (uint32_t)(product >> 32);
+				break;
+			case 0x19:	//MULTU
+				product = (uint64_t)a * (uint64_t)b;
+				state->LO = (uint32_t)product;
+				state->HI = (uint32_t)(product >> 32);
+				break;
+			case 0x1A:	//DIV
+				if (b != 0 && !(a == 0x80000000 && b == 0xFFFFFFFF)){
+					state->LO = (uint32_t)((int32_t)a / (int32_t)b);
+					state->HI = (uint32_t)((int32_t)a % (int32_t)b);
+				}
+				break;
+			case 0x1B:	//DIVU
+				if (b != 0){
+					state->LO = a / b;
+					state->HI = a % b;
+				}
+				break;
+			case 0x20:	//ADD
+				word = a + b;
+				if (((a ^ word) & (b ^ word)) >> 31){
+					exception = EXC_OV;
+				}else{
+					state->REGS[rd] = word;
+				}
+				break;
+			case 0x21: state->REGS[rd] = a + b; break;	//ADDU
+			case 0x22:	//SUB
+				word = a - b;
+				if (((a ^ b) & (a ^ word)) >> 31){
+					exception = EXC_OV;
+				}else{
+					state->REGS[rd] = word;
+				}
+				break;
+			case 0x23: state->REGS[rd] = a - b; break;	//SUBU
+			case 0x24: state->REGS[rd] = a & b; break;	//AND
+			case 0x25: state->REGS[rd] = a | b; break;	//OR
+			case 0x26: state->REGS[rd] = a ^ b; break;	//XOR
+			case 0x27: state->REGS[rd] = ~(a | b); break;	//NOR
+			case 0x2A: state->REGS[rd] = (int32_t)a < (int32_t)b; break;	//SLT
+			default:
+				if (!instruction_known(instruction)){
+					exception = EXC_RI;
+				}
+				break;
+		}
+	}
+	else{
+		switch(opcode){
+			case 0x01:	//BLTZ, BGEZ
+				if ((rt == 0 && (int32_t)a < 0) || (rt == 1 && (int32_t)a >= 0)){
+					npc = state->PC + 4 + (simm << 2);
+				}
+				break;
+			case 0x03:	//JAL
+				state->REGS[31] = state->PC + 4;
+				/* fall through */
+			case 0x02:	//J
+				npc = ((state->PC + 4) & 0xF0000000) | ((instruction & 0x03FFFFFF) << 2);
+				break;
+			case 0x04: if (a == b) npc = state->PC + 4 + (simm << 2); break;	//BEQ
+			case 0x05: if (a != b) npc = state->PC + 4 + (simm << 2); break;	//BNE
+			case 0x06: if ((int32_t)a <= 0) npc = state->PC + 4 + (simm << 2); break;	//BLEZ
+			case 0x07: if ((int32_t)a > 0) npc = state->PC + 4 + (simm << 2); break;	//BGTZ
+			case 0x08:	//ADDI
+				word = a + simm;
+				if (((a ^ word) & (simm ^ word)) >> 31){
+					exception = EXC_OV;
+				}else{
+					state->REGS[rt] = word;
+				}
+				break;
+			case 0x09: state->REGS[rt] = a + simm; break;	//ADDIU
+			case 0x0A: state->REGS[rt] = (int32_t)a < (int32_t)simm; break;	//SLTI
+			case 0x0C: state->REGS[rt] = a & immediate; break;	//ANDI
+			case 0x0D: state->REGS[rt] = a | immediate; break;	//ORI
+			case 0x0E: state->REGS[rt] = a ^ immediate; break;	//XORI
+			case 0x0F: state->REGS[rt] = immediate << 16; break;	//LUI
+			case 0x20:	//LB
+				word = mem_read_32(address & ~3u);
+				state->REGS[rt] = (uint32_t)(int32_t)(int8_t)(word >> (8 * (address & 3)));
+				break;
+			case 0x21:	//LH
+				if (address & 1){
+					exception = EXC_ADEL;
+					break;
+				}
+				word = mem_read_32(address & ~3u);
+				state->REGS[rt] = (uint32_t)(int32_t)(int16_t)(word >> (8 * (address & 2)));
+				break;
+			case 0x23:	//LW
+				if (address & 3){
+					exception = EXC_ADEL;
+				}else{
+					state->REGS[rt] = mem_read_32(address);
+				}
+				break;
+			case 0x28:	//SB
+				word = mem_read_32(address & ~3u);
+				word &= ~(0xFFu << (8 * (address & 3)));
+				mem_write_32(address & ~3u, word | ((b & 0xFF) << (8 * (address & 3))));
+				break;
+			case 0x29:	//SH
+				if (address & 1){
+					exception = EXC_ADES;
+					break;
+				}
+				word = mem_read_32(address & ~3u);
+				word &= ~(0xFFFFu << (8 * (address & 2)));
+				mem_write_32(address & ~3u, word | ((b & 0xFFFF) << (8 * (address & 2))));
+				break;
+			case 0x2B:	//SW
+				if (address & 3){
+					exception = EXC_ADES;
+				}else{
+					mem_write_32(address, b);
+				}
+				break;
+			case 0x10:	//COP0
+				if (cop0_mnemonic(instruction) == NULL){
+					exception = EXC_RI;
+				}else if (rs == 0x00){	//MFC0
+					state->REGS[rt] = cop0_read(state, rd);
+				}else if (rs == 0x04){	//MTC0
+					cop0_write(state, rd, b);
+				}else{	//ERET
+					state->COP0[COP0_STATUS] &= ~STATUS_EXL;
+					npc = state->COP0[COP0_EPC];
+				}
+				break;
+			default:
+				if (!instruction_known(instruction)){
+					exception = EXC_RI;
+				}
+				break;
+		}
+	}
+	if (exception != EXC_NONE){
+		if (KERNEL_SIZE == 0){
+			report_exception(exception, state->PC, address);
+			return FUNC_EXIT;
+		}
+		npc = enter_exception(state, exception, state->PC, address);
+	}
+	state->REGS[0] = 0;
+	state->PC = npc;
+	if (record != NULL){
+		record->next_pc = npc;
+	}
+	return status;
+}
+
+/************************************************************/
+/* Has the functional model run off the end of the program?         */
+/************************************************************/
+int functional_out_of_program(const CPU_State *state){
+	return state->PC < MEM_KTEXT_BEGIN && state->PC >= MEM_TEXT_BEGIN + 4*PROGRAM_SIZE;
+}
+
+/************************************************************/
+/* Restart the detailed pipeline from an architectural state        */
+/************************************************************/
+void pipeline_start(const CPU_State *state){
+	CURRENT_STATE = *state;
+	NEXT_STATE = CURRENT_STATE;
+	clear_pipeline();
+	if (MEMORY_MODEL != NULL){
+		MEMORY_MODEL->idle(MEMORY_MODEL);
+	}
+	prefetch_idle();
+	RUN_FLAG = TRUE;
+}
+
+/************************************************************/
+/* Save the architectural state and every dirty memory page,       */
+/* counting the pages of a program image mapped over the text       */
+/************************************************************/
+void checkpoint_save(checkpoint_t *checkpoint, const CPU_State *state, uint64_t instructions){
+	uint32_t region, page, pages, shared, count = 0;
+
+	for (region = 0; region < NUM_MEM_REGION; region++){
+		pages = (MEM_REGIONS[region].end - MEM_REGIONS[region].begin) / MEM_PAGE_SIZE + 1;
+		for (page = 0; page < pages; page += 8){
+			count += __builtin_popcount(MEM_REGIONS[region].dirty[page >> 3]);
+		}
+	}
+	count += TEXT_SHARED_LENGTH / MEM_PAGE_SIZE;	/* the program image mapped over the text */
+
+	checkpoint->state = *state;
+	checkpoint->instructions = instructions;
+	checkpoint->heap_break = HEAP_BREAK;
+	checkpoint->page_count = 0;
+	checkpoint->page_address = malloc((count + 1) * sizeof(uint32_t));
+	checkpoint->page_data = malloc((size_t)(count + 1) * MEM_PAGE_SIZE);
+	for (region = 0; region < NUM_MEM_REGION; region++){
+		pages = (MEM_REGIONS[region].end - MEM_REGIONS[region].begin) / MEM_PAGE_SIZE + 1;
+		shared = region == MEM_TEXT_REGION ? TEXT_SHARED_LENGTH / MEM_PAGE_SIZE : 0;
+		for (page = 0; page < pages; page++){
+			if (page >= shared && MEM_REGIONS[region].dirty[page >> 3] == 0){
+				page |= 7;	/* skip the clean byte of the bitmap */
+				continue;
+			}
+			if (page >= shared && !((MEM_REGIONS[region].dirty[page >> 3] >> (page & 7)) & 1)){
+				continue;
+			}
+			checkpoint->page_address[checkpoint->page_count] = MEM_REGIONS[region].begin + page * MEM_PAGE_SIZE;
+			memcpy(checkpoint->page_data + (size_t)checkpoint->page_count * MEM_PAGE_SIZE,
+				MEM_REGIONS[region].mem + (size_t)page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+			checkpoint->page_count++;
+		}
+	}
+}
+
+/************************************************************/
+/* Rebuild memory from a checkpoint and restart the pipeline there */
+/************************************************************/
+void checkpoint_restore(const checkpoint_t *checkpoint){
+	uint32_t i, address;
+	int region;
+
+	clear_memory();
+	for (i = 0; i < checkpoint->page_count; i++){
+		address = checkpoint->page_address[i];
+		region = mem_region_index(address, MEM_PAGE_SIZE);
+		memcpy(MEM_REGIONS[region].mem + (address - MEM_REGIONS[region].begin),
+			checkpoint->page_data + (size_t)i * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+		mark_dirty(region, address - MEM_REGIONS[region].begin, MEM_PAGE_SIZE);
+	}
+	HEAP_BREAK = checkpoint->heap_break;
+	pipeline_start(&checkpoint->state);
+}
+
+/************************************************************/
+/* Release a checkpoint's page copies                                             */
+/************************************************************/
+void checkpoint_free(checkpoint_t *checkpoint){
+	free(checkpoint->page_address);
+	free(checkpoint->page_data);
+	checkpoint->page_address = NULL;
+	checkpoint->page_data = NULL;
+	checkpoint->page_count = 0;
+}
+
+/************************************************************/
+/* Basic-block id (1-based) for a block leader PC                        */
+/************************************************************/
+uint32_t bbv_block_id(bbv_t *bbv, uint32_t pc){
+	uint32_t slot, i;
+
+	if (2 * (bbv->block_count + 1) >= bbv->table_size){
+		uint32_t old_size = bbv->table_size;
+		uint32_t *old_pc = bbv->table_pc, *old_id = bbv->table_id;
+		bbv->table_size = old_size ? 2 * old_size : 1024;
+		bbv->table_pc = calloc(bbv->table_size, sizeof(uint32_t));
+		bbv->table_id = calloc(bbv->table_size, sizeof(uint32_t));
+		for (i = 0; i < old_size; i++){
+			if (old_id[i] != 0){
+				slot = (old_pc[i] >> 2) * 2654435761u & (bbv->table_size - 1);
+				while (bbv->table_id[slot] != 0){
+					slot = (slot + 1) & (bbv->table_size - 1);
+				}
+				bbv->table_pc[slot] = old_pc[i];
+				bbv->table_id[slot] = old_id[i];
+			}
+		}
+		free(old_pc);
+		free(old_id);
+		bbv->counts = realloc(bbv->counts, bbv->table_size * sizeof(uint64_t));
+		memset(bbv->counts + old_size, 0, (bbv->table_size - old_size) * sizeof(uint64_t));
+	}
+
+	slot = (pc >> 2) * 2654435761u & (bbv->table_size - 1);
+	while (bbv->table_id[slot] != 0){
+		if (bbv->table_pc[slot] == pc){
+			return bbv->table_id[slot];
+		}
+		slot = (slot + 1) & (bbv->table_size - 1);
+	}
+	bbv->table_pc[slot] = pc;
+	bbv->table_id[slot] = ++bbv->block_count;
+	return bbv->block_count;
+}
+
+/************************************************************/
+/* Write one interval's vector in SimPoint .bb format                    */
+/************************************************************/
+void bbv_flush_interval(bbv_t *bbv, FILE *fp){
+	uint32_t id;
+
+	fprintf(fp, "T");
+	for (id = 1; id <= bbv->block_count; id++){
+		if (bbv->counts[id] != 0){
+			fprintf(fp, ":%u:%llu ", id, (unsigned long long)bbv->counts[id]);
+			bbv->counts[id] = 0;
+		}
+	}
+	fprintf(fp, "\n");
+}
+
+/************************************************************/
+/* Run the functional model to completion from a fresh reset,      */
+/* writing a basic-block vector every <interval> instructions.        */
+/************************************************************/
+int collect_bbv(uint64_t interval, const char *filename){
+	FILE *fp;
+	bbv_t bbv;
+	CPU_State state;
+	uint32_t leader, instruction, id;
+	uint64_t executed = 0, in_interval = 0, intervals = 0, block_length = 0;
+	int status = FUNC_OK;
+
+	fp = fopen(filename, "w");
+	if (fp == NULL){
+		perror(filename);
+		return CMD_ERROR;
+	}
+	memset(&bbv, 0, sizeof(bbv));
+	reset();
+	state = CURRENT_STATE;
+	leader = state.PC;
+
+	while (status == FUNC_OK && !functional_out_of_program(&state)){
+		instruction = mem_read_32(state.PC);
+		status = functional_step(&state);
+		executed++;
+		in_interval++;
+		block_length++;
+		/*a block ends at a control transfer; long straight-line code is cut at
+		  fixed PC boundaries so the same code always gets the same block ids*/
+		if (is_control_transfer(instruction) || state.PC % (4 * BBV_MAX_BLOCK) == 0 || status != FUNC_OK){
+			id = bbv_block_id(&bbv, leader);
+			bbv.counts[id] += block_length;
+			block_length = 0;
+			leader = state.PC;
+			/*intervals end on block boundaries, so they may run slightly long*/
+			if (in_interval >= interval){
+				bbv_flush_interval(&bbv, fp);
+				in_interval = 0;
+				intervals++;
+			}
+		}
+	}
+	if (in_interval > 0){
+		bbv_flush_interval(&bbv, fp);
+		intervals++;
+	}
+	fclose(fp);
+	guest_flush();
+
+	CURRENT_STATE = state;
+	NEXT_STATE = state;
+	RUN_FLAG = FALSE;
+	printf("%llu instructions, %llu intervals of %llu, %u basic blocks written to %s\n\n",
+		(unsigned long long)executed, (unsigned long long)intervals, (unsigned long long)interval,
+		bbv.block_count, filename);
+	free(bbv.table_pc);
+	free(bbv.table_id);
+	free(bbv.counts);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Run the detailed pipeline until <count> more instructions are  */
+/* fetched; returns the cycles it took                                            */
+/************************************************************/
+uint64_t detailed_run(uint64_t count){
+	uint64_t cycles = 0;
+	uint32_t start = INSTRUCTION_COUNT;
+
+	while (RUN_FLAG && INSTRUCTION_COUNT - start < count){
+		cycle();
+		cycles++;
+	}
+	return cycles;
+}
+
+/************************************************************/
+/* Simulate only the chosen intervals in detail and combine them  */
+/* into weighted CPI and cycle estimates.                                        */
+/************************************************************/
+int run_simpoints(const char *points_file, const char *weights_file, uint64_t interval, uint64_t warmup){
+	FILE *fp;
+	simpoint_t *points = NULL;
+	checkpoint_t *checkpoints;
+	CPU_State state;
+	uint64_t executed = 0, start, cycles, instructions;
+	uint32_t count = 0, capacity = 0, i, j, cluster, loaded, heap_break;
+	unsigned long long index;
+	double weight, cpi = 0, variance = 0, total_weight = 0, bound;
+	int status = FUNC_OK;
+
+	fp = fopen(points_file, "r");
+	if (fp == NULL){
+		perror(points_file);
+		return CMD_ERROR;
+	}
+	while (fscanf(fp, "%llu %u", &index, &cluster) == 2){
+		if (count == capacity){
+			capacity = capacity ? 2 * capacity : 16;
+			points = realloc(points, capacity * sizeof(simpoint_t));
+		}
+		points[count].interval = index;
+		points[count].cluster = cluster;
+		points[count].weight = 0;
+		count++;
+	}
+	fclose(fp);
+	fp = fopen(weights_file, "r");
+	if (fp == NULL){
+		perror(weights_file);
+		free(points);
+		return CMD_ERROR;
+	}
+	loaded = 0;
+	while (fscanf(fp, "%lf %u", &weight, &cluster) == 2){
+		for (i = 0; i < count; i++){
+			if (points[i].cluster == cluster){
+				points[i].weight = weight;
+				loaded++;
+			}
+		}
+	}
+	fclose(fp);
+	if (count == 0 || loaded != count){
+		printf("Error: %s and %s do not describe the same simulation points\n", points_file, weights_file);
+		free(points);
+		return CMD_ERROR;
+	}
+
+	/*simulation points in program order, so one functional pass reaches them all*/
+	for (i = 1; i < count; i++){
+		simpoint_t key = points[i];
+		for (j = i; j > 0 && points[j - 1].interval > key.interval; j--){
+			points[j] = points[j - 1];
+		}
+		points[j] = key;
+	}
+
+	/*fast-forward functionally, dropping a checkpoint <warmup> instructions before each point*/
+	checkpoints = calloc(count, sizeof(checkpoint_t));
+	reset();
+	state = CURRENT_STATE;
+	for (i = 0; i < count; i++){
+		start = points[i].interval * interval;
+		start = start > warmup ? start - warmup : 0;
+		while (executed < start && status == FUNC_OK && !functional_out_of_program(&state)){
+			status = functional_step(&state);
+			executed++;
+		}
+		checkpoint_save(&checkpoints[i], &state, executed);
+	}
+	while (status == FUNC_OK && !functional_out_of_program(&state)){
+		status = functional_step(&state);
+		executed++;
+	}
+	heap_break = HEAP_BREAK;
+	guest_flush();
+
+	/*the program's output was produced by the functional run; replays are silent*/
+	GUEST_SILENT = TRUE;
+	printf("-------------------------------------------------------------\n");
+	printf("[Interval]\t[Weight]\t[Instructions]\t[Cycles]\t[CPI]\n");
+	for (i = 0; i < count; i++){
+		checkpoint_restore(&checkpoints[i]);
+		INSTRUCTION_COUNT = 0;
+		CYCLE_COUNT = 0;
+		if (INTERVAL_CYCLES != 0){
+			interval_start();
+		}
+		detailed_run(points[i].interval * interval - checkpoints[i].instructions);
+		instructions = INSTRUCTION_COUNT;
+		cycles = detailed_run(interval);
+		instructions = INSTRUCTION_COUNT - instructions;
+		points[i].cpi = instructions ? (double)cycles / instructions : 0;
+		printf("%llu\t\t%.4f\t\t%llu\t\t%llu\t\t%.4f\n", (unsigned long long)points[i].interval, points[i].weight,
+			(unsigned long long)instructions, (unsigned long long)cycles, points[i].cpi);
+		cpi += points[i].weight * points[i].cpi;
+		total_weight += points[i].weight;
+		checkpoint_free(&checkpoints[i]);
+	}
+	GUEST_SILENT = FALSE;
+	HEAP_BREAK = heap_break;
+	if (total_weight > 0){
+		cpi /= total_weight;
+	}
+	for (i = 0; i < count; i++){
+		variance += points[i].weight * (points[i].cpi - cpi) * (points[i].cpi - cpi);
+	}
+	if (total_weight > 0){
+		variance /= total_weight;
+	}
+	/*treat the points as a weighted sample of the program's intervals*/
+	bound = 1.96 * sqrt(variance / count);
+
+	printf("-------------------------------------------------------------\n");
+	printf("Functional instructions\t: %llu\n", (unsigned long long)executed);
+	printf("Weighted CPI\t\t: %.4f +/- %.4f (95%%)\n", cpi, bound);
+	printf("Estimated cycles\t: %.0f +/- %.0f\n", cpi * executed, bound * executed);
+	printf("-------------------------------------------------------------\n\n");
+
+	free(checkpoints);
+	free(points);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* bbv <interval> <file>                                                                   */
+/* simpoint <points> <weights> <interval> [warmup]                      */
+/************************************************************/
+int simpoint_command(int argc, char **argv){
+	uint32_t interval, warmup = 0;
+
+	if (strcmp(argv[0], "bbv") == 0){
+		if (argc != 3 || !parse_value(argv[1], 10, &interval) || interval == 0){
+			return CMD_ERROR;
+		}
+		collect_bbv(interval, argv[2]);
+		return CMD_OK;
+	}
+	if ((argc != 4 && argc != 5) || !parse_value(argv[3], 10, &interval) || interval == 0 ||
+			(argc == 5 && !parse_value(argv[4], 10, &warmup))){
+		return CMD_ERROR;
+	}
+	run_simpoints(argv[1], argv[2], interval, warmup);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Reap one interval worker, then store every result it and its      */
+/* siblings have sent so far (the pipe is non-blocking)                 */
+/************************************************************/
+void collect_interval_results(int fd, interval_result_t **results, uint32_t *capacity){
+	interval_result_t result;
+	uint32_t old;
+
+	while (wait(NULL) < 0 && errno == EINTR);
+	while (read(fd, &result, sizeof(result)) == sizeof(result)){
+		if (result.index >= *capacity){
+			old = *capacity;
+			*capacity = 2 * result.index + 16;
+			*results = realloc(*results, *capacity * sizeof(interval_result_t));
+			memset(*results + old, 0, (*capacity - old) * sizeof(interval_result_t));
+		}
+		(*results)[result.index] = result;
+	}
+}
+
+/************************************************************/
+/* Simulate a long program interval by interval on <jobs> cores.   */
+/* A functional pass forks a worker at the start of each interval   */
+/* (less <warmup> instructions); the forked copy of the machine is  */
+/* the checkpoint, and the worker times its interval in the              */
+/* detailed pipeline.                                                                             */
+/************************************************************/
+int run_parallel(uint64_t interval, uint32_t jobs, uint64_t warmup){
+	CPU_State state;
+	interval_result_t *results = NULL, result;
+	uint32_t capacity = 0, running = 0, intervals = 0, i;
+	uint64_t executed = 0, start, cycles = 0, instructions = 0, wall = host_time_ns();
+	int status = FUNC_OK, fds[2];
+	pid_t pid;
+
+	if (pipe(fds) != 0){
+		perror("pipe");
+		return CMD_ERROR;
+	}
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	reset();
+	state = CURRENT_STATE;
+	while (status == FUNC_OK && !functional_out_of_program(&state)){
+		start = (uint64_t)intervals * interval;
+		start = start > warmup ? start - warmup : 0;
+		while (executed < start && status == FUNC_OK && !functional_out_of_program(&state)){
+			status = functional_step(&state);
+			executed++;
+		}
+		if (status != FUNC_OK || functional_out_of_program(&state)){
+			break;
+		}
+
+		if (running == jobs){
+			collect_interval_results(fds[0], &results, &capacity);
+			running--;
+		}
+		guest_flush();
+		fflush(stdout);
+		pid = fork();
+		if (pid < 0){
+			perror("fork");
+			break;
+		}
+		if (pid == 0){
+			close(fds[0]);
+			QUIET = TRUE;
+			GUEST_SILENT = TRUE;
+			PROFILE_ENABLED = FALSE;
+			TRACE_FILE = NULL;
+			PIPEVIEW_FD = -1;
+			INTERVAL_CYCLES = 0;
+			INTERVAL_FILE = NULL;
+			ROI_FAST = FALSE;
+			pipeline_start(&state);
+			INSTRUCTION_COUNT = 0;
+			detailed_run((uint64_t)intervals * interval - executed);
+			memset(&result, 0, sizeof(result));
+			result.index = intervals;
+			result.instructions = INSTRUCTION_COUNT;
+			result.cycles = detailed_run(interval);
+			result.instructions = INSTRUCTION_COUNT - result.instructions;
+			if (write(fds[1], &result, sizeof(result)) != sizeof(result)){
+				_exit(1);
+			}
+			_exit(0);
+		}
+		running++;
+		intervals++;
+	}
+	while (running > 0){
+		collect_interval_results(fds[0], &results, &capacity);
+		running--;
+	}
+	guest_flush();
+	close(fds[0]);
+	close(fds[1]);
+	wall = host_time_ns() - wall;
+
+	printf("-------------------------------------------------------------\n");
+	printf("[Interval]\t[Instructions]\t[Cycles]\t[CPI]\n");
+	for (i = 0; i < intervals; i++){
+		if (i >= capacity || results[i].cycles == 0){
+			printf("%u\t\t(worker failed)\n", i);
+			continue;
+		}
+		printf("%u\t\t%llu\t\t%llu\t\t%.4f\n", i, (unsigned long long)results[i].instructions,
+			(unsigned long long)results[i].cycles,
+			results[i].instructions ? (double)results[i].cycles / results[i].instructions : 0.0);
+		instructions += results[i].instructions;
+		cycles += results[i].cycles;
+	}
+	printf("-------------------------------------------------------------\n");
+	printf("Intervals\t\t: %u (%u jobs, %llu warmup)\n", intervals, jobs, (unsigned long long)warmup);
+	printf("Functional instructions\t: %llu\n", (unsigned long long)executed);
+	printf("Detailed instructions\t: %llu\n", (unsigned long long)instructions);
+	printf("Detailed cycles\t\t: %llu\n", (unsigned long long)cycles);
+	printf("CPI\t\t\t: %.4f\n", instructions ? (double)cycles / instructions : 0.0);
+	printf("Wall time (ms)\t\t: %.1f\n", wall / 1e6);
+	printf("-------------------------------------------------------------\n\n");
+
+	CURRENT_STATE = state;
+	NEXT_STATE = state;
+	RUN_FLAG = FALSE;
+	free(results);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* parallel <interval> <jobs> [warmup]                                              */
+/************************************************************/
+int parallel_command(int argc, char **argv){
+	uint32_t interval, jobs, warmup = 0;
+
+	if ((argc != 3 && argc != 4) || !parse_value(argv[1], 10, &interval) || interval == 0 ||
+			!parse_value(argv[2], 10, &jobs) || jobs == 0 ||
+			(argc == 4 && !parse_value(argv[3], 10, &warmup))){
+		return CMD_ERROR;
+	}
+	run_parallel(interval, jobs, warmup);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Registers read by an instruction, as a bit mask (bit 32 is HI,  */
+/* bit 33 is LO); the registers it writes go to <writes>.              */
+/************************************************************/
+uint64_t register_uses(uint32_t instruction, uint64_t *writes){
+	uint32_t opcode = (instruction & 0xFC000000) >> 26;
+	uint32_t function = instruction & 0x0000003F;
+	uint64_t rs = 1ull << ((instruction & 0x03E00000) >> 21);
+	uint64_t rt = 1ull << ((instruction & 0x001F0000) >> 16);
+	uint64_t rd = 1ull << ((instruction & 0x0000F800) >> 11);
+	uint64_t hi = 1ull << 32, lo = 1ull << 33, reads = 0;
+
+	*writes = 0;
+	if (opcode == 0x00){
+		switch(function){
+			case 0x00: case 0x02: case 0x03: reads = rt; *writes = rd; break;	//SLL, SRL, SRA
+			case 0x08: reads = rs; break;	//JR
+			case 0x09: reads = rs; *writes = rd; break;	//JALR
+			case 0x0C: reads = 1ull << 2; break;	//SYSCALL
+			case 0x10: reads = hi; *writes = rd; break;	//MFHI
+			case 0x11: reads = rs; *writes = hi; break;	//MTHI
+			case 0x12: reads = lo; *writes = rd; break;	//MFLO
+			case 0x13: reads = rs; *writes = lo; break;	//MTLO
+			case 0x18: case 0x19: case 0x1A: case 0x1B: reads = rs | rt; *writes = hi | lo; break;	//MULT, DIV
+			default: reads = rs | rt; *writes = rd; break;
+		}
+	}
+	else{
+		switch(opcode){
+			case 0x01: case 0x06: case 0x07: reads = rs; break;	//BLTZ, BGEZ, BLEZ, BGTZ
+			case 0x02: break;	//J
+			case 0x03: *writes = 1ull << 31; break;	//JAL
+			case 0x04: case 0x05: reads = rs | rt; break;	//BEQ, BNE
+			case 0x0F: *writes = rt; break;	//LUI
+			case 0x10:	//MFC0, MTC0, ERET
+				if ((instruction & 0x03E00000) == 0){
+					*writes = rt;
+				}else if ((instruction & 0x03E00000) == (0x04 << 21)){
+					reads = rt;
+				}
+				break;
+			case 0x28: case 0x29: case 0x2B: reads = rs | rt; break;	//SB, SH, SW
+			default: reads = rs; *writes = rt; break;	//immediate ALU ops and loads
+		}
+	}
+	*writes &= ~1ull;
+	return reads & ~1ull;
+}
+
+/************************************************************/
+/* In-order 5-stage timing model (IF ID EX MEM WB).  With             */
+/* forwarding a load's reader waits one cycle; without it, every      */
+/* reader waits in ID for the writer's WB.  Jumps redirect fetch      */
+/* from ID (one bubble), taken branches from EX (two bubbles).       */
+/************************************************************/
+void inorder_reset(timing_model_t *model){
+	inorder_timing_t *timing = (inorder_timing_t *)model;
+	int forwarding = timing->forwarding;
+
+	memset((char *)timing + sizeof(timing->base), 0, sizeof(*timing) - sizeof(timing->base));
+	timing->forwarding = forwarding;
+	timing->decode = 1;	/* the first instruction is fetched in cycle 1 */
+}
+
+void inorder_retire(timing_model_t *model, const retire_record_t *record){
+	inorder_timing_t *timing = (inorder_timing_t *)model;
+	uint64_t writes, reads = register_uses(record->instruction, &writes);
+	uint64_t decode = timing->decode + 1, earliest = decode, latency;
+	uint32_t opcode = record->instruction >> 26;
+	int reg, load_stall = FALSE;
+
+	if (timing->fetch_ready > earliest){
+		timing->control_stalls += timing->fetch_ready - earliest;
+		earliest = timing->fetch_ready;
+	}
+	decode = earliest;
+	while (reads != 0){
+		reg = __builtin_ctzll(reads);
+		reads &= reads - 1;
+		if (timing->ready[reg] > decode){
+			decode = timing->ready[reg];
+			load_stall = timing->ready_load[reg];
+		}
+	}
+	if (load_stall){
+		timing->load_use_stalls += decode - earliest;
+	}
+	else{
+		timing->raw_stalls += decode - earliest;
+	}
+
+	latency = timing->forwarding ? ((opcode >= 0x20 && opcode < 0x28) ? 2 : 1) : 3;
+	while (writes != 0){
+		reg = __builtin_ctzll(writes);
+		writes &= writes - 1;
+		timing->ready[reg] = decode + latency;
+		timing->ready_load[reg] = (opcode >= 0x20 && opcode < 0x28);
+	}
+	if (record->next_pc != record->pc + 4){
+		/* J, JAL, JR and JALR resolve in ID, branches in EX */
+		timing->fetch_ready = decode + ((opcode <= 0x03 && opcode != 0x01) ? 2 : 3);
+	}
+	timing->decode = decode;
+	timing->instructions++;
+}
+
+uint64_t inorder_cycles(timing_model_t *model){
+	inorder_timing_t *timing = (inorder_timing_t *)model;
+	return timing->instructions ? timing->decode + 3 : 0;
+}
+
+void inorder_report(timing_model_t *model){
+	inorder_timing_t *timing = (inorder_timing_t *)model;
+	printf("Load-use stalls\t\t: %llu\n", (unsigned long long)timing->load_use_stalls);
+	printf("RAW stalls\t\t: %llu\n", (unsigned long long)timing->raw_stalls);
+	printf("Control stalls\t\t: %llu\n", (unsigned long long)timing->control_stalls);
+}
+
+inorder_timing_t INORDER_TIMING = {
+	{ "inorder", "in-order 5-stage pipeline with forwarding",
+		inorder_reset, inorder_retire, inorder_cycles, inorder_report }, TRUE };
+inorder_timing_t NOFORWARD_TIMING = {
+	{ "noforward", "in-order 5-stage pipeline without forwarding",
+		inorder_reset, inorder_retire, inorder_cycles, inorder_report }, FALSE };
+
+timing_model_t *TIMING_MODELS[] = { &INORDER_TIMING.base, &NOFORWARD_TIMING.base };
+#define NUM_TIMING_MODELS (sizeof(TIMING_MODELS) / sizeof(TIMING_MODELS[0]))
+
+/************************************************************/
+/* Timing thread: feed every record in RETIRE_QUEUE to the model.  */
+/************************************************************/
+void *timing_thread(void *arg){
+	timing_model_t *model = arg;
+	retire_queue_t *queue = RETIRE_QUEUE;
+	uint64_t head = atomic_load_explicit(&queue->head, memory_order_relaxed), tail;
+
+	for (;;){
+		tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+		if (tail == head){
+			if (atomic_load_explicit(&queue->done, memory_order_acquire) &&
+					atomic_load_explicit(&queue->tail, memory_order_acquire) == head){
+				break;
+			}
+			queue->consumer_waits++;
+			sched_yield();
+			continue;
+		}
+		while (head != tail){
+			model->retire(model, &queue->records[head & (RETIRE_QUEUE_SIZE - 1)]);
+			head++;
+			if ((head & (RETIRE_BATCH - 1)) == 0){
+				atomic_store_explicit(&queue->head, head, memory_order_release);
+			}
+		}
+		atomic_store_explicit(&queue->head, head, memory_order_release);
+	}
+	return NULL;
+}
+
+/************************************************************/
+/* Run the program functionally on this thread while <model>       */
+/* computes its timing on a second one, connected by a lock-free   */
+/* queue of retired instructions.                                                   */
+/************************************************************/
+int run_decoupled(timing_model_t *model){
+	CPU_State state;
+	retire_queue_t *queue;
+	pthread_t thread;
+	uint64_t head = 0, tail = 0, wall = host_time_ns(), cycles;
+	int status = FUNC_OK;
+
+	queue = aligned_alloc(64, sizeof(retire_queue_t));
+	if (queue == NULL){
+		printf("Out of memory\n");
+		return CMD_ERROR;
+	}
+	memset(queue, 0, sizeof(*queue));
+	RETIRE_QUEUE = queue;
+	reset();
+	state = CURRENT_STATE;
+	model->reset(model);
+	if (pthread_create(&thread, NULL, timing_thread, model) != 0){
+		printf("Could not start the timing thread\n");
+		free(queue);
+		return CMD_ERROR;
+	}
+
+	while (status == FUNC_OK && !functional_out_of_program(&state)){
+		while (tail - head == RETIRE_QUEUE_SIZE){
+			head = atomic_load_explicit(&queue->head, memory_order_acquire);
+			if (tail - head == RETIRE_QUEUE_SIZE){
+				queue->producer_waits++;
+				sched_yield();
+			}
+		}
+		status = functional_retire(&state, &queue->records[tail & (RETIRE_QUEUE_SIZE - 1)]);
+		tail++;
+		if ((tail & (RETIRE_BATCH - 1)) == 0){
+			atomic_store_explicit(&queue->tail, tail, memory_order_release);
+		}
+	}
+	atomic_store_explicit(&queue->tail, tail, memory_order_release);
+	atomic_store_explicit(&queue->done, TRUE, memory_order_release);
+	pthread_join(thread, NULL);
+	guest_flush();
+	wall = host_time_ns() - wall;
+	cycles = model->cycles(model);
+
+	printf("-------------------------------------------------------------\n");
+	printf("Timing model\t\t: %s (%s)\n", model->name, model->description);
+	printf("Instructions\t\t: %llu\n", (unsigned long long)tail);
+	printf("Cycles\t\t\t: %llu\n", (unsigned long long)cycles);
+	printf("CPI\t\t\t: %.4f\n", tail ? (double)cycles / tail : 0.0);
+	model->report(model);
+	printf("Queue full / empty waits: %llu / %llu\n", (unsigned long long)queue->producer_waits,
+		(unsigned long long)queue->consumer_waits);
+	printf("Wall time (ms)\t\t: %.1f\n", wall / 1e6);
+	printf("-------------------------------------------------------------\n\n");
+
+	CURRENT_STATE = state;
+	NEXT_STATE = state;
+	RUN_FLAG = FALSE;
+	RETIRE_QUEUE = NULL;
+	free(queue);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* decoupled [model]                                                                         */
+/************************************************************/
+int decoupled_command(int argc, char **argv){
+	uint32_t i;
+
+	if (argc > 2){
+		return CMD_ERROR;
+	}
+	for (i = 0; i < NUM_TIMING_MODELS; i++){
+		if (argc == 1 || strcmp(argv[1], TIMING_MODELS[i]->name) == 0){
+			return run_decoupled(TIMING_MODELS[i]);
+		}
+	}
+	printf("Unknown timing model: %s (models:", argv[1]);
+	for (i = 0; i < NUM_TIMING_MODELS; i++){
+		printf(" %s", TIMING_MODELS[i]->name);
+	}
+	printf(")\n");
+	return CMD_OK;
+}
+
+/************************************************************/
+/* Read a word as seen by one sweep lane                                        */
+/************************************************************/
+uint32_t sweep_read(sweep_t *sweep, uint32_t lane, uint32_t address){
+	sweep_overlay_t *overlay = &sweep->overlay[lane];
+	uint32_t slot;
+
+	if (overlay->count != 0){
+		slot = (address >> 2) * 2654435761u & (overlay->size - 1);
+		while (overlay->address[slot] != 0){
+			if (overlay->address[slot] == address){
+				return overlay->value[slot];
+			}
+			slot = (slot + 1) & (overlay->size - 1);
+		}
+	}
+	return mem_read_32(address);
+}
+
+/************************************************************/
+/* Write a word into one sweep lane's private overlay                    */
+/************************************************************/
+void sweep_write(sweep_t *sweep, uint32_t lane, uint32_t address, uint32_t value){
+	sweep_overlay_t *overlay = &sweep->overlay[lane];
+	uint32_t slot, i, old_size;
+	uint32_t *old_address, *old_value;
+
+	if (2 * (overlay->count + 1) >= overlay->size){
+		old_size = overlay->size;
+		old_address = overlay->address;
+		old_value = overlay->value;
+		overlay->size = old_size ? 2 * old_size : 16;
+		overlay->address = calloc(overlay->size, sizeof(uint32_t));
+		overlay->value = calloc(overlay->size, sizeof(uint32_t));
+		for (i = 0; i < old_size; i++){
+			if (old_address[i] != 0){
+				slot = (old_address[i] >> 2) * 2654435761u & (overlay->size - 1);
+				while (overlay->address[slot] != 0){
+					slot = (slot + 1) & (overlay->size - 1);
+				}
+				overlay->address[slot] = old_address[i];
+				overlay->value[slot] = old_value[i];
+			}
+		}
+		free(old_address);
+		free(old_value);
+	}
+
+	slot = (address >> 2) * 2654435761u & (overlay->size - 1);
+	while (overlay->address[slot] != 0 && overlay->address[slot] != address){
+		slot = (slot + 1) & (overlay->size - 1);
+	}
+	if (overlay->address[slot] == 0){
+		overlay->address[slot] = address;
+		overlay->count++;
+	}
+	overlay->value[slot] = value;
+}
+
+/* dst[i] = value for every lane (mask == NULL) or every masked lane */
+#define SWEEP_SET(dst, value) do{ \
+	if (mask == NULL){ \
+		for (i = 0; i < n; i++){ (dst)[i] = (value); } \
+	} \
+	else{ \
+		for (i = 0; i < n; i++){ (dst)[i] = mask[i] ? (value) : (dst)[i]; } \
+	} \
+}while(0)
+
+/* per-lane loop for memory and syscalls, which cannot be vectorized */
+#define SWEEP_EACH_LANE for (i = 0; i < sweep->lanes; i++) if (mask ? mask[i] : sweep->running[i])
+
+/************************************************************/
+/* Execute the instruction at <pc> on all lanes (mask == NULL) or     */
+/* on the lanes in <mask>.  Register rows are updated with plain        */
+/* per-lane loops the compiler turns into vector code.  Returns TRUE */
+/* if the instruction set the lanes' PCs (control transfer).               */
+/************************************************************/
+int sweep_execute(sweep_t *sweep, uint32_t instruction, uint32_t pc, const uint8_t *mask){
+	uint32_t opcode = (instruction & 0xFC000000) >> 26;
+	uint32_t function = instruction & 0x0000003F;
+	uint32_t rs = (instruction & 0x03E00000) >> 21;
+	uint32_t rt = (instruction & 0x001F0000) >> 16;
+	uint32_t rd = (instruction & 0x0000F800) >> 11;
+	uint32_t sa = (instruction & 0x000007C0) >> 6;
+	uint32_t immediate = instruction & 0x0000FFFF;
+	uint32_t simm = (immediate & 0x8000) ? (immediate | 0xFFFF0000) : immediate;
+	uint32_t target = pc + 4 + (simm << 2), next = pc + 4;
+	uint32_t n = sweep->stride, i, address, word;
+	uint32_t *A = sweep->regs + rs * n, *B = sweep->regs + rt * n;
+	uint32_t *D = sweep->regs + rd * n, *T = B;
+	uint32_t *HI = sweep->regs + 32 * n, *LO = sweep->regs + 33 * n, *P = sweep->pc;
+
+	if(opcode == 0x00){
+		switch(function){
+			case 0x08: SWEEP_SET(P, A[i]); return TRUE;	//JR
+			case 0x09:	//JALR
+				SWEEP_SET(P, A[i]);
+				if (rd != 0){
+					SWEEP_SET(D, next);
+				}
+				return TRUE;
+			case 0x0C:	//SYSCALL
+				SWEEP_EACH_LANE{
+					if (sweep->regs[2 * n + i] == 0xa){
+						sweep->running[i] = FALSE;
+						sweep->running_count--;
+					}
+				}
+				return FALSE;
+			case 0x11: SWEEP_SET(HI, A[i]); return FALSE;	//MTHI
+			case 0x13: SWEEP_SET(LO, A[i]); return FALSE;	//MTLO
+			case 0x18:	//MULT
+				SWEEP_SET(HI, (uint32_t)((uint64_t)((int64_t)(int32_t)A[i] * (int32_t)B[i]) >> 32));
+				SWEEP_SET(LO, (uint32_t)((int32_t)A[i] * (int64_t)(int32_t)B[i]));
+				return FALSE;
+			case 0x19:	//MULTU
+				SWEEP_SET(HI, (uint32_t)(((uint64_t)A[i] * B[i]) >> 32));
+				SWEEP_SET(LO, A[i] * B[i]);
+				return FALSE;
+			case 0x1A:	//DIV
+				SWEEP_SET(HI, (B[i] != 0 && !(A[i] == 0x80000000 && B[i] == 0xFFFFFFFF)) ?
+					(uint32_t)((int32_t)A[i] % (int32_t)B[i]) : HI[i]);
+				SWEEP_SET(LO, (B[i] != 0 && !(A[i] == 0x80000000 && B[i] == 0xFFFFFFFF)) ?
+					(uint32_t)((int32_t)A[i] / (int32_t)B[i]) : LO[i]);
+				return FALSE;
+			case 0x1B:	//DIVU
+				SWEEP_SET(HI, B[i] != 0 ? A[i] % B[i] : HI[i]);
+				SWEEP_SET(LO, B[i] != 0 ? A[i] / B[i] : LO[i]);
+				return FALSE;
+		}
+		if (rd == 0){
+			return FALSE;
+		}
+		switch(function){
+			case 0x00: SWEEP_SET(D, B[i] << sa); break;	//SLL
+			case 0x02: SWEEP_SET(D, B[i] >> sa); break;	//SRL
+			case 0x03: SWEEP_SET(D, (uint32_t)((int32_t)B[i] >> sa)); break;	//SRA
+			case 0x10: SWEEP_SET(D, HI[i]); break;	//MFHI
+			case 0x12: SWEEP_SET(D, LO[i]); break;	//MFLO
+			case 0x20: case 0x21: SWEEP_SET(D, A[i] + B[i]); break;	//ADD, ADDU
+			case 0x22: case 0x23: SWEEP_SET(D, A[i] - B[i]); break;	//SUB, SUBU
+			case 0x24: SWEEP_SET(D, A[i] & B[i]); break;	//AND
+			case 0x25: SWEEP_SET(D, A[i] | B[i]); break;	//OR
+			case 0x26: SWEEP_SET(D, A[i] ^ B[i]); break;	//XOR
+			case 0x27: SWEEP_SET(D, ~(A[i] | B[i])); break;	//NOR
+			case 0x2A: SWEEP_SET(D, (int32_t)A[i] < (int32_t)B[i]); break;	//SLT
+		}
+		return FALSE;
+	}
+
+	switch(opcode){
+		case 0x01:	//BLTZ, BGEZ
+			if (rt == 0){
+				SWEEP_SET(P, (int32_t)A[i] < 0 ? target : next);
+			}
+			else{
+				SWEEP_SET(P, (int32_t)A[i] >= 0 ? target : next);
+			}
+			return TRUE;
+		case 0x03:	//JAL
+			SWEEP_SET(sweep->regs + 31 * n, next);
+			/* fall through */
+		case 0x02:	//J
+			SWEEP_SET(P, (next & 0xF0000000) | ((instruction & 0x03FFFFFF) << 2));
+			return TRUE;
+		case 0x04: SWEEP_SET(P, A[i] == B[i] ? target : next); return TRUE;	//BEQ
+		case 0x05: SWEEP_SET(P, A[i] != B[i] ? target : next); return TRUE;	//BNE
+		case 0x06: SWEEP_SET(P, (int32_t)A[i] <= 0 ? target : next); return TRUE;	//BLEZ
+		case 0x07: SWEEP_SET(P, (int32_t)A[i] > 0 ? target : next); return TRUE;	//BGTZ
+		case 0x28:	//SB
+			SWEEP_EACH_LANE{
+				address = A[i] + simm;
+				word = sweep_read(sweep, i, address & ~3u) & ~(0xFFu << (8 * (address & 3)));
+				sweep_write(sweep, i, address & ~3u, word | ((B[i] & 0xFF) << (8 * (address & 3))));
+			}
+			return FALSE;
+		case 0x29:	//SH
+			SWEEP_EACH_LANE{
+				address = A[i] + simm;
+				word = sweep_read(sweep, i, address & ~3u) & ~(0xFFFFu << (8 * (address & 2)));
+				sweep_write(sweep, i, address & ~3u, word | ((B[i] & 0xFFFF) << (8 * (address & 2))));
+			}
+			return FALSE;
+		case 0x2B: SWEEP_EACH_LANE{ sweep_write(sweep, i, A[i] + simm, B[i]); } return FALSE;	//SW
+	}
+	if (rt == 0){
+		return FALSE;
+	}
+	switch(opcode){
+		case 0x08: case 0x09: SWEEP_SET(T, A[i] + simm); break;	//ADDI, ADDIU
+		case 0x0A: SWEEP_SET(T, (int32_t)A[i] < (int32_t)simm); break;	//SLTI
+		case 0x0C: SWEEP_SET(T, A[i] & immediate); break;	//ANDI
+		case 0x0D: SWEEP_SET(T, A[i] | immediate); break;	//ORI
+		case 0x0E: SWEEP_SET(T, A[i] ^ immediate); break;	//XORI
+		case 0x0F: SWEEP_SET(T, immediate << 16); break;	//LUI
+		case 0x20:	//LB
+			SWEEP_EACH_LANE{
+				address = A[i] + simm;
+				word = sweep_read(sweep, i, address & ~3u);
+				T[i] = (uint32_t)(int32_t)(int8_t)(word >> (8 * (address & 3)));
+			}
+			break;
+		case 0x21:	//LH
+			SWEEP_EACH_LANE{
+				address = A[i] + simm;
+				word = sweep_read(sweep, i, address & ~3u);
+				T[i] = (uint32_t)(int32_t)(int16_t)(word >> (8 * (address & 2)));
+			}
+			break;
+		case 0x23: SWEEP_EACH_LANE{ T[i] = sweep_read(sweep, i, A[i] + simm); } break;	//LW
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Run <lanes> copies of the program from reset, lane i with            */
+/* register <reg> = <start> + i * <step>.  Lanes execute each             */
+/* instruction together while they agree on the PC; after a            */
+/* divergent branch the lanes at the lowest PC run masked until they */
+/* meet again.  Final registers go to <filename>, one lane per line. */
+/************************************************************/
+int run_sweep(uint32_t lanes, uint32_t reg, uint32_t start, uint32_t step, const char *filename){
+	sweep_t sweep;
+	FILE *fp = NULL;
+	const uint8_t *mask;
+	uint32_t i, r, pc, count, first;
+	uint64_t wall;
+
+	if (filename != NULL){
+		fp = fopen(filename, "w");
+		if (fp == NULL){
+			perror(filename);
+			return CMD_ERROR;
+		}
+	}
+	memset(&sweep, 0, sizeof(sweep));
+	sweep.lanes = lanes;
+	sweep.stride = (lanes + SWEEP_LANE_GROUP - 1) / SWEEP_LANE_GROUP * SWEEP_LANE_GROUP;
+	sweep.regs = aligned_alloc(64, (size_t)(MIPS_REGS + 2) * sweep.stride * sizeof(uint32_t));
+	sweep.pc = aligned_alloc(64, sweep.stride * sizeof(uint32_t));
+	sweep.running = calloc(sweep.stride, 1);
+	sweep.active = calloc(sweep.stride, 1);
+	sweep.overlay = calloc(lanes, sizeof(sweep_overlay_t));
+
+	reset();
+	for (r = 0; r < MIPS_REGS + 2; r++){
+		uint32_t value = (r < MIPS_REGS) ? CURRENT_STATE.REGS[r] : (r == 32 ? CURRENT_STATE.HI : CURRENT_STATE.LO);
+		for (i = 0; i < sweep.stride; i++){
+			sweep.regs[r * sweep.stride + i] = value;
+		}
+	}
+	for (i = 0; i < lanes; i++){
+		if (reg != 0){
+			sweep.regs[reg * sweep.stride + i] = start + i * step;
+		}
+		sweep.running[i] = TRUE;
+	}
+	sweep.running_count = lanes;
+	sweep.converged = TRUE;
+	sweep.common_pc = CURRENT_STATE.PC;
+
+	wall = host_time_ns();
+	while (sweep.running_count > 0){
+		if (sweep.converged){
+			pc = sweep.common_pc;
+			mask = (sweep.running_count == lanes) ? NULL : sweep.running;
+			count = sweep.running_count;
+			sweep.lockstep_steps++;
+		}
+		else{
+			pc = 0xFFFFFFFF;
+			for (i = 0; i < lanes; i++){
+				if (sweep.running[i] && sweep.pc[i] < pc){
+					pc = sweep.pc[i];
+				}
+			}
+			count = 0;
+			for (i = 0; i < sweep.stride; i++){
+				sweep.active[i] = sweep.running[i] && sweep.pc[i] == pc;
+				count += sweep.active[i];
+			}
+			mask = sweep.active;
+			sweep.masked_steps++;
+		}
+
+		if (pc < MEM_KTEXT_BEGIN && pc >= MEM_TEXT_BEGIN + 4*PROGRAM_SIZE){
+			for (i = 0; i < lanes; i++){
+				if (mask ? mask[i] : sweep.running[i]){
+					sweep.running[i] = FALSE;
+					sweep.running_count--;
+				}
+			}
+		}
+		else{
+			sweep.lane_instructions += count;
+			if (!sweep_execute(&sweep, mem_read_32(pc), pc, mask)){
+				if (sweep.converged){
+					sweep.common_pc = pc + 4;
+					continue;
+				}
+				for (i = 0; i < lanes; i++){
+					if (sweep.active[i]){
+						sweep.pc[i] = pc + 4;
+					}
+				}
+			}
+		}
+
+		/* back in lockstep once every running lane is at one PC */
+		for (first = 0; first < lanes && !sweep.running[first]; first++);
+		sweep.converged = TRUE;
+		for (i = first; i < lanes; i++){
+			if (sweep.running[i] && sweep.pc[i] != sweep.pc[first]){
+				sweep.converged = FALSE;
+				break;
+			}
+		}
+		if (sweep.converged && first < lanes){
+			sweep.common_pc = sweep.pc[first];
+		}
+	}
+	wall = host_time_ns() - wall;
+
+	if (fp != NULL){
+		for (i = 0; i < lanes; i++){
+			fprintf(fp, "%u", i);
+			for (r = 0; r < MIPS_REGS + 2; r++){
+				fprintf(fp, " %08x", sweep.regs[r * sweep.stride + i]);
+			}
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+	}
+
+	printf("-------------------------------------------------------------\n");
+	printf("Lanes\t\t\t: %u (R%u = 0x%x + i * 0x%x)\n", lanes, reg, start, step);
+	printf("Lane instructions\t: %llu\n", (unsigned long long)sweep.lane_instructions);
+	printf("Lockstep steps\t\t: %llu\n", (unsigned long long)sweep.lockstep_steps);
+	printf("Masked steps\t\t: %llu\n", (unsigned long long)sweep.masked_steps);
+	printf("Wall time (ms)\t\t: %.1f\n", wall / 1e6);
+	printf("Lane instructions/s\t: %.0f\n", wall ? sweep.lane_instructions * 1e9 / wall : 0.0);
+	printf("-------------------------------------------------------------\n\n");
+
+	for (i = 0; i < lanes; i++){
+		free(sweep.overlay[i].address);
+		free(sweep.overlay[i].value);
+	}
+	free(sweep.overlay);
+	free(sweep.regs);
+	free(sweep.pc);
+	free(sweep.running);
+	free(sweep.active);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* sweep <lanes> <reg> <start> <step> [file]                                    */
+/************************************************************/
+int sweep_command(int argc, char **argv){
+	uint32_t lanes, reg, start, step;
+
+	if ((argc != 5 && argc != 6) || !parse_value(argv[1], 10, &lanes) || lanes == 0 ||
+			lanes > SWEEP_MAX_LANES || !parse_register(argv[2], &reg) ||
+			!parse_value(argv[3], 16, &start) || !parse_value(argv[4], 16, &step)){
+		return CMD_ERROR;
+	}
+	return run_sweep(lanes, reg, start, step, argc == 6 ? argv[5] : NULL);
+}
+
+/************************************************************/
+/* Disassembly tables, indexed by opcode and by SPECIAL function */ 
+/************************************************************/
+const disasm_entry_t OPCODE_TABLE[64] = {
+	[0x01] = { "",      FMT_REGIMM },
+	[0x02] = { "J",     FMT_J },
+	[0x03] = { "JAL",   FMT_J },
+	[0x04] = { "BEQ",   FMT_RS_RT_OFFSET },
+	[0x05] = { "BNE",   FMT_RS_RT_OFFSET },
+	[0x06] = { "BLEZ",  FMT_RS_OFFSET },
+	[0x07] = { "BGTZ",  FMT_RS_OFFSET },
+	[0x08] = { "ADDI",  FMT_RT_RS_IMM },
+	[0x09] = { "ADDIU", FMT_RT_RS_IMM },
+	[0x0A] = { "SLTI",  FMT_RT_RS_IMM },
+	[0x0C] = { "ANDI",  FMT_RT_RS_IMM },
+	[0x0D] = { "ORI",   FMT_RT_RS_IMM },
+	[0x0E] = { "XORI",  FMT_RT_RS_IMM },
+	[0x0F] = { "LUI",   FMT_RT_IMM },
+	[0x10] = { "",      FMT_COP0 },
+	[0x20] = { "LB",    FMT_RT_OFFSET_RS },
+	[0x21] = { "LH",    FMT_RT_OFFSET_RS },
+	[0x23] = { "LW",    FMT_RT_OFFSET_RS },
+	[0x28] = { "SB",    FMT_RT_OFFSET_RS },
+	[0x29] = { "SH",    FMT_RT_OFFSET_RS },
+	[0x2B] = { "SW",    FMT_RT_OFFSET_RS },
+};
+
+const disasm_entry_t SPECIAL_TABLE[64] = {
+	[0x00] = { "SLL",     FMT_RD_RT_SA },
+	[0x02] = { "SRL",     FMT_RD_RT_SA },
+	[0x03] = { "SRA",     FMT_RD_RT_SA },
+	[0x08] = { "JR",      FMT_RS },
+	[0x09] = { "JALR",    FMT_JALR },
+	[0x0C] = { "SYSCALL", FMT_NONE },
+	[0x10] = { "MFHI",    FMT_RD },
+	[0x11] = { "MTHI",    FMT_RS },
+	[0x12] = { "MFLO",    FMT_RD },
+	[0x13] = { "MTLO",    FMT_RS },
+	[0x18] = { "MULT",    FMT_RS_RT },
+	[0x19] = { "MULTU",   FMT_RS_RT },
+	[0x1A] = { "DIV",     FMT_RS_RT },
+	[0x1B] = { "DIVU",    FMT_RS_RT },
+	[0x20] = { "ADD",     FMT_RD_RS_RT },
+	[0x21] = { "ADDU",    FMT_RD_RS_RT },
+	[0x22] = { "SUB",     FMT_RD_RS_RT },
+	[0x23] = { "SUBU",    FMT_RD_RS_RT },
+	[0x24] = { "AND",     FMT_RD_RS_RT },
+	[0x25] = { "OR",      FMT_RD_RS_RT },
+	[0x26] = { "XOR",     FMT_RD_RS_RT },
+	[0x27] = { "NOR",     FMT_RD_RS_RT },
+	[0x2A] = { "SLT",     FMT_RD_RS_RT },
+};
+
+/************************************************************/
+/* Disassemble one instruction word into <buffer>                           */ 
+/************************************************************/
+void disassemble(uint32_t instruction, uint32_t pc, char *buffer, int size){
+	uint32_t opcode, function, rs, rt, rd, sa, immediate, target;
+	const disasm_entry_t *entry;
+
+	opcode = (instruction & 0xFC000000) >> 26;
+	function = instruction & 0x0000003F;
+	rs = (instruction & 0x03E00000) >> 21;
+	rt = (instruction & 0x001F0000) >> 16;
+	rd = (instruction & 0x0000F800) >> 11;
+	sa = (instruction & 0x000007C0) >> 6;
+	immediate = instruction & 0x0000FFFF;
+	target = instruction & 0x03FFFFFF;
+	buffer[0] = '\0';
+
+	entry = (opcode == 0x00) ? &SPECIAL_TABLE[function] : &OPCODE_TABLE[opcode];
+	switch(entry->format){
+		case FMT_INVALID:
+			snprintf(buffer,size,"Instruction is not implemented!");
+			break;
+		case FMT_NONE:
+			snprintf(buffer,size,"%s", entry->name);
+			break;
+		case FMT_RD_RT_SA:
+			snprintf(buffer,size,"%s $r%u, $r%u, 0x%x", entry->name, rd, rt, sa);
+			break;
+		case FMT_RD_RS_RT:
+			snprintf(buffer,size,"%s $r%u, $r%u, $r%u", entry->name, rd, rs, rt);
+			break;
+		case FMT_RS_RT:
+			snprintf(buffer,size,"%s $r%u, $r%u", entry->name, rs, rt);
+			break;
+		case FMT_RS:
+			snprintf(buffer,size,"%s $r%u", entry->name, rs);
+			break;
+		case FMT_RD:
+			snprintf(buffer,size,"%s $r%u", entry->name, rd);
+			break;
+		case FMT_JALR:
+			if(rd == 31){
+				snprintf(buffer,size,"%s $r%u", entry->name, rs);
+			}
+			else{
+				snprintf(buffer,size,"%s $r%u, $r%u", entry->name, rd, rs);
+			}
+			break;
+		case FMT_REGIMM:
+			if(rt == 0){
+				snprintf(buffer,size,"BLTZ $r%u, 0x%x", rs, immediate<<2);
+			}
+			else if(rt == 1){
+				snprintf(buffer,size,"BGEZ $r%u, 0x%x", rs, immediate<<2);
+			}
+			break;
+		case FMT_J:
+			snprintf(buffer,size,"%s 0x%x", entry->name, (pc & 0xF0000000) | (target<<2));
+			break;
+		case FMT_RS_RT_OFFSET:
+			snprintf(buffer,size,"%s $r%u, $r%u, 0x%x", entry->name, rs, rt, immediate<<2);
+			break;
+		case FMT_RS_OFFSET:
+			snprintf(buffer,size,"%s $r%u, 0x%x", entry->name, rs, immediate<<2);
+			break;
+		case FMT_RT_RS_IMM:
+			snprintf(buffer,size,"%s $r%u, $r%u, 0x%x", entry->name, rt, rs, immediate);
+			break;
+		case FMT_RT_IMM:
+			snprintf(buffer,size,"%s $r%u, 0x%x", entry->name, rt, immediate);
+			break;
+		case FMT_RT_OFFSET_RS:
+			snprintf(buffer,size,"%s $r%u, 0x%x($r%u)", entry->name, rt, immediate, rs);
+			break;
+		case FMT_COP0:
+			if(cop0_mnemonic(instruction) == NULL){
+				snprintf(buffer,size,"Instruction is not implemented!");
+			}
+			else if(rs == 0x10){
+				snprintf(buffer,size,"%s", cop0_mnemonic(instruction));
+			}
+			else{
+				snprintf(buffer,size,"%s $r%u, $%u", cop0_mnemonic(instruction), rt, rd);
+			}
+			break;
+	}
+}
+
+/************************************************************/
+/* Mnemonic of a COP0 instruction, NULL if not implemented          */
+/************************************************************/
+const char *cop0_mnemonic(uint32_t instruction){
+	uint32_t rs = (instruction & 0x03E00000) >> 21;
+
+	if (rs == 0x00){
+		return "MFC0";
+	}
+	if (rs == 0x04){
+		return "MTC0";
+	}
+	if (rs == 0x10 && (instruction & 0x3F) == 0x18){
+		return "ERET";
+	}
+	return NULL;
+}
+
+/************************************************************/
+/* Is <instruction> one the simulator knows (else RI)?                 */
+/************************************************************/
+int instruction_known(uint32_t instruction){
+	uint32_t opcode = (instruction & 0xFC000000) >> 26;
+
+	if (opcode == 0x10){
+		return cop0_mnemonic(instruction) != NULL;
+	}
+	return ((opcode == 0x00) ? SPECIAL_TABLE[instruction & 0x3F] : OPCODE_TABLE[opcode]).format != FMT_INVALID;
+}
+
+/************************************************************/
+/* Disassembly of the word at <pc>, cached with the program image */ 
+/************************************************************/
+const char *disassemble_pc(uint32_t instruction, uint32_t pc){
+	static char scratch[DISASM_TEXT_SIZE];
+	program_image_t *image = CURRENT_IMAGE;
+	uint32_t index = (pc - MEM_TEXT_BEGIN) / 4;
+	char *text;
+
+	if (image == NULL || pc < MEM_TEXT_BEGIN || index >= image->count || image->words[index] != instruction){
+		disassemble(instruction, pc, scratch, sizeof(scratch));
+		return scratch;
+	}
+	text = image->text + (size_t)index * DISASM_TEXT_SIZE;
+	if (text[0] == '\0'){
+		disassemble(instruction, pc, text, DISASM_TEXT_SIZE);
+	}
+	return text;
+}
+
+/************************************************************/
+/* Append formatted text to an output buffer                                  */ 
+/************************************************************/
+void out_printf(out_buffer_t *out, const char *format, ...){
+	va_list args;
+	int length;
+
+	while (1){
+		va_start(args, format);
+		length = vsnprintf(out->data + out->length, out->capacity - out->length, format, args);
+		va_end(args);
+		if (length >= 0 && out->length + length < out->capacity){
+			out->length += length;
+			return;
+		}
+		out->capacity = out->capacity ? 2 * out->capacity : 4096;
+		while (length >= 0 && out->length + length >= out->capacity){
+			out->capacity *= 2;
+		}
+		out->data = realloc(out->data, out->capacity);
+	}
+}
+
+/************************************************************/
+/* Append raw bytes to an output buffer                                        */ 
+/************************************************************/
+void out_append(out_buffer_t *out, const char *data, size_t length){
+	if (out->length + length >= out->capacity){
+		out->capacity = out->capacity ? out->capacity : 4096;
+		while (out->length + length >= out->capacity){
+			out->capacity *= 2;
+		}
+		out->data = realloc(out->data, out->capacity);
+	}
+	memcpy(out->data + out->length, data, length);
+	out->length += length;
+}
+
+/************************************************************/
+/* Write out a buffer with as few write() calls as possible          */ 
+/************************************************************/
+void out_flush(out_buffer_t *out, int fd){
+	size_t done = 0;
+	ssize_t n;
+
+	if (fd == STDOUT_FILENO){
+		fflush(stdout);	/*keep ordering with printf output*/
+	}
+	while (done < out->length){
+		n = write(fd, out->data + done, out->length - done);
+		if (n < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			break;
+		}
+		done += n;
+	}
+	out->length = 0;
+}
+
+/************************************************************/
+/* Print the program loaded into memory (in MIPS assembly format)    */ 
+/************************************************************/
+void print_program(){
+	static out_buffer_t out;
+	uint32_t address, instruction;
+
+	address = CURRENT_STATE.PC;
+	do {
+		instruction = mem_read_32(address);
+		out_printf(&out, "%s\n", disassemble_pc(instruction, address));
+		address += 4;
+	} while (instruction != 0x0000000C && address <= MEM_TEXT_END);
+	out_flush(&out, STDOUT_FILENO);
+}
+
+/************************************************************/
+/* Print the current pipeline                                                                                    */ 
+/* In delta mode only the latches changed since the last print appear. */
+/************************************************************/
+void show_pipeline(){
+	static out_buffer_t out;
+	int delta = PIPELINE_VIEW == VIEW_DELTA && PIPELINE_SHOWN;
+
+	out_printf(&out, "************************************************************\n");
+	out_printf(&out, "CURRENT PC:\t\t0x%x\n",CURRENT_STATE.PC);
+	if (!delta || memcmp(&ID_IF, &SHOWN_ID_IF, sizeof(ID_IF)) != 0){
+		out_printf(&out, "IF/ID.IR\t\t0x%x\t%s\n",ID_IF.IR,disassemble_pc(ID_IF.IR, ID_IF.PC - 4));
+		out_printf(&out, "IF/ID.PC\t\t0x%x\n",ID_IF.PC);
+		out_printf(&out, "\n");
+	}
+	if (!delta || memcmp(&IF_EX, &SHOWN_IF_EX, sizeof(IF_EX)) != 0){
+		out_printf(&out, "ID/EX.IR\t\t0x%x\t%s\n",IF_EX.IR,disassemble_pc(IF_EX.IR, IF_EX.PC - 4));
+		out_printf(&out, "ID/EX.A\t\t\t0x%x\n",IF_EX.A);
+		out_printf(&out, "ID/EX.B\t\t\t0x%x\n",IF_EX.B);
+		out_printf(&out, "ID/EX.imm\t\t0x%x\n",IF_EX.imm);
+		out_printf(&out, "\n");
+	}
+	if (!delta || memcmp(&EX_MEM, &SHOWN_EX_MEM, sizeof(EX_MEM)) != 0){
+		out_printf(&out, "EX/MEM.IR\t\t0x%x\n",EX_MEM.IR);
+		out_printf(&out, "EX/MEM.A\t\t0x%x\n",EX_MEM.A);
+		out_printf(&out, "EX/MEM.B\t\t0x%x\n",EX_MEM.B);
+		out_printf(&out, "EX/MEM.ALUOutput\t0x%x\n",EX_MEM.ALUOutput);
+		out_printf(&out, "\n");
+	}
+	if (!delta || memcmp(&MEM_WB, &SHOWN_MEM_WB, sizeof(MEM_WB)) != 0){
+		out_printf(&out, "MEM/WB.IR\t\t0x%x\n",MEM_WB.IR);
+		out_printf(&out, "MEM/WB.ALUOutput\t0x%x\n",MEM_WB.ALUOutput);
+		out_printf(&out, "MEM/WB.LMD\t\t0x%x\n",MEM_WB.LMD);
+		out_printf(&out, "\n");
+	}
+	out_flush(&out, STDOUT_FILENO);
+
+	SHOWN_ID_IF = ID_IF;
+	SHOWN_IF_EX = IF_EX;
+	SHOWN_EX_MEM = EX_MEM;
+	SHOWN_MEM_WB = MEM_WB;
+	PIPELINE_SHOWN = TRUE;
+}
+
+/************************************************************/
+/* show [full|delta]: select the pipeline view and print it            */ 
+/************************************************************/
+int show_command(int argc, char **argv){
+	if (argc == 2 && strcmp(argv[1], "full") == 0){
+		PIPELINE_VIEW = VIEW_FULL;
+	}else if (argc == 2 && strcmp(argv[1], "delta") == 0){
+		PIPELINE_VIEW = VIEW_DELTA;
+		PIPELINE_SHOWN = FALSE;
+	}else if (argc != 1){
+		return CMD_ERROR;
+	}
+	show_pipeline();
+	return CMD_OK;
+}
+
+
+/************************************************************/
+/* Does this instruction end a basic block?                                         */ 
+/************************************************************/
+int is_control_transfer(uint32_t instruction){
+	uint32_t opcode = (instruction & 0xFC000000) >> 26;
+	uint32_t function = instruction & 0x0000003F;
+
+	if (opcode == 0x00){
+		return function == 0x08 || function == 0x09 || function == 0x0C;	/*JR, JALR, SYSCALL*/
+	}
+	if (opcode == 0x10){
+		return ((instruction >> 21) & 0x1F) == 0x10;	/*ERET*/
+	}
+	return opcode >= 0x01 && opcode <= 0x07;	/*REGIMM branches, J, JAL, BEQ..BGTZ*/
+}
+
+/************************************************************/
+/* Static target of a branch/jump at <pc>; FALSE if none                */ 
+/************************************************************/
+int branch_target(uint32_t instruction, uint32_t pc, uint32_t *target){
+	uint32_t opcode = (instruction & 0xFC000000) >> 26;
+	uint32_t immediate = instruction & 0x0000FFFF;
+
+	if (opcode == 0x02 || opcode == 0x03){
+		*target = ((pc + 4) & 0xF0000000) | ((instruction & 0x03FFFFFF) << 2);
+		return TRUE;
+	}
+	if (opcode == 0x01 || (opcode >= 0x04 && opcode <= 0x07)){
+		if (immediate & 0x8000){
+			immediate |= 0xFFFF0000;
+		}
+		*target = pc + 4 + (immediate << 2);
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/************************************************************/
+/* Clear the profile and split the program into basic blocks     */ 
+/************************************************************/
+void profile_reset(){
+	uint32_t i, instruction, target;
+	uint8_t *leader;
+
+	free(PROFILE);
+	PROFILE_SIZE = PROGRAM_SIZE;
+	PROFILE = calloc(PROFILE_SIZE + 1, sizeof(profile_entry_t));
+	PROFILE_OTHER_CYCLES = 0;
+
+	leader = calloc(PROFILE_SIZE + 1, 1);
+	if (PROFILE_SIZE > 0){
+		leader[0] = TRUE;
+	}
+	for (i = 0; i < PROFILE_SIZE; i++){
+		instruction = mem_read_32(MEM_TEXT_BEGIN + 4*i);
+		if (is_control_transfer(instruction)){
+			leader[i + 1] = TRUE;
+			if (branch_target(instruction, MEM_TEXT_BEGIN + 4*i, &target) &&
+					target >= MEM_TEXT_BEGIN && target < MEM_TEXT_BEGIN + 4*PROFILE_SIZE){
+				leader[(target - MEM_TEXT_BEGIN) / 4] = TRUE;
+			}
+		}
+	}
+	for (i = 0; i < PROFILE_SIZE; i++){
+		PROFILE[i].block = leader[i] ? i : PROFILE[i - 1].block;
+	}
+	free(leader);
+}
+
+/************************************************************/
+/* Attribute the current cycle to the oldest instruction in flight: */
+/* it retires if it is in WB, else a bubble in WB is its stall; a      */
+/* load waiting on the memory model sits in EX/MEM and so is charged */
+/************************************************************/
+void profile_cycle(){
+	const CPU_Pipeline_Reg *oldest;
+	uint32_t pc, index;
+
+	oldest = MEM_WB.seq ? &MEM_WB : EX_MEM.seq ? &EX_MEM : IF_EX.seq ? &IF_EX : &ID_IF;
+	if (oldest->seq == 0){
+		PROFILE_OTHER_CYCLES++;
+		return;
+	}
+	pc = oldest->PC - 4;
+	index = (pc - MEM_TEXT_BEGIN) / 4;
+	if (pc < MEM_TEXT_BEGIN || index >= PROFILE_SIZE){
+		PROFILE_OTHER_CYCLES++;
+		return;
+	}
+	PROFILE[index].cycles++;
+	if (oldest == &MEM_WB){
+		PROFILE[index].executions++;
+	}else{
+		PROFILE[index].stalls++;	/*no instruction retired this cycle*/
+	}
+}
+
+/************************************************************/
+/* qsort helpers: order profile indexes by cycles, descending    */ 
+/************************************************************/
+int profile_compare_pc(const void *a, const void *b){
+	uint64_t ca = PROFILE[*(const uint32_t *)a].cycles;
+	uint64_t cb = PROFILE[*(const uint32_t *)b].cycles;
+	return (ca < cb) - (ca > cb);
+}
+
+int profile_compare_block(const void *a, const void *b){
+	uint64_t ca = PROFILE[*(const uint32_t *)a].block_cycles;
+	uint64_t cb = PROFILE[*(const uint32_t *)b].block_cycles;
+	return (ca < cb) - (ca > cb);
+}
+
+/************************************************************/
+/* Print the hottest instructions and basic blocks                         */ 
+/************************************************************/
+void profile_report(uint32_t max_lines){
+	uint32_t *order, i, n, blocks, length;
+	uint64_t total = PROFILE_OTHER_CYCLES, retired = 0;
+
+	if (PROFILE == NULL){
+		printf("Profiling is not enabled (profile on).\n\n");
+		return;
+	}
+	for (i = 0; i < PROFILE_SIZE; i++){
+		PROFILE[i].block_executions = 0;
+		PROFILE[i].block_cycles = 0;
+		PROFILE[i].block_stalls = 0;
+	}
+	for (i = 0; i < PROFILE_SIZE; i++){
+		total += PROFILE[i].cycles;
+		retired += PROFILE[i].executions;
+		PROFILE[PROFILE[i].block].block_cycles += PROFILE[i].cycles;
+		PROFILE[PROFILE[i].block].block_stalls += PROFILE[i].stalls;
+		if (PROFILE[i].block == i){
+			PROFILE[i].block_executions = PROFILE[i].executions;
+		}
+	}
+	if (total == 0){
+		total = 1;
+	}
+
+	order = malloc((PROFILE_SIZE + 1) * sizeof(uint32_t));
+	for (i = 0; i < PROFILE_SIZE; i++){
+		order[i] = i;
+	}
+	qsort(order, PROFILE_SIZE, sizeof(uint32_t), profile_compare_pc);
+
+	printf("-------------------------------------------------------------\n");
+	printf("Profile: %llu instructions retired, %llu fill/drain cycles\n",
+		(unsigned long long)retired, (unsigned long long)PROFILE_OTHER_CYCLES);
+	printf("-------------------------------------------------------------\n");
+	printf("[PC]\t\t[Execs]\t[Cycles]\t[%%]\t[Stalls]\t[Instruction]\n");
+	for (i = 0; i < PROFILE_SIZE && i < max_lines && PROFILE[order[i]].cycles > 0; i++){
+		n = order[i];
+		printf("0x%08x\t%llu\t%llu\t\t%5.1f\t%llu\t\t%s\n", MEM_TEXT_BEGIN + 4*n,
+			(unsigned long long)PROFILE[n].executions, (unsigned long long)PROFILE[n].cycles,
+			100.0 * PROFILE[n].cycles / total, (unsigned long long)PROFILE[n].stalls,
+			disassemble_pc(mem_read_32(MEM_TEXT_BEGIN + 4*n), MEM_TEXT_BEGIN + 4*n));
+	}
+
+	blocks = 0;
+	for (i = 0; i < PROFILE_SIZE; i++){
+		if (PROFILE[i].block == i){
+			order[blocks++] = i;
+		}
+	}
+	qsort(order, blocks, sizeof(uint32_t), profile_compare_block);
+
+	printf("-------------------------------------------------------------\n");
+	printf("[Block]\t\t[Length]\t[Execs]\t[Cycles]\t[%%]\t[Stalls]\n");
+	for (i = 0; i < blocks && i < max_lines && PROFILE[order[i]].block_cycles > 0; i++){
+		n = order[i];
+		for (length = 1; n + length < PROFILE_SIZE && PROFILE[n + length].block == n; length++);
+		printf("0x%08x\t%u\t\t%llu\t%llu\t\t%5.1f\t%llu\n", MEM_TEXT_BEGIN + 4*n, length,
+			(unsigned long long)PROFILE[n].block_executions, (unsigned long long)PROFILE[n].block_cycles,
+			100.0 * PROFILE[n].block_cycles / total, (unsigned long long)PROFILE[n].block_stalls);
+	}
+	printf("\n");
+	free(order);
+}
+
+/************************************************************/
+/* Write a folded-stack profile (flamegraph.pl input)                    */ 
+/************************************************************/
+int profile_write_flame(const char *filename){
+	FILE *fp;
+	uint32_t i;
+
+	if (PROFILE == NULL){
+		printf("Profiling is not enabled (profile on).\n\n");
+		return CMD_ERROR;
+	}
+	fp = fopen(filename, "w");
+	if (fp == NULL){
+		perror(filename);
+		return CMD_ERROR;
+	}
+	for (i = 0; i < PROFILE_SIZE; i++){
+		if (PROFILE[i].cycles == 0){
+			continue;
+		}
+		fprintf(fp, "%s;bb_0x%08x;0x%08x %s %llu\n", prog_file, MEM_TEXT_BEGIN + 4*PROFILE[i].block,
+			MEM_TEXT_BEGIN + 4*i, disassemble_pc(mem_read_32(MEM_TEXT_BEGIN + 4*i), MEM_TEXT_BEGIN + 4*i),
+			(unsigned long long)PROFILE[i].cycles);
+	}
+	if (PROFILE_OTHER_CYCLES > 0){
+		fprintf(fp, "%s;pipeline_fill_drain %llu\n", prog_file, (unsigned long long)PROFILE_OTHER_CYCLES);
+	}
+	fclose(fp);
+	printf("Profile written to %s\n\n", filename);
+	return CMD_OK;
+}
+
+/************************************************************/
+/* profile on|off|reset|report [n]|flame <file>                                */ 
+/************************************************************/
+int profile_command(int argc, char **argv){
+	uint32_t lines = 20;
+
+	if (argc == 2 && strcmp(argv[1], "on") == 0){
+		if (PROFILE == NULL || PROFILE_SIZE != PROGRAM_SIZE){
+			profile_reset();
+		}
+		PROFILE_ENABLED = TRUE;
+	}else if (argc == 2 && strcmp(argv[1], "off") == 0){
+		PROFILE_ENABLED = FALSE;
+	}else if (argc == 2 && strcmp(argv[1], "reset") == 0){
+		profile_reset();
+	}else if ((argc == 2 || argc == 3) && strcmp(argv[1], "report") == 0){
+		if (argc == 3 && !parse_value(argv[2], 10, &lines)){
+			return CMD_ERROR;
+		}
+		profile_report(lines);
+	}else if (argc == 3 && strcmp(argv[1], "flame") == 0){
+		profile_write_flame(argv[2]);
+	}else{
+		return CMD_ERROR;
+	}
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* Advance the view's clock to the current cycle                               */
+/***************************************************************/
+void pipeview_emit_cycle(){
+	if (PIPEVIEW_CYCLE != PIPEVIEW_LAST_CYCLE){
+		out_printf(&PIPEVIEW_OUT, "C\t%llu\n", (unsigned long long)(PIPEVIEW_CYCLE - PIPEVIEW_LAST_CYCLE));
+		PIPEVIEW_LAST_CYCLE = PIPEVIEW_CYCLE;
+	}
+}
+
+/***************************************************************/
+/* Label a stage the instruction was held in                                   */
+/***************************************************************/
+void pipeview_end_stage(pipeview_slot_t *slot){
+	static const char *names[PIPEVIEW_STAGES] = { "fetch", "decode", "execute", "memory", "writeback" };
+
+	if (slot->stalls > 0){
+		out_printf(&PIPEVIEW_OUT, "L\t%llu\t1\t%s held %u cycles waiting on memory\n",
+			(unsigned long long)slot->id, names[slot->stage], slot->stalls);
+		slot->stalls = 0;
+	}
+}
+
+/***************************************************************/
+/* Record this cycle's stage occupancy: the instruction fetched    */
+/* into the next IF/ID latch and those in the current latches.      */
+/* An instruction that vanished before writeback was flushed.       */
+/* Called after the stages and before the clock edge.                   */
+/***************************************************************/
+void pipeview_cycle(){
+	static const char *stages[PIPEVIEW_STAGES] = { "F", "D", "X", "M", "W" };
+	const CPU_Pipeline_Reg *latches[PIPEVIEW_STAGES] = { &NEXT_LATCHES->id_if, &ID_IF, &IF_EX, &EX_MEM, &MEM_WB };
+	uint32_t seqs[PIPEVIEW_STAGES], stage, other, i;
+	pipeview_slot_t *slot;
+
+	/*an instruction held in a stage is also copied into the next latch: keep its oldest stage*/
+	for (stage = 0; stage < PIPEVIEW_STAGES; stage++){
+		seqs[stage] = latches[stage]->seq;
+		for (other = stage + 1; other < PIPEVIEW_STAGES; other++){
+			if (latches[other]->seq == seqs[stage]){
+				seqs[stage] = 0;
+			}
+		}
+	}
+
+	pipeview_emit_cycle();
+	for (i = 0; i < PIPEVIEW_SLOTS; i++){
+		slot = &PIPEVIEW_INFLIGHT[i];
+		if (slot->seq == 0){
+			continue;
+		}
+		for (stage = 0; stage < PIPEVIEW_STAGES && seqs[stage] != slot->seq; stage++);
+		if (stage == PIPEVIEW_STAGES){
+			pipeview_end_stage(slot);
+			if (slot->stage == PIPEVIEW_STAGES - 1){
+				out_printf(&PIPEVIEW_OUT, "R\t%llu\t%llu\t0\n", (unsigned long long)slot->id, (unsigned long long)PIPEVIEW_RETIRED++);
+			}
+			else{
+				out_printf(&PIPEVIEW_OUT, "L\t%llu\t1\tflushed by %s\nR\t%llu\t0\t1\n", (unsigned long long)slot->id,
+					PIPEVIEW_REDIRECT ? "a redirect from EX (exception or ERET)" : "an interrupt or pipeline reset",
+					(unsigned long long)slot->id);
+				PIPEVIEW_FLUSHED++;
+			}
+			slot->seq = 0;
+		}
+		else if (stage == slot->stage){
+			slot->stalls++;
+			seqs[stage] = 0;
+		}
+		else{
+			pipeview_end_stage(slot);
+			slot->stage = stage;
+			out_printf(&PIPEVIEW_OUT, "S\t%llu\t0\t%s\n", (unsigned long long)slot->id, stages[stage]);
+			if (latches[stage]->exception != 0){
+				out_printf(&PIPEVIEW_OUT, "L\t%llu\t1\traised %s\n", (unsigned long long)slot->id,
+					EXCEPTION_NAMES[latches[stage]->exception - 1]);
+			}
+			seqs[stage] = 0;
+		}
+	}
+	/*what is left entered the pipeline this cycle*/
+	for (stage = 0; stage < PIPEVIEW_STAGES; stage++){
+		if (seqs[stage] == 0){
+			continue;
+		}
+		for (i = 0; i < PIPEVIEW_SLOTS && PIPEVIEW_INFLIGHT[i].seq != 0; i++);
+		if (i == PIPEVIEW_SLOTS){
+			break;
+		}
+		slot = &PIPEVIEW_INFLIGHT[i];
+		*slot = (pipeview_slot_t){ .seq = seqs[stage], .id = PIPEVIEW_NEXT_ID++, .stage = stage };
+		out_printf(&PIPEVIEW_OUT, "I\t%llu\t%u\t0\nL\t%llu\t0\t%08x: %s\nS\t%llu\t0\t%s\n",
+			(unsigned long long)slot->id, slot->seq, (unsigned long long)slot->id, latches[stage]->PC - 4,
+			disassemble_pc(latches[stage]->IR, latches[stage]->PC - 4), (unsigned long long)slot->id, stages[stage]);
+	}
+
+	PIPEVIEW_REDIRECT = REDIRECT_PENDING;
+	PIPEVIEW_CYCLE++;
+	if (PIPEVIEW_OUT.length >= PIPEVIEW_FLUSH){
+		out_flush(&PIPEVIEW_OUT, PIPEVIEW_FD);
+	}
+}
+
+/***************************************************************/
+/* Start exporting the pipeline view to <filename>                           */
+/***************************************************************/
+int pipeview_open(const char *filename){
+	pipeview_close();
+	PIPEVIEW_FD = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (PIPEVIEW_FD < 0){
+		perror(filename);
+		return FALSE;
+	}
+	memset(PIPEVIEW_INFLIGHT, 0, sizeof(PIPEVIEW_INFLIGHT));
+	PIPEVIEW_CYCLE = PIPEVIEW_LAST_CYCLE = 0;
+	PIPEVIEW_NEXT_ID = PIPEVIEW_RETIRED = PIPEVIEW_FLUSHED = 0;
+	PIPEVIEW_REDIRECT = FALSE;
+	out_printf(&PIPEVIEW_OUT, "Kanata\t0004\nC=\t%u\n", CYCLE_COUNT);
+	return TRUE;
+}
+
+/***************************************************************/
+/* Write out and close the view                                                         */
+/***************************************************************/
+void pipeview_close(){
+	if (PIPEVIEW_FD < 0){
+		return;
+	}
+	out_flush(&PIPEVIEW_OUT, PIPEVIEW_FD);
+	close(PIPEVIEW_FD);
+	PIPEVIEW_FD = -1;
+	if (!QUIET){
+		printf("Pipeline view: %llu instructions, %llu retired, %llu flushed\n", (unsigned long long)PIPEVIEW_NEXT_ID,
+			(unsigned long long)PIPEVIEW_RETIRED, (unsigned long long)PIPEVIEW_FLUSHED);
+	}
+}
+
+/***************************************************************/
+/* pipeview <file> | pipeview off                                                       */
+/***************************************************************/
+int pipeview_command(int argc, char **argv){
+	if (argc != 2){
+		printf("Usage: pipeview <file> | pipeview off\n");
+		return CMD_ERROR;
+	}
+	if (strcmp(argv[1], "off") == 0){
+		pipeview_close();
+		return CMD_OK;
+	}
+	return pipeview_open(argv[1]) ? CMD_OK : CMD_ERROR;
+}
+
+/***************************************************************/
+/* Exceptions and interrupts taken so far                                           */
+/***************************************************************/
+uint64_t exception_total(){
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < EXC_NONE; i++){
+		total += EXCEPTION_COUNTS[i];
+	}
+	return total;
+}
+
+/***************************************************************/
+/* Begin an interval: remember the global counters                         */
+/***************************************************************/
+void interval_start(){
+	memset(&INTERVAL_CURRENT, 0, sizeof(INTERVAL_CURRENT));
+	INTERVAL_BASE = (interval_row_t){ .cycle = CYCLE_COUNT, .instructions = INSTRUCTION_COUNT,
+		.memory_stalls = MEMORY_STALLS, .fetch_stalls = FETCH_STALLS, .squashed = SQUASHED_INSTRUCTIONS,
+		.exceptions = exception_total() };
+	INTERVAL_LEFT = INTERVAL_CYCLES;
+}
+
+/***************************************************************/
+/* Count a load or store from MEM against its memory region          */
+/***************************************************************/
+void interval_access(uint32_t address, int store){
+	uintptr_t entry = PAGE_TABLE[address >> PAGE_SHIFT];
+
+	if (store){
+		INTERVAL_CURRENT.stores++;
+	}
+	else{
+		INTERVAL_CURRENT.loads++;
+	}
+	INTERVAL_CURRENT.region_accesses[(entry & PAGE_HOST_MASK) ? entry & PAGE_REGION_MASK : NUM_MEM_REGION]++;
+}
+
+/***************************************************************/
+/* Close the interval in progress into the row table                        */
+/***************************************************************/
+void interval_row(){
+	interval_row_t *row = &INTERVAL_ROWS[INTERVAL_ROW_COUNT++];
+
+	*row = INTERVAL_CURRENT;
+	row->cycle = CYCLE_COUNT;
+	row->cycles = CYCLE_COUNT - INTERVAL_BASE.cycle;
+	row->instructions = INSTRUCTION_COUNT - INTERVAL_BASE.instructions;
+	row->memory_stalls = MEMORY_STALLS - INTERVAL_BASE.memory_stalls;
+	row->fetch_stalls = FETCH_STALLS - INTERVAL_BASE.fetch_stalls;
+	row->squashed = SQUASHED_INSTRUCTIONS - INTERVAL_BASE.squashed;
+	row->exceptions = exception_total() - INTERVAL_BASE.exceptions;
+	if (INTERVAL_ROW_COUNT == INTERVAL_BUFFER_ROWS){
+		interval_flush();
+	}
+	interval_start();
+}
+
+/***************************************************************/
+/* Write the buffered rows as CSV                                                     */
+/***************************************************************/
+void interval_flush(){
+	interval_row_t *row;
+	uint32_t i, region;
+
+	for (i = 0; i < INTERVAL_ROW_COUNT; i++){
+		row = &INTERVAL_ROWS[i];
+		fprintf(INTERVAL_FILE, "%llu,%u,%u,%.4f,%u,%u,%u,%u,%u,%u", (unsigned long long)row->cycle, row->cycles,
+			row->instructions, row->cycles ? (double)row->instructions / row->cycles : 0.0, row->loads, row->stores,
+			row->memory_stalls, row->fetch_stalls, row->squashed, row->exceptions);
+		for (region = 0; region <= NUM_MEM_REGION; region++){
+			fprintf(INTERVAL_FILE, ",%u", row->region_accesses[region]);
+		}
+		fputc('\n', INTERVAL_FILE);
+	}
+	INTERVAL_ROW_COUNT = 0;
+}
+
+/***************************************************************/
+/* Write the partial last interval and close the file                          */
+/***************************************************************/
+void interval_close(){
+	if (INTERVAL_FILE == NULL){
+		return;
+	}
+	if (CYCLE_COUNT != INTERVAL_BASE.cycle){
+		interval_row();
+	}
+	interval_flush();
+	fclose(INTERVAL_FILE);
+	INTERVAL_FILE = NULL;
+	INTERVAL_CYCLES = 0;
+}
+
+/***************************************************************/
+/* interval <cycles> <file> | interval off                                             */
+/***************************************************************/
+int interval_command(int argc, char **argv){
+	uint32_t cycles;
+
+	if (argc == 2 && strcmp(argv[1], "off") == 0){
+		interval_close();
+		return CMD_OK;
+	}
+	if (argc != 3 || !parse_value(argv[1], 10, &cycles) || cycles == 0){
+		printf("Usage: interval <cycles> <file> | interval off\n");
+		return CMD_ERROR;
+	}
+	interval_close();
+	INTERVAL_FILE = fopen(argv[2], "w");
+	if (INTERVAL_FILE == NULL){
+		perror(argv[2]);
+		return CMD_ERROR;
+	}
+	fprintf(INTERVAL_FILE, "cycle,cycles,instructions,ipc,loads,stores,mem_stall_cycles,fetch_stall_cycles,squashed,exceptions,"
+		"text,data,kdata,ktext,other\n");
+	INTERVAL_ROW_COUNT = 0;
+	INTERVAL_CYCLES = cycles;
+	interval_start();
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* Clear the statistics gathered so far (guest SYS_STATS_RESET)      */
+/***************************************************************/
+void stats_reset(){
+	uint32_t i;
+
+	memset(SYSCALL_COUNTS, 0, sizeof(SYSCALL_COUNTS));
+	memset(EXCEPTION_COUNTS, 0, sizeof(EXCEPTION_COUNTS));
+	memset(HANDLER_CYCLES, 0, sizeof(HANDLER_CYCLES));
+	for (i = 0; i < NUM_MMIO_DEVICES; i++){
+		MMIO_DEVICES[i]->reads = 0;
+		MMIO_DEVICES[i]->writes = 0;
+	}
+	if (MEMORY_MODEL != NULL){
+		MEMORY_MODEL->reset(MEMORY_MODEL);
+	}
+	MEMORY_STALLS = 0;
+	prefetch_reset();
+	if (REUSE_ENABLED){
+		reuse_reset(&REUSE_DATA);
+		reuse_reset(&REUSE_INST);
+	}
+	if (PROFILE != NULL){
+		profile_reset();
+	}
+	STATS_BASE_CYCLES = CYCLE_COUNT;
+	STATS_BASE_INSTRUCTIONS = INSTRUCTION_COUNT;
+	STATS_RESET_DONE = TRUE;
+}
+
+/***************************************************************/
+/* Magic SYSCALL services; <state> is the pipeline's current       */
+/* state (fetch already past the SYSCALL) or the functional model's */
+/***************************************************************/
+void magic_syscall(const CPU_State *state, uint32_t service){
+	MEMO_TAINTED = TRUE;
+	switch (service){
+		case SYS_ROI_BEGIN:
+			stats_reset();
+			ROI_OUTSIDE = FALSE;
+			break;
+		case SYS_ROI_END:
+			if (ROI_FAST && state == &CURRENT_STATE){
+				/*fetch is stalled behind this SYSCALL: the pipeline is empty after it*/
+				ROI_OUTSIDE = TRUE;
+				RUN_FLAG = FALSE;
+			}
+			break;
+		case SYS_STATS_RESET:
+			stats_reset();
+			break;
+		case SYS_STATS_DUMP:
+			if (!GUEST_SILENT){
+				guest_flush();
+				stats();
+			}
+			break;
+		case SYS_CHECKPOINT:
+			checkpoint_free(&ROI_CHECKPOINT);
+			checkpoint_save(&ROI_CHECKPOINT, state, INSTRUCTION_COUNT);
+			if (state != &CURRENT_STATE){
+				ROI_CHECKPOINT.state.PC += 4;
+			}
+			break;
+	}
+}
+
+/***************************************************************/
+/* Branches and jumps in the loaded program (SYSCALL and ERET,       */
+/* which the pipeline does handle, are not counted)                      */
+/***************************************************************/
+uint32_t count_branches(){
+	uint32_t i, instruction, count = 0;
+
+	for (i = 0; i < PROGRAM_SIZE; i++){
+		instruction = mem_read_32(MEM_TEXT_BEGIN + 4*i);
+		if (is_control_transfer(instruction) && (instruction & 0xFC00003F) != 0x0C && (instruction >> 26) != 0x10){
+			count++;
+		}
+	}
+	return count;
+}
+
+/***************************************************************/
+/* Run functionally from the current state to the start of the    */
+/* ROI and restart the pipeline there, or to the end of the program */
+/***************************************************************/
+void roi_fast_forward(){
+	CPU_State state = CURRENT_STATE;
+	int status = FUNC_OK;
+	uint32_t branches;
+
+	while (ROI_OUTSIDE && status == FUNC_OK && !functional_out_of_program(&state)){
+		status = functional_step(&state);
+		ROI_FAST_INSTRUCTIONS++;
+	}
+	if (ROI_OUTSIDE){
+		ROI_OUTSIDE = FALSE;
+		CURRENT_STATE = state;
+		NEXT_STATE = state;
+		clear_pipeline();
+		RUN_FLAG = FALSE;
+		return;
+	}
+	branches = ROI_WARNED ? 0 : count_branches();
+	if (branches != 0){
+		printf("Warning: %u branch/jump instructions: the functional model outside the ROI takes them,\n"
+			"the pipeline inside it runs them as NOPs\n", branches);
+	}
+	ROI_WARNED = TRUE;
+	pipeline_start(&state);
+}
+
+/***************************************************************/
+/* roi on|off | roi restore                                                                   */
+/***************************************************************/
+int roi_command(int argc, char **argv){
+	if (argc == 2 && strcmp(argv[1], "on") == 0){
+		ROI_FAST = TRUE;
+		ROI_OUTSIDE = TRUE;
+		ROI_WARNED = FALSE;
+		return CMD_OK;
+	}
+	if (argc == 2 && strcmp(argv[1], "off") == 0){
+		ROI_FAST = FALSE;
+		ROI_OUTSIDE = FALSE;
+		return CMD_OK;
+	}
+	if (argc == 2 && strcmp(argv[1], "restore") == 0){
+		if (ROI_CHECKPOINT.page_data == NULL){
+			printf("The program has not taken a checkpoint\n");
+			return CMD_ERROR;
+		}
+		checkpoint_restore(&ROI_CHECKPOINT);
+		ROI_OUTSIDE = FALSE;
+		stats_reset();
+		return CMD_OK;
+	}
+	printf("Usage: roi on|off | roi restore\n");
+	return CMD_ERROR;
+}
+
+/***************************************************************/
+/* xorshift64*: the fuzzer's deterministic random numbers            */
+/***************************************************************/
+uint64_t fuzz_random(uint64_t *seed){
+	*seed ^= *seed >> 12;
+	*seed ^= *seed << 25;
+	*seed ^= *seed >> 27;
+	return *seed * 0x2545F4914F6CDD1DULL;
+}
+
+/***************************************************************/
+/* A register or memory value, biased towards the edge cases           */
+/***************************************************************/
+uint32_t fuzz_value(uint64_t *seed){
+	uint32_t value = (uint32_t)(fuzz_random(seed) >> 32);
+
+	switch (value & 7){
+		case 0: return 0;
+		case 1: return 1;
+		case 2: return 0xFFFFFFFF;
+		case 3: return (value & 0x100) ? 0x80000000 : 0x7FFFFFFF;
+		case 4: return value >> 24;
+		case 5: return (value & 0x100) ? 0xFFFF8000 : 0x00007FFF;
+		default: return (uint32_t)fuzz_random(seed);
+	}
+}
+
+/***************************************************************/
+/* Collect the instructions the pipeline implements from the       */
+/* disassembly tables: everything but control transfers, SYSCALL */
+/* and COP0                                                                                       */
+/***************************************************************/
+void fuzz_init_ops(){
+	uint32_t i, instruction;
+
+	FUZZ_OP_COUNT = 0;
+	for (i = 0; i < 128; i++){
+		instruction = (i < 64) ? i : (i - 64) << 26;
+		if ((i < 64 ? SPECIAL_TABLE[i] : OPCODE_TABLE[i - 64]).format == FMT_INVALID ||
+				is_control_transfer(instruction) || (instruction >> 26) == 0x10){
+			continue;
+		}
+		FUZZ_OPS[FUZZ_OP_COUNT++] = instruction;
+	}
+}
+
+/***************************************************************/
+/* Generate <length> instructions (plus NOP padding) and the            */
+/* initial registers and data window, all from <seed>                      */
+/***************************************************************/
+void fuzz_generate(fuzz_program_t *program, uint32_t program_seed, uint32_t length){
+	uint64_t seed = program_seed * 0x9E3779B97F4A7C15ULL + 1;
+	int written[FUZZ_LO + 1];
+	uint32_t reads[4], writes[2] = { 0, 0 }, nreads, nwrites, i, j, instruction, opcode, function, rs, rt, rd, width, offset;
+	const disasm_entry_t *entry;
+
+	program->seed = program_seed;
+	program->length = length;
+	memset(&program->state, 0, sizeof(program->state));
+	for (i = 1; i < FUZZ_REGS; i++){
+		program->state.REGS[i] = fuzz_value(&seed);
+	}
+	program->state.REGS[FUZZ_BASE_REG] = MEM_DATA_BEGIN;
+	program->state.HI = fuzz_value(&seed);
+	program->state.LO = fuzz_value(&seed);
+	program->state.PC = MEM_TEXT_BEGIN;
+	for (i = 0; i < FUZZ_WINDOW; i += 4){
+		instruction = fuzz_value(&seed);
+		memcpy(program->window + i, &instruction, 4);
+	}
+	for (i = 0; i <= FUZZ_LO; i++){
+		written[i] = -FUZZ_HAZARD_DISTANCE;
+	}
+
+	program->count = 0;
+	for (i = 0; i < length; i++){
+		instruction = FUZZ_OPS[fuzz_random(&seed) % FUZZ_OP_COUNT];
+		opcode = instruction >> 26;
+		function = instruction & 0x3F;
+		entry = (opcode == 0x00) ? &SPECIAL_TABLE[function] : &OPCODE_TABLE[opcode];
+		rs = fuzz_random(&seed) % FUZZ_REGS;
+		rt = fuzz_random(&seed) % FUZZ_REGS;
+		rd = fuzz_random(&seed) % FUZZ_REGS;
+		nreads = nwrites = 0;
+		switch (entry->format){
+			case FMT_RD_RT_SA:
+				instruction |= (rt << 16) | (rd << 11) | ((fuzz_random(&seed) & 0x1F) << 6);
+				reads[nreads++] = rt;
+				writes[nwrites++] = rd;
+				break;
+			case FMT_RD_RS_RT:
+				instruction |= (rs << 21) | (rt << 16) | (rd << 11);
+				reads[nreads++] = rs;
+				reads[nreads++] = rt;
+				writes[nwrites++] = rd;
+				break;
+			case FMT_RS_RT:	/* MULT..DIVU; a DIV by zero keeps HI and LO */
+				instruction |= (rs << 21) | (rt << 16);
+				reads[nreads++] = rs;
+				reads[nreads++] = rt;
+				reads[nreads++] = FUZZ_HI;
+				reads[nreads++] = FUZZ_LO;
+				writes[nwrites++] = FUZZ_HI;
+				writes[nwrites++] = FUZZ_LO;
+				break;
+			case FMT_RS:	/* MTHI, MTLO */
+				instruction |= rs << 21;
+				reads[nreads++] = rs;
+				writes[nwrites++] = (function == 0x11) ? FUZZ_HI : FUZZ_LO;
+				break;
+			case FMT_RD:	/* MFHI, MFLO */
+				instruction |= rd << 11;
+				reads[nreads++] = (function == 0x10) ? FUZZ_HI : FUZZ_LO;
+				writes[nwrites++] = rd;
+				break;
+			case FMT_RT_RS_IMM:
+				instruction |= (rs << 21) | (rt << 16) | (fuzz_value(&seed) & 0xFFFF);
+				reads[nreads++] = rs;
+				writes[nwrites++] = rt;
+				break;
+			case FMT_RT_IMM:
+				instruction |= (rt << 16) | (fuzz_value(&seed) & 0xFFFF);
+				writes[nwrites++] = rt;
+				break;
+			case FMT_RT_OFFSET_RS:
+				width = ((opcode & 3) == 3) ? 4 : (opcode & 3) + 1;
+				offset = fuzz_random(&seed) % (FUZZ_WINDOW - 3) & ~(width - 1);
+				if ((fuzz_random(&seed) & 63) == 0){
+					offset |= fuzz_random(&seed) & (width - 1);	/* AdEL/AdES */
+				}
+				instruction |= (FUZZ_BASE_REG << 21) | (rt << 16) | offset;
+				if (opcode >= 0x28){
+					reads[nreads++] = rt;
+				}else{
+					writes[nwrites++] = rt;
+				}
+				break;
+			default:
+				break;
+		}
+		for (j = 0; j < nreads; j++){
+			while ((int)program->count - written[reads[j]] < FUZZ_HAZARD_DISTANCE){
+				program->words[program->count++] = 0;	/* NOP */
+			}
+		}
+		for (j = 0; j < nwrites; j++){
+			written[writes[j]] = program->count;
+		}
+		program->words[program->count++] = instruction;
+	}
+}
+
+/***************************************************************/
+/* Run a fuzz program through the pipeline until its last            */
+/* instruction writes back; TRUE if it stopped on an exception       */
+/***************************************************************/
+int fuzz_run_pipeline(const fuzz_program_t *program, CPU_State *state, uint8_t *window){
+	uint8_t *data = (uint8_t *)(PAGE_TABLE[MEM_DATA_BEGIN >> PAGE_SHIFT] & PAGE_HOST_MASK);
+	uint32_t end = MEM_TEXT_BEGIN + 4 * (program->count + FUZZ_HAZARD_DISTANCE);
+	uint64_t cycles = 0, limit = 1000 * (uint64_t)(program->count + 8);
+
+	memcpy(data, program->window, FUZZ_WINDOW);
+	mark_dirty(MEM_DATA_REGION, 0, FUZZ_WINDOW);
+	pipeline_start(&program->state);
+	/*fetch reaches <end> in the cycle the last instruction is in WB*/
+	while (RUN_FLAG && CURRENT_STATE.PC < end && cycles++ < limit){
+		cycle();
+	}
+	*state = CURRENT_STATE;
+	memcpy(window, data, FUZZ_WINDOW);
+	if (cycles > limit){
+		printf("Fuzz program %u: the pipeline did not finish in %llu cycles\n", program->seed, (unsigned long long)limit);
+		state->PC = 0;
+	}
+	return !RUN_FLAG;
+}
+
+/***************************************************************/
+/* Run a fuzz program on the functional model from the same         */
+/* snapshot; TRUE if it stopped on an exception                            */
+/***************************************************************/
+int fuzz_run_functional(const fuzz_program_t *program, CPU_State *state){
+	uint8_t *data = (uint8_t *)(PAGE_TABLE[MEM_DATA_BEGIN >> PAGE_SHIFT] & PAGE_HOST_MASK);
+	uint32_t end = MEM_TEXT_BEGIN + 4 * program->count;
+
+	memcpy(data, program->window, FUZZ_WINDOW);
+	mark_dirty(MEM_DATA_REGION, 0, FUZZ_WINDOW);
+	*state = program->state;
+	while (state->PC < end){
+		if (functional_step(state) != FUNC_OK){
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* Compare the two runs; on a mismatch print the program, the         */
+/* differences and how to replay it, and return FALSE                       */
+/***************************************************************/
+int fuzz_compare(const fuzz_program_t *program, const CPU_State *pipe, const uint8_t *pipe_window,
+		const CPU_State *ref, int pipe_fault, int ref_fault){
+	uint8_t *data = (uint8_t *)(PAGE_TABLE[MEM_DATA_BEGIN >> PAGE_SHIFT] & PAGE_HOST_MASK);
+	char text[DISASM_TEXT_SIZE];
+	uint32_t i, pipe_word, ref_word;
+
+	if (pipe_fault == ref_fault && (!pipe_fault || pipe->PC == ref->PC) &&
+			memcmp(pipe->REGS, ref->REGS, sizeof(ref->REGS)) == 0 &&
+			pipe->HI == ref->HI && pipe->LO == ref->LO && memcmp(pipe_window, data, FUZZ_WINDOW) == 0){
+		return TRUE;
+	}
+
+	printf("Fuzz program %u: the pipeline and the functional model disagree\n", program->seed);
+	for (i = 0; i < program->count; i++){
+		if (program->words[i] != 0){
+			disassemble(program->words[i], MEM_TEXT_BEGIN + 4*i, text, sizeof(text));
+			printf("  0x%08x: %08x  %s\n", MEM_TEXT_BEGIN + 4*i, program->words[i], text);
+		}
+	}
+	printf("Initial:");
+	for (i = 1; i < FUZZ_REGS; i++){
+		printf(" $r%u=0x%08x", i, program->state.REGS[i]);
+	}
+	printf(" HI=0x%08x LO=0x%08x\n", program->state.HI, program->state.LO);
+	printf("%-12s %12s %12s\n", "", "pipeline", "functional");
+	if (pipe_fault || ref_fault){
+		printf("%-12s %12s %12s\n", "stopped", pipe_fault ? "exception" : "end", ref_fault ? "exception" : "end");
+		printf("%-12s   0x%08x   0x%08x\n", "PC", pipe->PC, ref->PC);
+	}
+	for (i = 0; i < MIPS_REGS; i++){
+		if (pipe->REGS[i] != ref->REGS[i]){
+			printf("$r%-11u   0x%08x   0x%08x\n", i, pipe->REGS[i], ref->REGS[i]);
+		}
+	}
+	if (pipe->HI != ref->HI){
+		printf("%-12s   0x%08x   0x%08x\n", "HI", pipe->HI, ref->HI);
+	}
+	if (pipe->LO != ref->LO){
+		printf("%-12s   0x%08x   0x%08x\n", "LO", pipe->LO, ref->LO);
+	}
+	for (i = 0; i < FUZZ_WINDOW; i += 4){
+		memcpy(&pipe_word, pipe_window + i, 4);
+		memcpy(&ref_word, data + i, 4);
+		if (pipe_word != ref_word){
+			printf("[0x%08x]   0x%08x   0x%08x\n", MEM_DATA_BEGIN + i, pipe_word, ref_word);
+		}
+	}
+	printf("Replay with: fuzz 1 %u %u\n\n", program->length, program->seed);
+	return FALSE;
+}
+
+/***************************************************************/
+/* Fuzz <programs> programs of <length> instructions, seeds <seed>   */
+/* upwards.  Only the data window changes between runs, so the     */
+/* snapshot is restored with one copy.  The simulator's own program */
+/* is reloaded afterwards.                                                                  */
+/***************************************************************/
+int run_fuzz(uint64_t programs, uint32_t length, uint32_t seed){
+	static fuzz_program_t program;
+	CPU_State pipe, ref;
+	uint8_t pipe_window[FUZZ_WINDOW], *text;
+	int quiet = QUIET, silent = GUEST_SILENT, profile = PROFILE_ENABLED, pipeview = PIPEVIEW_FD, reuse = REUSE_ENABLED;
+	int pipe_fault, ref_fault, ok = TRUE;
+	FILE *trace = TRACE_FILE;
+	uint32_t interval = INTERVAL_CYCLES, i;
+	uint64_t n, faults = 0, words = 0, start_ns = host_time_ns(), elapsed;
+
+	QUIET = TRUE;
+	GUEST_SILENT = TRUE;
+	PROFILE_ENABLED = FALSE;
+	TRACE_FILE = NULL;
+	PIPEVIEW_FD = -1;
+	INTERVAL_CYCLES = 0;
+	REUSE_ENABLED = FALSE;
+	fuzz_init_ops();
+	clear_memory();
+	KERNEL_SIZE = 0;	/* exceptions stop both models */
+	text = (uint8_t *)(PAGE_TABLE[MEM_TEXT_BEGIN >> PAGE_SHIFT] & PAGE_HOST_MASK);
+
+	for (n = 0; n < programs && ok; n++){
+		fuzz_generate(&program, (uint32_t)(seed + n), length);
+		memset(text, 0, MEM_PAGE_SIZE);
+		mark_dirty(MEM_TEXT_REGION, 0, MEM_PAGE_SIZE);
+		for (i = 0; i < program.count; i++){
+			mem_write_32(MEM_TEXT_BEGIN + 4*i, program.words[i]);
+		}
+		PROGRAM_SIZE = program.count;
+		pipe_fault = fuzz_run_pipeline(&program, &pipe, pipe_window);
+		ref_fault = fuzz_run_functional(&program, &ref);
+		ok = pipe.PC != 0 && fuzz_compare(&program, &pipe, pipe_window, &ref, pipe_fault, ref_fault);
+		faults += ref_fault;
+		words += program.count;
+	}
+	elapsed = host_time_ns() - start_ns;
+
+	reset();
+	QUIET = quiet;
+	GUEST_SILENT = silent;
+	PROFILE_ENABLED = profile;
+	TRACE_FILE = trace;
+	PIPEVIEW_FD = pipeview;
+	REUSE_ENABLED = reuse;
+	INTERVAL_CYCLES = interval;
+	if (INTERVAL_CYCLES != 0){
+		interval_start();
+	}
+	printf("%llu programs (%llu words, %llu stopped on exceptions) in %.3f s, %.0f programs/s: %s\n\n",
+		(unsigned long long)n, (unsigned long long)words, (unsigned long long)faults, elapsed * 1e-9,
+		elapsed ? n * 1e9 / elapsed : 0.0, ok ? "no mismatches" : "MISMATCH");
+	return ok ? CMD_OK : CMD_ERROR;
+}
+
+/***************************************************************/
+/* fuzz <programs> [length] [seed]                                                        */
+/***************************************************************/
+int fuzz_command(int argc, char **argv){
+	uint32_t programs, length = 64, seed = 1;
+
+	if (argc < 2 || argc > 4 || !parse_value(argv[1], 10, &programs) ||
+			(argc > 2 && (!parse_value(argv[2], 10, &length) || length == 0 || length > FUZZ_MAX_LENGTH)) ||
+			(argc > 3 && !parse_value(argv[3], 10, &seed))){
+		printf("Usage: fuzz <programs> [length 1..%u] [seed]\n", FUZZ_MAX_LENGTH);
+		return CMD_ERROR;
+	}
+	return run_fuzz(programs, length, seed);
+}
+
+/***************************************************************/
+/* Next byte from gdb, -1 once it hangs up                                        */
+/***************************************************************/
+int gdb_getc(){
+	ssize_t n;
+
+	if (GDB_INPUT_NEXT == GDB_INPUT_LENGTH){
+		do {
+			n = recv(GDB_FD, GDB_INPUT, sizeof(GDB_INPUT), 0);
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0){
+			return -1;
+		}
+		GDB_INPUT_NEXT = 0;
+		GDB_INPUT_LENGTH = n;
+	}
+	return GDB_INPUT[GDB_INPUT_NEXT++];
+}
+
+/***************************************************************/
+/* Read one $<data>#<checksum> packet into <packet> (still escaped, */
+/* NUL-terminated) and acknowledge it; its length, -1 on hang-up      */
+/***************************************************************/
+int gdb_read_packet(char *packet, uint32_t size){
+	uint32_t length, sum;
+	int c, high, low;
+
+	while (1){
+		do {
+			c = gdb_getc();
+		} while (c >= 0 && c != '$');	/* acks and stray ^C between packets */
+		if (c < 0){
+			return -1;
+		}
+		length = sum = 0;
+		while ((c = gdb_getc()) >= 0 && c != '#'){
+			if (length + 1 < size){
+				packet[length++] = c;
+			}
+			sum += c;
+		}
+		high = gdb_getc();
+		low = gdb_getc();
+		if (c < 0 || low < 0){
+			return -1;
+		}
+		packet[length] = '\0';
+		if (GDB_NO_ACK){
+			return length;
+		}
+		if (strtoul((char []){ high, low, '\0' }, NULL, 16) == (sum & 0xFF)){
+			return send(GDB_FD, "+", 1, MSG_NOSIGNAL) == 1 ? (int)length : -1;
+		}
+		if (send(GDB_FD, "-", 1, MSG_NOSIGNAL) != 1){
+			return -1;
+		}
+	}
+}
+
+/***************************************************************/
+/* Send <data> as one packet; FALSE once gdb has hung up               */
+/***************************************************************/
+int gdb_send(const char *data, uint32_t length){
+	static char frame[2 * GDB_PACKET_SIZE + 32];
+	uint32_t i, sum = 0;
+	size_t sent;
+	ssize_t n;
+
+	frame[0] = '$';
+	for (i = 0; i < length; i++){
+		frame[i + 1] = data[i];
+		sum += (uint8_t)data[i];
+	}
+	snprintf(frame + length + 1, 4, "#%02x", sum & 0xFF);
+	for (sent = 0; sent < length + 4; sent += n){
+		n = send(GDB_FD, frame + sent, length + 4 - sent, MSG_NOSIGNAL);
+		if (n <= 0){
+			if (n < 0 && errno == EINTR){
+				n = 0;
+				continue;
+			}
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+int gdb_send_text(const char *text){
+	return gdb_send(text, strlen(text));
+}
+
+/***************************************************************/
+/* Parse hex digits at *<text>, leaving it after them                    */
+/***************************************************************/
+uint32_t gdb_hex_value(const char **text){
+	uint32_t value = 0;
+	char c;
+
+	while ((c = **text) != '\0' && strchr("0123456789abcdefABCDEF", c) != NULL){
+		value = (value << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+		(*text)++;
+	}
+	return value;
+}
+
+/***************************************************************/
+/* Copy guest memory through the page table; stops at the first   */
+/* page that is not plain memory (MMIO or unmapped).  Bytes copied.  */
+/***************************************************************/
+uint32_t gdb_read_memory(uint32_t address, uint8_t *data, uint32_t length){
+	uint32_t done = 0, offset, chunk;
+	uintptr_t entry;
+
+	while (done < length){
+		entry = PAGE_TABLE[(address + done) >> PAGE_SHIFT];
+		if (!(entry & PAGE_HOST_MASK)){
+			break;
+		}
+		offset = (address + done) & (MEM_PAGE_SIZE - 1);
+		chunk = MEM_PAGE_SIZE - offset < length - done ? MEM_PAGE_SIZE - offset : length - done;
+		memcpy(data + done, (uint8_t *)(entry & PAGE_HOST_MASK) + offset, chunk);
+		done += chunk;
+	}
+	return done;
+}
+
+int gdb_write_memory(uint32_t address, const uint8_t *data, uint32_t length){
+	uint32_t done = 0, offset, chunk;
+	uintptr_t entry;
+	int region;
+
+	while (done < length){
+		entry = PAGE_TABLE[(address + done) >> PAGE_SHIFT];
+		if (!(entry & PAGE_HOST_MASK)){
+			return FALSE;
+		}
+		offset = (address + done) & (MEM_PAGE_SIZE - 1);
+		chunk = MEM_PAGE_SIZE - offset < length - done ? MEM_PAGE_SIZE - offset : length - done;
+		memcpy((uint8_t *)(entry & PAGE_HOST_MASK) + offset, data + done, chunk);
+		region = entry & PAGE_REGION_MASK;
+		mark_dirty(region, address + done - MEM_REGIONS[region].begin, chunk);
+		done += chunk;
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* Registers in gdb's MIPS numbering; there is no FPU, its registers */
+/* read as zero                                                                                   */
+/***************************************************************/
+uint32_t gdb_get_register(uint32_t reg){
+	switch (reg){
+		case 32: return CURRENT_STATE.COP0[COP0_STATUS];
+		case 33: return CURRENT_STATE.LO;
+		case 34: return CURRENT_STATE.HI;
+		case 35: return CURRENT_STATE.COP0[COP0_BADVADDR];
+		case 36: return cop0_read(&CURRENT_STATE, COP0_CAUSE);
+		case 37: return CURRENT_STATE.PC;
+	}
+	return reg < MIPS_REGS ? CURRENT_STATE.REGS[reg] : 0;
+}
+
+void gdb_set_register(uint32_t reg, uint32_t value){
+	switch (reg){
+		case 0: break;
+		case 32: cop0_write(&CURRENT_STATE, COP0_STATUS, value); break;
+		case 33: CURRENT_STATE.LO = value; break;
+		case 34: CURRENT_STATE.HI = value; break;
+		case 35: CURRENT_STATE.COP0[COP0_BADVADDR] = value; break;
+		case 36: CURRENT_STATE.COP0[COP0_CAUSE] = value & ~CAUSE_IP; break;
+		case 37: CURRENT_STATE.PC = value; break;
+		default:
+			if (reg < MIPS_REGS){
+				CURRENT_STATE.REGS[reg] = value;
+			}
+			break;
+	}
+	NEXT_STATE = CURRENT_STATE;
+}
+
+/***************************************************************/
+/* Is any instruction in the pipeline?                                              */
+/***************************************************************/
+int gdb_in_flight(){
+	return !pipeline_empty();
+}
+
+/***************************************************************/
+/* Hold fetch and let the instructions in flight retire, leaving  */
+/* CURRENT_STATE architectural with PC at the next instruction         */
+/***************************************************************/
+void gdb_drain(){
+	while (RUN_FLAG && gdb_in_flight()){
+		SYSCALL_SEQ = GDB_FETCH_HOLD;
+		cycle();
+	}
+	SYSCALL_SEQ = 0;
+}
+
+/***************************************************************/
+/* Did the load or store that just left MEM touch a watchpoint?     */
+/***************************************************************/
+int gdb_watch_hit(uint32_t *address, uint32_t *type){
+	uint32_t opcode = MEM_WB.IR >> 26, access = MEM_WB.ALUOutput, width, store, i;
+	const gdb_watch_t *watch;
+
+	if (MEM_WB.seq == 0 || MEM_WB.exception || opcode < 0x20){
+		return FALSE;
+	}
+	width = ((opcode & 3) == 3) ? 4 : (opcode & 3) + 1;
+	store = opcode >= 0x28;
+	for (i = 0; i < GDB_WATCHPOINT_COUNT; i++){
+		watch = &GDB_WATCHPOINTS[i];
+		if (access < watch->address + watch->length && watch->address < access + width &&
+				(watch->type == GDB_WATCH_ACCESS || (watch->type == GDB_WATCH_WRITE) == store)){
+			*address = watch->address;
+			*type = watch->type;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/***************************************************************/
+/* Continue, or step one instruction, until something stops the     */
+/* program; the stop reply goes to <reply>                                      */
+/***************************************************************/
+void gdb_resume(int step, char *reply){
+	static const char *watch_names[] = { "watch", "rwatch", "awatch" };
+	uint64_t start_ns = host_time_ns(), cycles = 0;
+	uint32_t start_cycles = CYCLE_COUNT, start_instructions = INSTRUCTION_COUNT;
+	uint32_t start_seq = FETCH_SEQ, exception = 0, address, type, pc, i;
+	char c;
+
+	reply[0] = '\0';
+	while (RUN_FLAG && reply[0] == '\0'){
+		if (FETCH_SEQ != start_seq){
+			for (i = 0; i < GDB_BREAKPOINT_COUNT && GDB_BREAKPOINTS[i] != CURRENT_STATE.PC; i++);
+			if (step || i < GDB_BREAKPOINT_COUNT){
+				gdb_drain();
+				strcpy(reply, "S05");
+				break;
+			}
+		}
+		exception = MEM_WB.exception;
+		cycle();
+		if (GDB_WATCHPOINT_COUNT != 0 && gdb_watch_hit(&address, &type)){
+			/*the access is done: drop the younger instructions and resume at the oldest of them*/
+			pc = CURRENT_STATE.PC;
+			pc = ID_IF.seq ? ID_IF.PC - 4 : pc;
+			pc = IF_EX.seq ? IF_EX.PC - 4 : pc;
+			pc = EX_MEM.seq ? EX_MEM.PC - 4 : pc;
+			squash_latch(&EX_MEM);
+			squash_latch(&IF_EX);
+			squash_latch(&ID_IF);
+			CURRENT_STATE.PC = NEXT_STATE.PC = pc;
+			gdb_drain();
+			sprintf(reply, "T05%s:%x;", watch_names[type - GDB_WATCH_WRITE], address);
+		}
+		if (++cycles % GDB_POLL_CYCLES == 0 && recv(GDB_FD, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 1 && c == 0x03){
+			recv(GDB_FD, &c, 1, 0);
+			gdb_drain();
+			strcpy(reply, "S02");
+		}
+	}
+	if (!RUN_FLAG && reply[0] == '\0'){
+		switch (exception ? exception - 1 : EXC_NONE){
+			case EXC_NONE: sprintf(reply, "W%02x", GUEST_EXIT_CODE & 0xFF); break;
+			case EXC_OV: strcpy(reply, "S08"); break;	/* SIGFPE */
+			case EXC_ADEL: case EXC_ADES: strcpy(reply, "S0a"); break;	/* SIGBUS */
+			case EXC_RI: strcpy(reply, "S04"); break;	/* SIGILL */
+			default: strcpy(reply, "S05"); break;
+		}
+	}
+	guest_flush();
+	account_host_time(start_ns, start_cycles, start_instructions);
+}
+
+/***************************************************************/
+/* Z/z packets: <type> 0/1 breakpoint, 2 write, 3 read, 4 access    */
+/* watchpoint                                                                                     */
+/***************************************************************/
+int gdb_breakpoint(char type, uint32_t address, uint32_t length, int insert){
+	uint32_t i;
+
+	if (type == '0' || type == '1'){
+		for (i = 0; i < GDB_BREAKPOINT_COUNT && GDB_BREAKPOINTS[i] != address; i++);
+		if (!insert){
+			if (i < GDB_BREAKPOINT_COUNT){
+				GDB_BREAKPOINTS[i] = GDB_BREAKPOINTS[--GDB_BREAKPOINT_COUNT];
+			}
+			return TRUE;
+		}
+		if (i == GDB_BREAKPOINT_COUNT){
+			if (GDB_BREAKPOINT_COUNT == GDB_MAX_BREAKPOINTS){
+				return FALSE;
+			}
+			GDB_BREAKPOINTS[GDB_BREAKPOINT_COUNT++] = address;
+		}
+		return TRUE;
+	}
+	if (type < '2' || type > '4'){
+		return FALSE;
+	}
+	for (i = 0; i < GDB_WATCHPOINT_COUNT; i++){
+		if (GDB_WATCHPOINTS[i].address == address && GDB_WATCHPOINTS[i].length == length &&
+				GDB_WATCHPOINTS[i].type == (uint32_t)(type - '0')){
+			break;
+		}
+	}
+	if (!insert){
+		if (i < GDB_WATCHPOINT_COUNT){
+			GDB_WATCHPOINTS[i] = GDB_WATCHPOINTS[--GDB_WATCHPOINT_COUNT];
+		}
+		return TRUE;
+	}
+	if (i == GDB_WATCHPOINT_COUNT){
+		if (GDB_WATCHPOINT_COUNT == GDB_MAX_WATCHPOINTS){
+			return FALSE;
+		}
+		GDB_WATCHPOINTS[GDB_WATCHPOINT_COUNT++] = (gdb_watch_t){ address, length ? length : 1, type - '0' };
+	}
+	return TRUE;
+}
+
+/***************************************************************/
+/* q packets.  "monitor <command>" runs a simulator command, its  */
+/* output on the simulator's terminal.                                             */
+/***************************************************************/
+void gdb_query(const char *packet, char *reply){
+	static char xml[8192];
+	static uint32_t xml_length;
+	char line[CMD_BUFFER_SIZE], *argv[CMD_MAX_ARGS];
+	const char *p;
+	uint32_t offset, length, i;
+	int argc;
+
+	reply[0] = '\0';
+	if (strncmp(packet, "qSupported", 10) == 0){
+		sprintf(reply, "PacketSize=%x;QStartNoAckMode+;qXfer:features:read+;binary-upload+", GDB_PACKET_SIZE);
+	}else if (strcmp(packet, "qAttached") == 0){
+		strcpy(reply, "1");
+	}else if (strcmp(packet, "qC") == 0){
+		strcpy(reply, "QC1");
+	}else if (strcmp(packet, "qfThreadInfo") == 0){
+		strcpy(reply, "m1");
+	}else if (strcmp(packet, "qsThreadInfo") == 0){
+		strcpy(reply, "l");
+	}else if (strncmp(packet, "qSymbol", 7) == 0){
+		strcpy(reply, "OK");
+	}else if (strncmp(packet, "qXfer:features:read:target.xml:", 31) == 0){
+		if (xml_length == 0){
+			xml_length = snprintf(xml, sizeof(xml), "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+				"<target><architecture>mips</architecture><feature name=\"org.gnu.gdb.mips.cpu\">");
+			for (i = 0; i < MIPS_REGS; i++){
+				xml_length += snprintf(xml + xml_length, sizeof(xml) - xml_length, "<reg name=\"r%u\" bitsize=\"32\" regnum=\"%u\"/>", i, i);
+			}
+			xml_length += snprintf(xml + xml_length, sizeof(xml) - xml_length, "<reg name=\"lo\" bitsize=\"32\" regnum=\"33\"/>"
+				"<reg name=\"hi\" bitsize=\"32\" regnum=\"34\"/><reg name=\"pc\" bitsize=\"32\" regnum=\"37\"/></feature>"
+				"<feature name=\"org.gnu.gdb.mips.cp0\"><reg name=\"status\" bitsize=\"32\" regnum=\"32\"/>"
+				"<reg name=\"badvaddr\" bitsize=\"32\" regnum=\"35\"/><reg name=\"cause\" bitsize=\"32\" regnum=\"36\"/></feature>"
+				"<feature name=\"org.gnu.gdb.mips.fpu\">");
+			for (i = 0; i < 32; i++){
+				xml_length += snprintf(xml + xml_length, sizeof(xml) - xml_length,
+					"<reg name=\"f%u\" bitsize=\"32\" type=\"ieee_single\" regnum=\"%u\"/>", i, 38 + i);
+			}
+			xml_length += snprintf(xml + xml_length, sizeof(xml) - xml_length, "<reg name=\"fcsr\" bitsize=\"32\" group=\"float\" regnum=\"70\"/>"
+				"<reg name=\"fir\" bitsize=\"32\" group=\"float\" regnum=\"71\"/></feature></target>");
+		}
+		p = packet + 31;
+		offset = gdb_hex_value(&p);
+		p += (*p == ',');
+		length = gdb_hex_value(&p);
+		if (offset >= xml_length){
+			strcpy(reply, "l");
+		}else{
+			length = length < xml_length - offset ? length : xml_length - offset;
+			length = length < GDB_PACKET_SIZE - 1 ? length : GDB_PACKET_SIZE - 1;
+			reply[0] = (offset + length < xml_length) ? 'm' : 'l';
+			memcpy(reply + 1, xml + offset, length);
+			reply[length + 1] = '\0';
+		}
+	}else if (strncmp(packet, "qRcmd,", 6) == 0){
+		for (p = packet + 6, i = 0; p[0] != '\0' && p[1] != '\0' && i + 1 < sizeof(line); p += 2){
+			line[i++] = strtoul((char []){ p[0], p[1], '\0' }, NULL, 16);
+		}
+		line[i] = '\0';
+		argc = tokenize_command(line, argv, CMD_MAX_ARGS);
+		if (argc > 0){
+			execute_command(argc, argv);
+			gdb_drain();
+		}
+		fflush(stdout);
+		strcpy(reply, "OK");
+	}
+}
+
+/***************************************************************/
+/* Wait for gdb on 127.0.0.1:<port> (all digits) or a Unix socket; */
+/* the connected descriptor, -1 on error                                       */
+/***************************************************************/
+int gdb_listen(const char *where){
+	struct sockaddr_un unix_addr;
+	struct sockaddr_in inet_addr;
+	int listen_fd, fd, one = 1, tcp = where[strspn(where, "0123456789")] == '\0';
+
+	if (tcp){
+		memset(&inet_addr, 0, sizeof(inet_addr));
+		inet_addr.sin_family = AF_INET;
+		inet_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		inet_addr.sin_port = htons(atoi(where));
+		listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (listen_fd >= 0){
+			setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		}
+		if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&inet_addr, sizeof(inet_addr)) != 0 ||
+				listen(listen_fd, 1) != 0){
+			perror(where);
+			if (listen_fd >= 0) close(listen_fd);
+			return -1;
+		}
+	}else{
+		if (strlen(where) >= sizeof(unix_addr.sun_path)){
+			printf("Error: Socket path too long: %s\n", where);
+			return -1;
+		}
+		memset(&unix_addr, 0, sizeof(unix_addr));
+		unix_addr.sun_family = AF_UNIX;
+		strcpy(unix_addr.sun_path, where);
+		unlink(where);
+		listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&unix_addr, sizeof(unix_addr)) != 0 ||
+				listen(listen_fd, 1) != 0){
+			perror(where);
+			if (listen_fd >= 0) close(listen_fd);
+			return -1;
 		}
 	}
-	
-	instruction = IF_EX.IR;
-	opcode = (instruction & 0xFC000000) >> 26;
-	function = instruction & 0x0000003F;
-	rs = (instruction & 0x03E00000) >> 21;
-	rt = (instruction & 0x001F0000) >> 16;
-	rd = (instruction & 0x0000F800) >> 11;
-	sa = (instruction & 0x000007C0) >> 6;
-	immediate = instruction & 0x0000FFFF;
-	target = instruction & 0x03FFFFFF;
-	
-	if(opcode == 0x00){
-		/*R format instructions here*/
-		
-		switch(function){
-			case 0x00:
-				snprintf(id_ex,64,"SLL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x02:
-				snprintf(id_ex,64,"SRL $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x03:
-				snprintf(id_ex,64,"SRA $r%u, $r%u, 0x%x\n", rd, rt, sa);
-				break;
-			case 0x08:
-				snprintf(id_ex,64,"JR $r%u\n", rs);
+
+	printf("Waiting for gdb on %s%s\n", tcp ? "localhost:" : "", where);
+	fflush(stdout);
+	do {
+		fd = accept(listen_fd, NULL, NULL);
+	} while (fd < 0 && errno == EINTR);
+	close(listen_fd);
+	if (!tcp){
+		unlink(where);
+	}
+	if (fd < 0){
+		perror("accept");
+		return -1;
+	}
+	if (tcp){
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}
+
+/***************************************************************/
+/* Serve one gdb connection until it detaches, kills or hangs up    */
+/***************************************************************/
+int gdb_serve(int fd){
+	static char packet[GDB_PACKET_SIZE + 1], reply[2 * GDB_PACKET_SIZE + 16];
+	static uint8_t data[GDB_PACKET_SIZE];
+	const char *p;
+	uint32_t address, length, reg, i, n;
+	int quiet = QUIET, done = FALSE, size;
+	char *out;
+
+	GDB_FD = fd;
+	GDB_NO_ACK = FALSE;
+	GDB_INPUT_NEXT = GDB_INPUT_LENGTH = 0;
+	GDB_BREAKPOINT_COUNT = 0;
+	GDB_WATCHPOINT_COUNT = 0;
+	QUIET = TRUE;
+	gdb_drain();
+
+	while (!done && (size = gdb_read_packet(packet, sizeof(packet))) >= 0){
+		p = packet + 1;
+		reply[0] = '\0';
+		switch (packet[0]){
+			case '?':
+				strcpy(reply, RUN_FLAG ? "S05" : "W00");
+				break;
+			case 'g':
+				for (reg = 0, out = reply; reg < GDB_NUM_REGS; reg++, out += 8){
+					n = gdb_get_register(reg);
+					sprintf(out, "%02x%02x%02x%02x", n & 0xFF, (n >> 8) & 0xFF, (n >> 16) & 0xFF, n >> 24);
+				}
 				break;
-			case 0x09:
-				if(rd == 31){
-					snprintf(id_ex,64,"JALR $r%u\n", rs);
+			case 'G':
+			case 'P':
+				reg = (packet[0] == 'P') ? gdb_hex_value(&p) : 0;
+				p += (*p == '=');
+				for (; reg < GDB_NUM_REGS && strlen(p) >= 8; reg++, p += 8){
+					for (i = 0, n = 0; i < 4; i++){
+						n |= (uint32_t)strtoul((char []){ p[2*i], p[2*i + 1], '\0' }, NULL, 16) << (8 * i);
+					}
+					gdb_set_register(reg, n);
+					if (packet[0] == 'P'){
+						break;
+					}
 				}
-				else{
-					snprintf(id_ex,64,"JALR $r%u, $r%u\n", rd, rs);
+				strcpy(reply, "OK");
+				break;
+			case 'p':
+				n = gdb_get_register(gdb_hex_value(&p));
+				sprintf(reply, "%02x%02x%02x%02x", n & 0xFF, (n >> 8) & 0xFF, (n >> 16) & 0xFF, n >> 24);
+				break;
+			case 'm':
+			case 'x':
+				address = gdb_hex_value(&p);
+				p += (*p == ',');
+				length = gdb_hex_value(&p);
+				length = length < GDB_PACKET_SIZE / 2 ? length : GDB_PACKET_SIZE / 2;
+				n = gdb_read_memory(address, data, length);
+				if (n == 0 && length != 0){
+					strcpy(reply, "E01");
+				}else if (packet[0] == 'm'){
+					for (i = 0; i < n; i++){
+						sprintf(reply + 2*i, "%02x", data[i]);
+					}
+				}else{
+					/*binary, with #, $, } and * escaped*/
+					out = reply;
+					*out++ = 'b';
+					for (i = 0; i < n; i++){
+						if (data[i] == '#' || data[i] == '$' || data[i] == '}' || data[i] == '*'){
+							*out++ = '}';
+							*out++ = data[i] ^ 0x20;
+						}else{
+							*out++ = data[i];
+						}
+					}
+					done = !gdb_send(reply, out - reply);
+					continue;
 				}
 				break;
-			case 0x0C:
-				snprintf(id_ex,64,"SYSCALL\n");
-				break;
-			case 0x10:
-				snprintf(id_ex,64,"MFHI $r%u\n", rd);
-				break;
-			case 0x11:
-				snprintf(id_ex,64,"MTHI $r%u\n", rs);
-				break;
-			case 0x12:
-				snprintf(id_ex,64,"MFLO $r%u\n", rd);
-				break;
-			case 0x13:
-				snprintf(id_ex,64,"MTLO $r%u\n", rs);
-				break;
-			case 0x18:
-				snprintf(id_ex,64,"MULT $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x19:
-				snprintf(id_ex,64,"MULTU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1A:
-				snprintf(id_ex,64,"DIV $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x1B:
-				snprintf(id_ex,64,"DIVU $r%u, $r%u\n", rs, rt);
-				break;
-			case 0x20:
-				snprintf(id_ex,64,"ADD $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x21:
-				snprintf(id_ex,64,"ADDU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x22:
-				snprintf(id_ex,64,"SUB $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x23:
-				snprintf(id_ex,64,"SUBU $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x24:
-				snprintf(id_ex,64,"AND $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x25:
-				snprintf(id_ex,64,"OR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x26:
-				snprintf(id_ex,64,"XOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x27:
-				snprintf(id_ex,64,"NOR $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			case 0x2A:
-				snprintf(id_ex,64,"SLT $r%u, $r%u, $r%u\n", rd, rs, rt);
-				break;
-			default:
-				snprintf(id_ex,64,"Instruction is not implemented!\n");
+			case 'M':
+			case 'X':
+				address = gdb_hex_value(&p);
+				p += (*p == ',');
+				length = gdb_hex_value(&p);
+				p += (*p == ':');
+				for (i = 0; i < length && i < sizeof(data) && p < packet + size; i++){
+					if (packet[0] == 'M'){
+						data[i] = strtoul((char []){ p[0], p[1], '\0' }, NULL, 16);
+						p += 2;
+					}else if (*p == '}'){
+						data[i] = p[1] ^ 0x20;
+						p += 2;
+					}else{
+						data[i] = *p++;
+					}
+				}
+				strcpy(reply, (i == length && gdb_write_memory(address, data, length)) ? "OK" : "E01");
 				break;
-		}
-	}
-	else{
-		switch(opcode){
-			case 0x01:
-				if(rt == 0){
-					snprintf(id_ex,64,"BLTZ $r%u, 0x%x\n", rs, immediate<<2);
+			case 'c':
+			case 's':
+				if (*p != '\0'){
+					gdb_set_register(37, gdb_hex_value(&p));
 				}
-				else if(rt == 1){
-					snprintf(id_ex,64,"BGEZ $r%u, 0x%x\n", rs, immediate<<2);
+				gdb_resume(packet[0] == 's', reply);
+				break;
+			case 'Z':
+			case 'z':
+				p = packet + 3;
+				address = gdb_hex_value(&p);
+				p += (*p == ',');
+				length = gdb_hex_value(&p);
+				strcpy(reply, gdb_breakpoint(packet[1], address, length, packet[0] == 'Z') ? "OK" : "E01");
+				break;
+			case 'H':
+			case 'T':
+				strcpy(reply, "OK");
+				break;
+			case 'q':
+				gdb_query(packet, reply);
+				break;
+			case 'Q':
+				if (strcmp(packet, "QStartNoAckMode") == 0){
+					done = !gdb_send_text("OK");
+					GDB_NO_ACK = TRUE;
+					continue;
 				}
 				break;
-			case 0x02:
-				snprintf(id_ex,64,"J 0x%x\n", (CURRENT_STATE.PC & 0xF0000000) | (target<<2));
-				break;
-			case 0x03:
-				snprintf(id_ex,64,"JAL 0x%x\n", (CURRENT_STATE.PC & 0xF0000000) | (target<<2));
-				break;
-			case 0x04:
-				snprintf(id_ex,64,"BEQ $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x05:
-				snprintf(id_ex,64,"BNE $r%u, $r%u, 0x%x\n", rs, rt, immediate<<2);
-				break;
-			case 0x06:
-				snprintf(id_ex,64,"BLEZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x07:
-				snprintf(id_ex,64,"BGTZ $r%u, 0x%x\n", rs, immediate<<2);
-				break;
-			case 0x08:
-				snprintf(id_ex,64,"ADDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x09:
-				snprintf(id_ex,64,"ADDIU $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0A:
-				snprintf(id_ex,64,"SLTI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0C:
-				snprintf(id_ex,64,"ANDI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0D:
-				snprintf(id_ex,64,"ORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0E:
-				snprintf(id_ex,64,"XORI $r%u, $r%u, 0x%x\n", rt, rs, immediate);
-				break;
-			case 0x0F:
-				snprintf(id_ex,64,"LUI $r%u, 0x%x\n", rt, immediate);
-				break;
-			case 0x20:
-				snprintf(id_ex,64,"LB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x21:
-				snprintf(id_ex,64,"LH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x23:
-				snprintf(id_ex,64,"LW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x28:
-				snprintf(id_ex,64,"SB $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x29:
-				snprintf(id_ex,64,"SH $r%u, 0x%x($r%u)\n", rt, immediate, rs);
-				break;
-			case 0x2B:
-				snprintf(id_ex,64,"SW $r%u, 0x%x($r%u)\n", rt, immediate, rs);
+			case 'v':
+				if (strcmp(packet, "vKill") == 0 || strncmp(packet, "vKill;", 6) == 0){
+					strcpy(reply, "OK");
+					done = TRUE;
+				}
 				break;
-			default:
-				snprintf(id_ex,64,"Instruction is not implemented!\n");
+			case 'D':
+				strcpy(reply, "OK");
+				done = TRUE;
 				break;
+			case 'k':
+				done = TRUE;
+				continue;
+		}
+		if (!gdb_send_text(reply)){
+			done = TRUE;	/* gdb hung up: detach as on a read */
 		}
 	}
-	printf("************************************************************\n");
-	printf("CURRENT PC:\t\t0x%x\n",CURRENT_STATE.PC);
-	printf("IF/ID.IR\t\t0x%x\t%s",ID_IF.IR,string1);
-	printf("IF/ID.PC\t\t0x%x\n",ID_IF.PC);
-	printf("\n");
-	printf("ID/EX.IR\t\t0x%x\t%s",IF_EX.IR,string2);
-	printf("ID/EX.A\t\t\t0x%x\n",IF_EX.A);
-	printf("ID/EX.B\t\t\t0x%x\n",IF_EX.B);
-	printf("ID/EX.imm\t\t0x%x\n",IF_EX.imm);
-	printf("\n");
-	printf("EX/MEM.IR\t\t0x%x\n",EX_MEM.IR);
-	printf("EX/MEM.A\t\t0x%x\n",EX_MEM.A);
-	printf("EX/MEM.B\t\t0x%x\n",EX_MEM.B);
-	printf("EX/MEM.ALUOutput\t0x%x\n",EX_MEM.ALUOutput);
-	printf("\n");
-	printf("MEM/WB.IR\t\t0x%x\n",MEM_WB.IR);
-	printf("MEM/WB.ALUOutput\t0x%x\n",MEM_WB.ALUOutput);
-	printf("MEM/WB.LMD\t\t0x%x\n",MEM_WB.LMD);
-	printf("\n");
+	close(fd);
+	GDB_FD = -1;
+	QUIET = quiet;
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* gdb <port>|<socket path>                                                              */
+/***************************************************************/
+int gdb_command(int argc, char **argv){
+	int fd;
+
+	if (argc != 2){
+		printf("Usage: gdb <port>|<socket path>\n");
+		return CMD_ERROR;
+	}
+	fd = gdb_listen(argv[1]);
+	if (fd < 0){
+		return CMD_ERROR;
+	}
+	gdb_serve(fd);
+	printf("gdb disconnected\n");
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* FNV-1a over 64-bit words, then the trailing bytes                   */
+/***************************************************************/
+uint64_t store_hash(uint64_t hash, const void *data, size_t length){
+	const uint8_t *bytes = data;
+	uint64_t word;
+
+	for (; length >= 8; length -= 8, bytes += 8){
+		memcpy(&word, bytes, 8);
+		hash = (hash ^ word) * STORE_HASH_PRIME;
+	}
+	for (; length > 0; length--){
+		hash = (hash ^ *bytes++) * STORE_HASH_PRIME;
+	}
+	return hash;
+}
+
+/***************************************************************/
+/* Hash the rest of a file and rewind it                                          */
+/***************************************************************/
+uint64_t store_file_hash(FILE *fp){
+	static char buffer[65536];	/* a multiple of 8: chunking does not change the hash */
+	uint64_t hash = STORE_HASH_SEED;
+	size_t n;
+
+	while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0){
+		hash = store_hash(hash, buffer, n);
+	}
+	rewind(fp);
+	return hash;
+}
+
+/***************************************************************/
+/* Map a store file copy-on-write; NULL if missing or empty.  With */
+/* <fd_out>, the file is also left open there                              */
+/***************************************************************/
+void *store_map(uint64_t hash, const char *suffix, size_t *size, int *fd_out){
+	char path[sizeof(STORE_DIR) + 32];
+	struct stat st;
+	void *map;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%016llx.%s", STORE_DIR, (unsigned long long)hash, suffix);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0){
+		return NULL;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size == 0){
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED || fd_out == NULL){
+		close(fd);
+	}else{
+		*fd_out = fd;
+	}
+	if (map == MAP_FAILED){
+		return NULL;
+	}
+	*size = st.st_size;
+	return map;
+}
+
+/***************************************************************/
+/* Publish a store file: write a temporary and rename it into place, */
+/* so concurrent readers see all of it or nothing                            */
+/***************************************************************/
+void store_write(uint64_t hash, const char *suffix, out_buffer_t *data){
+	char path[sizeof(STORE_DIR) + 32], temporary[sizeof(STORE_DIR) + 64];
+	size_t length = data->length;
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%016llx.%s", STORE_DIR, (unsigned long long)hash, suffix);
+	snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid());
+	fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0){
+		return;
+	}
+	out_flush(data, fd);
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size != length || close(fd) != 0 || rename(temporary, path) != 0){
+		unlink(temporary);
+	}
+}
+
+/***************************************************************/
+/* Use the stored image with this content hash; FALSE if none        */
+/***************************************************************/
+int store_image_map(program_image_t *image, uint64_t hash){
+	store_image_t *header;
+	size_t size, words;
+	int fd;
+
+	header = store_map(hash, "img", &size, &fd);
+	if (header == NULL){
+		STORE_IMAGE_MISSES++;
+		return FALSE;
+	}
+	words = ((size_t)header->count * sizeof(uint32_t) + MEM_PAGE_SIZE - 1) & ~(size_t)(MEM_PAGE_SIZE - 1);
+	if (size < MEM_PAGE_SIZE || memcmp(header->magic, STORE_IMAGE_MAGIC, 8) != 0 || header->hash != hash ||
+			size != MEM_PAGE_SIZE + words + (size_t)header->count * DISASM_TEXT_SIZE){
+		munmap(header, size);
+		close(fd);
+		STORE_IMAGE_MISSES++;
+		return FALSE;
+	}
+	image->mapping = header;
+	image->mapping_size = size;
+	image->count = header->count;
+	image->words = (uint32_t *)((char *)header + MEM_PAGE_SIZE);
+	image->text = (char *)image->words + words;
+	image->text_fd = fd + 1;	/* the words are mapped as text straight from the store */
+	image->text_offset = MEM_PAGE_SIZE;
+	STORE_IMAGE_HITS++;
+	return TRUE;
+}
+
+/***************************************************************/
+/* Disassemble a freshly parsed image and put it in the store         */
+/***************************************************************/
+void store_image_save(program_image_t *image, uint64_t hash){
+	store_image_t header = { STORE_IMAGE_MAGIC, hash, image->count, 0 };
+	static const char zero[MEM_PAGE_SIZE];
+	size_t words = (size_t)image->count * sizeof(uint32_t);
+	out_buffer_t out = { 0 };
+	uint32_t i;
+
+	for (i = 0; i < image->count; i++){
+		disassemble(image->words[i], MEM_TEXT_BEGIN + 4*i, image->text + (size_t)i * DISASM_TEXT_SIZE, DISASM_TEXT_SIZE);
+	}
+	/*header and words each fill whole pages, so the words can be mapped as text*/
+	out_append(&out, (const char *)&header, sizeof(header));
+	out_append(&out, zero, MEM_PAGE_SIZE - sizeof(header));
+	out_append(&out, (const char *)image->words, words);
+	out_append(&out, zero, (MEM_PAGE_SIZE - words % MEM_PAGE_SIZE) % MEM_PAGE_SIZE);
+	out_append(&out, image->text, (size_t)image->count * DISASM_TEXT_SIZE);
+	store_write(hash, "img", &out);
+	free(out.data);
+}
+
+/***************************************************************/
+/* Key of a run from here: this build, the architectural state,  */
+/* the pipeline latches and every dirty memory page                          */
+/***************************************************************/
+uint64_t memo_key(){
+	static const char build[] = __DATE__ " " __TIME__;
+	checkpoint_t checkpoint;
+	uint64_t hash;
+
+	checkpoint_save(&checkpoint, &CURRENT_STATE, 0);
+	hash = store_hash(STORE_HASH_SEED, build, sizeof(build));
+	hash = store_hash(hash, &checkpoint.state, sizeof(checkpoint.state));
+	hash = store_hash(hash, &checkpoint.heap_break, sizeof(checkpoint.heap_break));
+	hash = store_hash(hash, &KERNEL_SIZE, sizeof(KERNEL_SIZE));
+	hash = store_hash(hash, LATCHES, sizeof(*LATCHES));
+	hash = store_hash(hash, &SYSCALL_SEQ, sizeof(SYSCALL_SEQ));
+	hash = store_hash(hash, &REDIRECT_PENDING, sizeof(REDIRECT_PENDING));
+	hash = store_hash(hash, &REDIRECT_PC, sizeof(REDIRECT_PC));
+	hash = store_hash(hash, &REDIRECT_HOLD, sizeof(REDIRECT_HOLD));
+	hash = store_hash(hash, checkpoint.page_address, (size_t)checkpoint.page_count * sizeof(uint32_t));
+	hash = store_hash(hash, checkpoint.page_data, (size_t)checkpoint.page_count * MEM_PAGE_SIZE);
+	checkpoint_free(&checkpoint);
+	return hash;
+}
+
+/***************************************************************/
+/* Finish the run from a stored result: memory, state, counters and */
+/* the console output it printed                                                     */
+/***************************************************************/
+void memo_replay(const store_result_t *result){
+	const uint8_t *addresses = (const uint8_t *)(result + 1);
+	const uint8_t *data = addresses + (size_t)result->page_count * sizeof(uint32_t);
+	const uint8_t *output = data + (size_t)result->page_count * MEM_PAGE_SIZE;
+	const uint8_t *end = output + result->output_length;
+	uint32_t i, address, record[2];
+	int region;
+
+	for (i = 0; i < result->page_count; i++){
+		memcpy(&address, addresses + (size_t)i * sizeof(uint32_t), sizeof(address));
+		region = mem_region_index(address, MEM_PAGE_SIZE);
+		if (region < 0){
+			continue;
+		}
+		memcpy(MEM_REGIONS[region].mem + (address - MEM_REGIONS[region].begin), data + (size_t)i * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+		mark_dirty(region, address - MEM_REGIONS[region].begin, MEM_PAGE_SIZE);
+	}
+	CURRENT_STATE = result->state;
+	NEXT_STATE = CURRENT_STATE;
+	clear_pipeline();
+	RUN_FLAG = FALSE;
+	HEAP_BREAK = result->heap_break;
+	GUEST_EXIT_CODE = result->exit_code;
+	CYCLE_COUNT += result->cycles;
+	INSTRUCTION_COUNT += result->instructions;
+	for (i = 0; i <= SYS_MAX; i++){
+		SYSCALL_COUNTS[i] += result->syscall_counts[i];
+	}
+	for (i = 0; i < EXC_NONE; i++){
+		EXCEPTION_COUNTS[i] += result->exception_counts[i];
+		HANDLER_CYCLES[i] += result->handler_cycles[i];
+	}
+	FETCH_STALLS += result->fetch_stalls;
+	SQUASHED_INSTRUCTIONS += result->squashed;
+	while (output + sizeof(record) <= end){
+		memcpy(record, output, sizeof(record));
+		output += sizeof(record);
+		if (record[1] > (size_t)(end - output)){
+			break;
+		}
+		guest_output(record[0], (const char *)output, record[1]);
+		output += record[1];
+	}
+}
+
+/***************************************************************/
+/* Before running to completion: replay a stored result of the same  */
+/* run (MEMO_HIT), or start recording one (MEMO_RECORD).  Only quiet,  */
+/* unobserved runs starting from an empty pipeline are memoized.      */
+/***************************************************************/
+int memo_begin(){
+	store_result_t *result;
+	size_t size;
+	uint64_t key;
+
+	/*a replay ends with an empty pipeline, so the run must start with one too*/
+	if (STORE_DIR[0] == '\0' || !QUIET || !RUN_FLAG || !pipeline_empty() || SYSCALL_SEQ != 0 ||
+			REDIRECT_PENDING || REDIRECT_HOLD != 0 ||
+			PROFILE_ENABLED || TRACE_FILE != NULL || PIPEVIEW_FD >= 0 || INTERVAL_CYCLES != 0 || REUSE_ENABLED ||
+			MEMORY_MODEL != NULL || PREFETCHER != NULL || ROI_FAST){
+		return MEMO_OFF;
+	}
+	key = memo_key();
+	result = store_map(key, "res", &size, NULL);
+	if (result != NULL){
+		if (size >= sizeof(*result) && memcmp(result->magic, STORE_RESULT_MAGIC, 8) == 0 && result->key == key &&
+				size == sizeof(*result) + (size_t)result->page_count * (sizeof(uint32_t) + MEM_PAGE_SIZE) + result->output_length){
+			memo_replay(result);
+			munmap(result, size);
+			MEMO_HITS++;
+			return MEMO_HIT;
+		}
+		munmap(result, size);
+	}
+
+	memset(&MEMO_BASE, 0, sizeof(MEMO_BASE));
+	MEMO_BASE.key = key;
+	MEMO_BASE.cycles = CYCLE_COUNT;
+	MEMO_BASE.instructions = INSTRUCTION_COUNT;
+	memcpy(MEMO_BASE.syscall_counts, SYSCALL_COUNTS, sizeof(MEMO_BASE.syscall_counts));
+	memcpy(MEMO_BASE.exception_counts, EXCEPTION_COUNTS, sizeof(MEMO_BASE.exception_counts));
+	memcpy(MEMO_BASE.handler_cycles, HANDLER_CYCLES, sizeof(MEMO_BASE.handler_cycles));
+	MEMO_BASE.fetch_stalls = FETCH_STALLS;
+	MEMO_BASE.squashed = SQUASHED_INSTRUCTIONS;
+	MEMO_OUTPUT.length = 0;
+	MEMO_TAINTED = FALSE;
+	MEMO_RECORDING = TRUE;
+	return MEMO_RECORD;
+}
+
+/***************************************************************/
+/* After a recorded run: store its result unless it depended on    */
+/* input, files, devices or magic services, or stopped on an error */
+/***************************************************************/
+void memo_end(){
+	store_result_t result = MEMO_BASE;
+	checkpoint_t checkpoint;
+	out_buffer_t out = { 0 };
+	uint32_t i;
+
+	MEMO_RECORDING = FALSE;
+	if (MEMO_TAINTED || RUN_FLAG){
+		return;
+	}
+	memcpy(result.magic, STORE_RESULT_MAGIC, 8);
+	result.state = CURRENT_STATE;
+	result.heap_break = HEAP_BREAK;
+	result.exit_code = GUEST_EXIT_CODE;
+	result.cycles = CYCLE_COUNT - MEMO_BASE.cycles;
+	result.instructions = INSTRUCTION_COUNT - MEMO_BASE.instructions;
+	for (i = 0; i <= SYS_MAX; i++){
+		result.syscall_counts[i] = SYSCALL_COUNTS[i] - MEMO_BASE.syscall_counts[i];
+	}
+	for (i = 0; i < EXC_NONE; i++){
+		result.exception_counts[i] = EXCEPTION_COUNTS[i] - MEMO_BASE.exception_counts[i];
+		result.handler_cycles[i] = HANDLER_CYCLES[i] - MEMO_BASE.handler_cycles[i];
+	}
+	result.fetch_stalls = FETCH_STALLS - MEMO_BASE.fetch_stalls;
+	result.squashed = SQUASHED_INSTRUCTIONS - MEMO_BASE.squashed;
+
+	checkpoint_save(&checkpoint, &CURRENT_STATE, 0);
+	result.page_count = checkpoint.page_count;
+	result.output_length = MEMO_OUTPUT.length;
+	out_append(&out, (const char *)&result, sizeof(result));
+	out_append(&out, (const char *)checkpoint.page_address, (size_t)checkpoint.page_count * sizeof(uint32_t));
+	out_append(&out, (const char *)checkpoint.page_data, (size_t)checkpoint.page_count * MEM_PAGE_SIZE);
+	out_append(&out, MEMO_OUTPUT.data, MEMO_OUTPUT.length);
+	checkpoint_free(&checkpoint);
+	store_write(result.key, "res", &out);
+	free(out.data);
+	MEMO_STORES++;
+}
+
+/***************************************************************/
+/* Use <directory> as the store, or turn it off with NULL                 */
+/***************************************************************/
+int set_store(const char *directory){
+	struct stat st;
+
+	if (directory == NULL){
+		STORE_DIR[0] = '\0';
+		return TRUE;
+	}
+	if (stat(directory, &st) != 0 || !S_ISDIR(st.st_mode)){
+		printf("Error: %s is not a directory\n", directory);
+		return FALSE;
+	}
+	if (strlen(directory) >= sizeof(STORE_DIR)){
+		printf("Error: Store directory name too long: %s\n", directory);
+		return FALSE;
+	}
+	strcpy(STORE_DIR, directory);
+	return TRUE;
+}
+
+/***************************************************************/
+/* store <dir>|off, or store to show its hit counts                       */
+/***************************************************************/
+int store_command(int argc, char **argv){
+	if (argc == 1){
+		printf("Store\t: %s\n", STORE_DIR[0] != '\0' ? STORE_DIR : "off");
+		printf("Image hits / misses\t: %llu / %llu\n", (unsigned long long)STORE_IMAGE_HITS, (unsigned long long)STORE_IMAGE_MISSES);
+		printf("Memoized runs replayed / stored\t: %llu / %llu\n", (unsigned long long)MEMO_HITS, (unsigned long long)MEMO_STORES);
+		return CMD_OK;
+	}
+	if (argc != 2){
+		printf("Usage: store <directory>|off\n");
+		return CMD_ERROR;
+	}
+	return set_store(strcmp(argv[1], "off") == 0 ? NULL : argv[1]) ? CMD_OK : CMD_ERROR;
+}
+
+/***************************************************************/
+/* Monotonic host time in nanoseconds                                               */
+/***************************************************************/
+uint64_t host_time_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/***************************************************************/
+/* Serve one request line; the reply is a single JSON line.          */
+/***************************************************************/
+int server_request(FILE *out, int argc, char **argv) {
+	uint32_t start, stop, address, cycles, limit, n;
+	uint64_t start_ns;
+	uint32_t start_cycles, start_instructions;
+	int memo = MEMO_OFF;
+	int i;
+
+	SERVER_REQUESTS++;
+	if (argc == 0) {
+		fprintf(out, "{\"ok\":false,\"error\":\"empty request\"}\n");
+		return CMD_OK;
+	}
+
+	if (strcmp(argv[0], "load") == 0 && argc == 2) {
+		if (strlen(argv[1]) >= sizeof(prog_file) || load_program_image(argv[1]) == NULL) {
+			fprintf(out, "{\"ok\":false,\"error\":\"can't open program file\"}\n");
+			return CMD_OK;
+		}
+		strcpy(prog_file, argv[1]);
+		reset();
+		fprintf(out, "{\"ok\":true,\"words\":%u}\n", PROGRAM_SIZE);
+	}else if (strcmp(argv[0], "reset") == 0 && argc == 1) {
+		if (prog_file[0] == '\0') {
+			fprintf(out, "{\"ok\":false,\"error\":\"no program loaded\"}\n");
+			return CMD_OK;
+		}
+		reset();
+		fprintf(out, "{\"ok\":true}\n");
+	}else if ((strcmp(argv[0], "run") == 0 && argc == 2) || (strcmp(argv[0], "sim") == 0 && argc == 1)) {
+		if (argc == 2 && !parse_value(argv[1], 10, &cycles)) {
+			fprintf(out, "{\"ok\":false,\"error\":\"bad cycle count\"}\n");
+			return CMD_OK;
+		}
+		/*a guest that never stops must not hold the server from other clients*/
+		limit = argc == 2 && cycles < SERVER_MAX_CYCLES ? cycles : SERVER_MAX_CYCLES;
+		start_ns = host_time_ns();
+		start_cycles = CYCLE_COUNT;
+		start_instructions = INSTRUCTION_COUNT;
+		n = 0;
+		if (argc == 2) {
+			for (; n < limit && RUN_FLAG; n++) {
+				cycle();
+			}
+		}else{
+			memo = memo_begin();
+			for (; memo != MEMO_HIT && n < limit && RUN_FLAG; n++) {
+				cycle();
+			}
+			if (memo == MEMO_RECORD) {
+				memo_end();	/* stores nothing while the program still runs */
+			}
+		}
+		if (memo != MEMO_HIT) {
+			account_host_time(start_ns, start_cycles, start_instructions);
+		}
+		/*the program's console output goes out before the reply*/
+		guest_flush();
+		if (RUN_FLAG && n == SERVER_MAX_CYCLES && (argc == 1 || cycles > SERVER_MAX_CYCLES)) {
+			fprintf(out, "{\"ok\":false,\"error\":\"cycle limit reached\",\"running\":true,\"cycles\":%u,\"instructions\":%u}\n",
+				CYCLE_COUNT, INSTRUCTION_COUNT);
+			return CMD_OK;
+		}
+		fprintf(out, "{\"ok\":true,\"running\":%s,\"cycles\":%u,\"instructions\":%u}\n",
+			RUN_FLAG ? "true" : "false", CYCLE_COUNT, INSTRUCTION_COUNT);
+	}else if (strcmp(argv[0], "rdump") == 0 && argc == 1) {
+		fprintf(out, "{\"ok\":true,\"pc\":%u,\"hi\":%u,\"lo\":%u,\"regs\":[", CURRENT_STATE.PC, CURRENT_STATE.HI, CURRENT_STATE.LO);
+		for (i = 0; i < MIPS_REGS; i++) {
+			fprintf(out, "%s%u", i ? "," : "", CURRENT_STATE.REGS[i]);
+		}
+		fprintf(out, "],\"cycles\":%u,\"instructions\":%u}\n", CYCLE_COUNT, INSTRUCTION_COUNT);
+	}else if (strcmp(argv[0], "mdump") == 0 && argc == 3) {
+		if (!parse_value(argv[1], 16, &start) || !parse_value(argv[2], 16, &stop) || stop < start ||
+				(stop - start) / 4 >= SERVER_MAX_MDUMP_WORDS) {
+			fprintf(out, "{\"ok\":false,\"error\":\"bad address range\"}\n");
+			return CMD_OK;
+		}
+		fprintf(out, "{\"ok\":true,\"start\":%u,\"words\":[", start);
+		for (address = start; address <= stop && address >= start; address += 4) {
+			fprintf(out, "%s%u", address != start ? "," : "", mem_read_32(address));
+		}
+		fprintf(out, "]}\n");
+	}else if (strcmp(argv[0], "mdump-bin") == 0 && argc == 4) {
+		if (!parse_value(argv[1], 16, &start) || !parse_value(argv[2], 16, &stop) ||
+				mdump_bin(start, stop, argv[3]) != CMD_OK) {
+			fprintf(out, "{\"ok\":false,\"error\":\"mdump-bin failed\"}\n");
+			return CMD_OK;
+		}
+		fprintf(out, "{\"ok\":true}\n");
+	}else if (strcmp(argv[0], "mload") == 0 && argc == 3) {
+		if (!parse_value(argv[1], 16, &address) || mload(address, argv[2]) != CMD_OK) {
+			fprintf(out, "{\"ok\":false,\"error\":\"mload failed\"}\n");
+			return CMD_OK;
+		}
+		fprintf(out, "{\"ok\":true}\n");
+	}else if (strcmp(argv[0], "stats") == 0 && argc == 1) {
+		fprintf(out, "{\"ok\":true,\"cycles\":%u,\"instructions\":%u,\"requests\":%llu,\"run_ns\":%llu,"
+			"\"image_cache_hits\":%llu,\"image_cache_misses\":%llu,\"store_image_hits\":%llu,\"memo_hits\":%llu}\n",
+			CYCLE_COUNT, INSTRUCTION_COUNT, (unsigned long long)SERVER_REQUESTS, (unsigned long long)SIM_HOST_NS,
+			(unsigned long long)IMAGE_CACHE_HITS, (unsigned long long)IMAGE_CACHE_MISSES,
+			(unsigned long long)STORE_IMAGE_HITS, (unsigned long long)MEMO_HITS);
+	}else if (strcmp(argv[0], "quit") == 0) {
+		fprintf(out, "{\"ok\":true}\n");
+		return CMD_QUIT;
+	}else if (strcmp(argv[0], "shutdown") == 0) {
+		fprintf(out, "{\"ok\":true}\n");
+		return SERVER_SHUTDOWN;
+	}else{
+		fprintf(out, "{\"ok\":false,\"error\":\"invalid request\"}\n");
+	}
+	return CMD_OK;
+}
+
+/***************************************************************/
+/* Serve requests from one client until it disconnects.                 */
+/***************************************************************/
+int serve_client(int fd) {
+	FILE *in, *out;
+	char buffer[CMD_BUFFER_SIZE];
+	char *argv[CMD_MAX_ARGS];
+	int argc, result = CMD_OK;
+
+	in = fdopen(fd, "r");
+	out = fdopen(dup(fd), "w");
+	if (in == NULL || out == NULL) {
+		if (in != NULL) fclose(in); else close(fd);
+		if (out != NULL) fclose(out);
+		return CMD_OK;
+	}
+
+	while (fgets(buffer, sizeof(buffer), in) != NULL) {
+		argc = tokenize_command(buffer, argv, CMD_MAX_ARGS);
+		result = server_request(out, argc, argv);
+		if (fflush(out) != 0 || result != CMD_OK) {
+			break;	/* EPIPE: the client hung up mid-reply */
+		}
+	}
+	fclose(in);
+	fclose(out);
+	return result;
+}
+
+/***************************************************************/
+/* Listen on a Unix domain socket and keep this instance warm.  */
+/***************************************************************/
+void run_server(const char *socket_path) {
+	struct sockaddr_un addr;
+	int listen_fd, client_fd;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		printf("Error: Socket path too long: %s\n", socket_path);
+		exit(-1);
+	}
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		perror("socket");
+		exit(-1);
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+	unlink(socket_path);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+		perror(socket_path);
+		exit(-1);
+	}
+
+	/* a client that hangs up mid-reply fails the write, it does not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+	printf("Serving on %s\n", socket_path);
+	fflush(stdout);
+	/* one instance, so clients are served one at a time; others wait in the backlog */
+	while (1) {
+		client_fd = accept(listen_fd, NULL, NULL);
+		if (client_fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("accept");
+			break;
+		}
+		if (serve_client(client_fd) == SERVER_SHUTDOWN) {
+			break;
+		}
+	}
+	close(listen_fd);
+	unlink(socket_path);
 }
 
 /***************************************************************/
 /* main                                                                                                                                   */
 /***************************************************************/
 int main(int argc, char *argv[]) {                             
+	char *script_file = NULL;
+	char *socket_path = NULL;
+	char *program = NULL;
+	int i;
+
 	printf("\n**************************\n");
 	printf("Welcome to MU-MIPS SIM...\n");
 	printf("**************************\n\n");
+
+	if (getenv("MU_MIPS_STORE") != NULL && !set_store(getenv("MU_MIPS_STORE"))){
+		exit(EXIT_SCRIPT_ERROR);
+	}
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-x") == 0 && i + 1 < argc){
+			script_file = argv[++i];
+		}else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc){
+			socket_path = argv[++i];
+		}else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc){
+			if (strlen(argv[++i]) >= sizeof(kernel_file)){
+				printf("Error: Kernel file name too long: %s\n", argv[i]);
+				exit(1);
+			}
+			strcpy(kernel_file, argv[i]);
+		}else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc){
+			if (!set_sandbox(argv[++i])){
+				exit(EXIT_SCRIPT_ERROR);
+			}
+		}else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc){
+			if (!set_store(argv[++i])){
+				exit(EXIT_SCRIPT_ERROR);
+			}
+		}else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc){
+			i++;
+			if (strcmp(argv[i], "off") == 0){
+				HUGE_PAGES = HUGE_PAGES_OFF;
+			}else if (strcmp(argv[i], "thp") == 0){
+				HUGE_PAGES = HUGE_PAGES_TRANSPARENT;
+			}else if (strcmp(argv[i], "hugetlb") == 0){
+				HUGE_PAGES = HUGE_PAGES_EXPLICIT;
+			}else{
+				printf("Error: Unknown huge page mode %s (off, thp or hugetlb)\n", argv[i]);
+				exit(EXIT_SCRIPT_ERROR);
+			}
+		}else if (strcmp(argv[i], "-q") == 0){
+			QUIET = TRUE;
+		}else if (argv[i][0] != '-' && program == NULL){
+			program = argv[i];
+		}else{
+			printf("Error: Unknown option %s\n", argv[i]);
+			exit(EXIT_SCRIPT_ERROR);
+		}
+	}
 	
-	if (argc < 2) {
-		printf("Error: You should provide input file.\nUsage: %s <input program> \n\n",  argv[0]);
+	if (program == NULL && socket_path == NULL) {
+		printf("Error: You should provide input file.\nUsage: %s <input program> [-x <command script>] [-k <kernel>] [-d <sandbox dir>] [-c <store dir>] [-H off|thp|hugetlb] [-q]\n"
+			"       %s [<input program>] -S <socket path>\n\n",  argv[0], argv[0]);
 		exit(1);
 	}
 
-	strcpy(prog_file, argv[1]);
+	if (program != NULL && strlen(program) >= sizeof(prog_file)){
+		printf("Error: Program file name too long: %s\n", program);
+		exit(1);
+	}
 	initialize();
-	load_program();
+	if (program != NULL){
+		strcpy(prog_file, program);
+		load_program();
+	}
+	load_kernel();
+	if (socket_path != NULL){
+		QUIET = TRUE;
+		run_server(socket_path);
+		exit(EXIT_PASS);
+	}
+	if (script_file != NULL){
+		run_script(script_file);
+	}
 	help();
 	while (1){
 		handle_command();
@@ -1,4 +1,6 @@
+#include <stdio.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #define FALSE 0
 #define TRUE  1
@@ -22,9 +24,16 @@
 #define MEM_STACK_BEGIN 0x7FFFFFFF
 #define MEM_STACK_END  0x10010000
 
+#define MEM_PAGE_SIZE 4096
+
+#define DIRTY_LOG_SIZE 256	/* written pages a reset can zero one by one */
+
 typedef struct {
 	uint32_t begin, end;
 	uint8_t *mem;
+	uint8_t *dirty;	/* one bit per page written since the last clear */
+	uint32_t dirty_count;	/* pages marked in dirty */
+	uint32_t dirty_log[DIRTY_LOG_SIZE];	/* the first of them, in the order written */
 } mem_region_t;
 
 /* memory will be dynamically allocated at initialization */
@@ -36,13 +45,38 @@ mem_region_t MEM_REGIONS[] = {
 };
 
 #define NUM_MEM_REGION 4
+#define MEM_TEXT_REGION 0
+#define MEM_DATA_REGION 1
+
+/* Host page backing of guest RAM: the text region maps the program
+   image's words copy-on-write from a file shared by all simulator
+   processes; data and kdata use transparent huge pages, or hugetlbfs
+   pages with -H hugetlb, to cut TLB misses on memory-heavy programs. */
+#define HUGE_PAGES_OFF 0
+#define HUGE_PAGES_TRANSPARENT 1
+#define HUGE_PAGES_EXPLICIT 2
+int HUGE_PAGES = HUGE_PAGES_TRANSPARENT;
+uint32_t TEXT_SHARED_LENGTH;	/* bytes at the start of the text region mapped from an image */
+
+/* Page table over the whole 32-bit space, one entry per page: the host
+   address of a RAM page with its region index in the low bits, PAGE_DEVICE
+   plus a device index for memory-mapped I/O, or 0 if nothing is there.
+   RAM accesses take a single lookup; only device pages pay for dispatch. */
+#define PAGE_SHIFT 12
+#define PAGE_COUNT (1u << (32 - PAGE_SHIFT))
+#define PAGE_HOST_MASK (~(uintptr_t)(MEM_PAGE_SIZE - 1))
+#define PAGE_REGION_MASK 0x7
+#define PAGE_DEVICE 0x800
+uintptr_t PAGE_TABLE[PAGE_COUNT];
 #define MIPS_REGS 32
+#define COP0_REGS 32
 
 typedef struct CPU_State_Struct {
 
   uint32_t PC;		                   /* program counter */
   uint32_t REGS[MIPS_REGS]; /* register file. */
   uint32_t HI, LO;                          /* special regs for mult/div. */
+  uint32_t COP0[COP0_REGS];	/* coprocessor 0: Status, Cause, EPC, BadVAddr */
 } CPU_State;
 
 typedef struct CPU_Pipeline_Reg_Struct{
@@ -56,28 +90,754 @@ typedef struct CPU_Pipeline_Reg_Struct{
 	uint32_t LMD;
 	uint32_t LO;
 	uint32_t HI;
+	uint32_t seq;	/* fetch sequence number, 0 while the latch is empty */
+	uint32_t exception;	/* unhandled exception code + 1: the run stops when it writes back */
+	uint32_t mem_ready;	/* cycle MEM may finish the access (memory model), 0 for no wait */
 } CPU_Pipeline_Reg;
 
 /***************************************************************/
 /* CPU State info.                                                                                                               */
 /***************************************************************/
 
+/* at the clock edge only the registers marked in STATE_DIRTY are copied
+   from NEXT_STATE to CURRENT_STATE */
 CPU_State CURRENT_STATE, NEXT_STATE;
+uint64_t STATE_DIRTY;	/* bit per register written this cycle */
+
+/* STATE_DIRTY bits beyond the GPRs */
+#define REG_HI 32
+#define REG_LO 33
+#define REG_PC 34
+#define REG_COP0 35	/* any COP0 register */
+
 int RUN_FLAG;	/* run flag*/
 uint32_t INSTRUCTION_COUNT;
 uint32_t CYCLE_COUNT;
 uint32_t PROGRAM_SIZE; /*in words*/
+uint32_t FETCH_SEQ;	/* sequence number of the last fetched instruction */
+uint32_t SYSCALL_SEQ;	/* SYSCALL that fetch waits on to write back, 0 if none */
+
+/* host-side speed of the simulator itself, summed over all timed runs */
+uint64_t SIM_HOST_NS;
+uint64_t SIM_CYCLES;
+uint64_t SIM_INSTRUCTIONS;
 
 
 /***************************************************************/
 /* Pipeline Registers.                                                                                                        */
 /***************************************************************/
-CPU_Pipeline_Reg ID_IF;
-CPU_Pipeline_Reg IF_EX;
-CPU_Pipeline_Reg EX_MEM;
-CPU_Pipeline_Reg MEM_WB;
+typedef struct {
+	CPU_Pipeline_Reg id_if, if_ex, ex_mem, mem_wb;
+} pipeline_latches_t;
+
+/* every stage reads the current bank and writes all of its latch in the next
+   bank, so the stages may run in any order; the banks swap at the clock edge */
+pipeline_latches_t LATCH_BANK[2];
+pipeline_latches_t *LATCHES = &LATCH_BANK[0], *NEXT_LATCHES = &LATCH_BANK[1];
+#define ID_IF (LATCHES->id_if)
+#define IF_EX (LATCHES->if_ex)
+#define EX_MEM (LATCHES->ex_mem)
+#define MEM_WB (LATCHES->mem_wb)
+
+char prog_file[256];
+
+
+/***************************************************************/
+/* Functional model, checkpoints and sampled simulation.                */
+/***************************************************************/
+#define FUNC_OK 0
+#define FUNC_EXIT 1	/* exit syscall executed */
+#define BBV_MAX_BLOCK 256	/* straight-line code is split into blocks of at most this many words */
+
+typedef struct {
+	CPU_State state;
+	uint64_t instructions;	/* instructions executed before this point */
+	uint32_t heap_break;
+	uint32_t page_count;
+	uint32_t *page_address;	/* guest address of each saved page */
+	uint8_t *page_data;	/* page_count * MEM_PAGE_SIZE bytes */
+} checkpoint_t;
+
+typedef struct {
+	uint32_t table_size, block_count;
+	uint32_t *table_pc, *table_id;	/* open-addressed leader PC -> block id */
+	uint64_t *counts;	/* instructions per block id in the current interval */
+} bbv_t;
+
+typedef struct {
+	uint64_t interval;
+	uint32_t cluster;
+	double weight;
+	double cpi;
+} simpoint_t;
+
+typedef struct {
+	uint32_t index;
+	uint64_t instructions;
+	uint64_t cycles;
+} interval_result_t;
+
+
+/***************************************************************/
+/* Decoupled functional-first simulation.                                             */
+/***************************************************************/
+#define RETIRE_QUEUE_SIZE 4096	/* records; a power of two */
+#define RETIRE_BATCH 64	/* records published to the other side at a time */
+
+/* one instruction retired by the functional model */
+typedef struct {
+	uint32_t pc, instruction;
+	uint32_t a, b;	/* rs and rt operand values */
+	uint32_t address;	/* effective address of a load or store, else 0 */
+	uint32_t next_pc;	/* not pc + 4 after a taken branch or jump */
+} retire_record_t;
+
+/* single-producer/single-consumer ring; head and tail never wrap */
+typedef struct {
+	_Alignas(64) _Atomic uint64_t tail;	/* written by the functional thread */
+	_Atomic int done;
+	_Alignas(64) _Atomic uint64_t head;	/* written by the timing thread */
+	_Alignas(64) uint64_t producer_waits, consumer_waits;
+	retire_record_t records[RETIRE_QUEUE_SIZE];
+} retire_queue_t;
+
+/* a timing model consumes retired instructions in program order */
+typedef struct timing_model_struct {
+	const char *name;
+	const char *description;
+	void (*reset)(struct timing_model_struct *model);
+	void (*retire)(struct timing_model_struct *model, const retire_record_t *record);
+	uint64_t (*cycles)(struct timing_model_struct *model);
+	void (*report)(struct timing_model_struct *model);
+} timing_model_t;
+
+/* in-order 5-stage model; registers 32 and 33 are HI and LO */
+typedef struct {
+	timing_model_t base;
+	int forwarding;
+	uint64_t decode;	/* cycle in which the last instruction was in ID */
+	uint64_t fetch_ready;	/* earliest ID cycle after a redirect */
+	uint64_t ready[MIPS_REGS + 2];	/* earliest ID cycle of a reader of each register */
+	int ready_load[MIPS_REGS + 2];	/* register was last written by a load */
+	uint64_t instructions, load_use_stalls, raw_stalls, control_stalls;
+} inorder_timing_t;
+
+retire_queue_t *RETIRE_QUEUE;	/* queue of the running decoupled simulation */
+
+
+/***************************************************************/
+/* Lockstep multi-instance sweeps.                                                        */
+/***************************************************************/
+#define SWEEP_LANE_GROUP 16	/* lanes are padded to a multiple of this */
+#define SWEEP_MAX_LANES 65536
+
+/* a lane's private memory: open-addressed word address -> value, 0 = empty */
+typedef struct {
+	uint32_t size, count;
+	uint32_t *address, *value;
+} sweep_overlay_t;
+
+/* K copies of the program in structure-of-arrays layout */
+typedef struct {
+	uint32_t lanes, stride;	/* stride: lanes rounded up to SWEEP_LANE_GROUP */
+	uint32_t *regs;	/* regs[reg * stride + lane]; rows 32 and 33 are HI and LO */
+	uint32_t *pc;	/* per-lane PC, valid while the lanes are diverged */
+	uint8_t *running;	/* lane has not exited */
+	uint8_t *active;	/* lane is at the PC being executed */
+	sweep_overlay_t *overlay;
+	int converged;	/* every running lane is at common_pc */
+	uint32_t common_pc, running_count;
+	uint64_t lockstep_steps, masked_steps, lane_instructions;
+} sweep_t;
+
+
+/***************************************************************/
+/* Disassembler and pipeline view.                                                          */
+/***************************************************************/
+#define DISASM_TEXT_SIZE 40
+
+typedef enum {
+	FMT_INVALID = 0,	/* not implemented */
+	FMT_NONE,	/* SYSCALL */
+	FMT_RD_RT_SA,	/* SLL $rd, $rt, sa */
+	FMT_RD_RS_RT,	/* ADD $rd, $rs, $rt */
+	FMT_RS_RT,	/* MULT $rs, $rt */
+	FMT_RS,	/* JR $rs */
+	FMT_RD,	/* MFHI $rd */
+	FMT_JALR,	/* JALR [$rd,] $rs */
+	FMT_REGIMM,	/* BLTZ/BGEZ $rs, offset (selected by rt) */
+	FMT_J,	/* J target */
+	FMT_RS_RT_OFFSET,	/* BEQ $rs, $rt, offset */
+	FMT_RS_OFFSET,	/* BLEZ $rs, offset */
+	FMT_RT_RS_IMM,	/* ADDI $rt, $rs, imm */
+	FMT_RT_IMM,	/* LUI $rt, imm */
+	FMT_RT_OFFSET_RS,	/* LW $rt, offset($rs) */
+	FMT_COP0	/* MFC0/MTC0 $rt, $rd; ERET */
+} disasm_format_t;
+
+typedef struct {
+	const char *name;
+	disasm_format_t format;
+} disasm_entry_t;
+
+typedef struct {
+	char *data;
+	size_t length, capacity;
+} out_buffer_t;
+
+#define VIEW_FULL 0
+#define VIEW_DELTA 1
+
+int PIPELINE_VIEW;	/* VIEW_FULL or VIEW_DELTA */
+int PIPELINE_SHOWN;	/* SHOWN_* hold the last printed latches */
+CPU_Pipeline_Reg SHOWN_ID_IF, SHOWN_IF_EX, SHOWN_EX_MEM, SHOWN_MEM_WB;
+
+
+/***************************************************************/
+/* Syscall emulation (SPIM conventions: service in $v0,       */
+/* arguments in $a0-$a2, result in $v0).                       */
+/***************************************************************/
+#define SYS_PRINT_INT 1
+#define SYS_PRINT_STRING 4
+#define SYS_READ_INT 5
+#define SYS_READ_STRING 8
+#define SYS_SBRK 9
+#define SYS_EXIT 10
+#define SYS_PRINT_CHAR 11
+#define SYS_READ_CHAR 12
+#define SYS_OPEN 13
+#define SYS_READ 14
+#define SYS_WRITE 15
+#define SYS_CLOSE 16
+#define SYS_EXIT2 17
+#define SYS_MAX 17
+
+/* simulator magic, outside SPIM's numbering; see "Region of interest" */
+#define SYS_ROI_BEGIN 0x100
+#define SYS_ROI_END 0x101
+#define SYS_STATS_RESET 0x102
+#define SYS_STATS_DUMP 0x103
+#define SYS_CHECKPOINT 0x104
+
+/* emulate_syscall results */
+#define SYSCALL_DONE 0
+#define SYSCALL_RESULT 1	/* write the returned value to $v0 */
+#define SYSCALL_EXIT 2
+
+#define MEM_HEAP_BEGIN 0x10040000	/* first address handed out by sbrk */
+#define MEM_HEAP_END 0x6FFFFFFF	/* sbrk fails beyond this; the rest is left to the stack */
+#define GUEST_OUTPUT_FLUSH 65536	/* flush buffered console output at this size */
+#define GUEST_MAX_FILES 16	/* open files; guest descriptors 3.. */
+#define GUEST_MAX_STRING 65536
+
+out_buffer_t GUEST_OUTPUT;	/* console output of the program, flushed in large writes */
+uint64_t SYSCALL_COUNTS[SYS_MAX + 1];	/* per service; [0] counts unknown services */
+uint32_t HEAP_BREAK;
+int SANDBOX_FD = -1;	/* directory the guest may open files in, -1 for none */
+int GUEST_FILES[GUEST_MAX_FILES];	/* host descriptor + 1 of guest fd 3 + i, 0 if free */
+int GUEST_SILENT;	/* no host I/O: intervals re-simulated from checkpoints */
+uint32_t GUEST_EXIT_CODE;
+const char *SYSCALL_NAMES[SYS_MAX + 1] = { [SYS_PRINT_INT] = "print_int", [SYS_PRINT_STRING] = "print_string",
+	[SYS_READ_INT] = "read_int", [SYS_READ_STRING] = "read_string", [SYS_SBRK] = "sbrk", [SYS_EXIT] = "exit",
+	[SYS_PRINT_CHAR] = "print_char", [SYS_READ_CHAR] = "read_char", [SYS_OPEN] = "open", [SYS_READ] = "read",
+	[SYS_WRITE] = "write", [SYS_CLOSE] = "close", [SYS_EXIT2] = "exit2" };
+
+/***************************************************************/
+/* Coprocessor 0: exceptions and interrupts.  Exceptions are       */
+/* taken in EX, so every older instruction completes and no        */
+/* younger one has touched memory or registers.                           */
+/***************************************************************/
+#define COP0_BADVADDR 8
+#define COP0_STATUS 12
+#define COP0_CAUSE 13
+#define COP0_EPC 14
+
+#define STATUS_IE 0x1	/* interrupts enabled */
+#define STATUS_EXL 0x2	/* in a handler: interrupts masked */
+#define STATUS_IM 0xFF00	/* interrupt mask, one bit per Cause.IP line */
+#define CAUSE_EXCCODE 0x7C
+#define CAUSE_IP 0xFF00
+#define CAUSE_IP_UART 0x0400	/* IP2, hardware interrupt 0 */
+#define CAUSE_IP_TIMER 0x8000	/* IP7, as for the MIPS32 count/compare timer */
+
+/* Cause.ExcCode values */
+#define EXC_INT 0
+#define EXC_ADEL 4	/* unaligned load */
+#define EXC_ADES 5	/* unaligned store */
+#define EXC_RI 10	/* reserved (unknown) instruction */
+#define EXC_OV 12	/* ADD/ADDI/SUB overflow */
+#define EXC_NONE 32
+
+#define EXCEPTION_VECTOR 0x80000180	/* the kernel image is loaded here */
+
+char kernel_file[256];
+uint32_t KERNEL_SIZE;	/* words; 0 if no handler is loaded and exceptions stop the run */
+
+/* pipeline redirect requested by EX (exception, ERET) or an interrupt,
+   applied at the clock edge */
+int REDIRECT_PENDING;
+uint32_t REDIRECT_PC;
+uint32_t REDIRECT_HOLD;	/* fetch waits for this instruction to write back, 0 for none */
+
+uint64_t EXCEPTION_COUNTS[EXC_NONE];
+uint64_t HANDLER_CYCLES[EXC_NONE];	/* cycles with Status.EXL set, by the cause that entered */
+uint32_t HANDLER_CAUSE;
+const char *EXCEPTION_NAMES[EXC_NONE] = { [EXC_INT] = "interrupt", [EXC_ADEL] = "address error (load)",
+	[EXC_ADES] = "address error (store)", [EXC_RI] = "reserved instruction", [EXC_OV] = "arithmetic overflow" };
+
+
+/***************************************************************/
+/* Memory-mapped devices, in pages at the top of KDATA.  Register */
+/* offsets follow SPIM's console (receiver/transmitter control   */
+/* and data words).                                                                         */
+/***************************************************************/
+#define MMIO_BEGIN 0xFFFE0000
+#define UART_BASE MMIO_BEGIN
+#define UART_RX_CONTROL 0x0	/* bit 0: a byte is ready, bit 1: interrupt enable */
+#define UART_RX_DATA 0x4
+#define UART_TX_CONTROL 0x8	/* bit 0: ready (always), bit 1: interrupt enable */
+#define UART_TX_DATA 0xC
+#define TIMER_BASE (MMIO_BEGIN + MEM_PAGE_SIZE)
+#define TIMER_COUNT 0x0	/* cycles, counting from reset or the last write */
+#define TIMER_COMPARE 0x4	/* writing arms the timer */
+#define TIMER_CONTROL 0x8	/* bit 0: expired, bit 1: interrupt enable; writing bit 0 disarms */
+#define DEVICE_READY 0x1
+#define DEVICE_INTERRUPT_ENABLE 0x2
+#define TIMER_EXPIRED 0x1
+
+typedef struct mmio_device_struct {
+	const char *name;
+	uint32_t base, pages;
+	void (*reset)(struct mmio_device_struct *device);
+	uint32_t (*read)(struct mmio_device_struct *device, uint32_t offset);
+	void (*write)(struct mmio_device_struct *device, uint32_t offset, uint32_t value);
+	uint64_t reads, writes;
+} mmio_device_t;
+
+typedef struct {
+	mmio_device_t base;
+	uint32_t rx_control, tx_control;
+	int input_fd;	/* host file feeding the receiver, -1 for none */
+	uint32_t input_next, input_length;
+	uint8_t input[4096];
+	uint64_t bytes_in, bytes_out;
+} uart_device_t;
+
+typedef struct {
+	mmio_device_t base;
+	uint32_t origin;	/* CYCLE_COUNT at which the count was zero */
+	uint32_t compare, control;
+	int armed;
+	uint64_t expirations;
+} timer_device_t;
+
+
+/***************************************************************/
+/* Main-memory timing behind MEM.  EX issues a load or store to    */
+/* the model as the address is known; a load holds MEM (and the */
+/* stages behind it) until the data returns, stores are posted.  */
+/* Times are in CPU cycles.                                                               */
+/***************************************************************/
+#define DRAM_MAX_BANKS 64
+#define DRAM_HISTOGRAM_BUCKETS 32
+#define DRAM_HISTOGRAM_WIDTH 4	/* cycles per latency bucket; the last bucket takes the rest */
+
+typedef struct memory_model_struct {
+	const char *name;
+	const char *description;
+	void (*reset)(struct memory_model_struct *model);	/* forget all state and statistics */
+	void (*idle)(struct memory_model_struct *model);	/* forget in-flight requests: the cycle count restarts */
+	uint32_t (*access)(struct memory_model_struct *model, uint32_t address, int write, uint32_t cycle);	/* cycle the data is ready */
+	void (*report)(struct memory_model_struct *model);
+} memory_model_t;
+
+/* address = row : bank : column, so sequential words share a row */
+typedef struct {
+	memory_model_t base;
+	int open_page;	/* leave the row open after an access, else precharge at once */
+	uint32_t banks, row_bytes;
+	uint32_t t_cas, t_rcd, t_rp, t_burst;
+	uint32_t open_row[DRAM_MAX_BANKS];	/* row + 1, 0 while precharged */
+	uint32_t bank_ready[DRAM_MAX_BANKS];	/* cycle the bank takes its next command */
+	uint32_t bus_ready;	/* cycle the data bus is free */
+	uint64_t reads, writes, row_hits, row_misses, row_conflicts;
+	uint64_t bank_waits, bus_waits;	/* cycles requests queued behind a busy bank / the bus */
+	uint64_t bus_busy, latency_sum;
+	uint32_t first_cycle, last_cycle;	/* window over which the bus was in use */
+	uint32_t max_latency;
+	uint64_t read_latency[DRAM_HISTOGRAM_BUCKETS], write_latency[DRAM_HISTOGRAM_BUCKETS];
+} dram_model_t;
+
+memory_model_t *MEMORY_MODEL;	/* NULL: memory answers within the MEM cycle */
+uint64_t MEMORY_STALLS;	/* cycles MEM waited on the model */
+
+
+/***************************************************************/
+/* Data prefetchers.  Prefetched lines land in a small FIFO buffer */
+/* in front of the memory model; a load that finds its line there  */
+/* waits only for the prefetch still in flight, if any.  Demand      */
+/* loads train the prefetcher.                                                          */
+/***************************************************************/
+#define PREFETCH_LINE_BYTES 32
+#define PREFETCH_BUFFER_LINES 32
+#define PREFETCH_MAX_DEGREE 8
+#define STRIDE_TABLE_SIZE 64	/* direct-mapped on the load's PC */
+#define STREAM_COUNT 4
+
+typedef struct {
+	uint32_t line;	/* line number + 1, 0 if empty */
+	uint32_t ready;	/* cycle the line arrives */
+	int used;	/* a demand load has hit it */
+} prefetch_line_t;
+
+typedef struct prefetcher_struct {
+	const char *name;
+	const char *description;
+	void (*reset)(struct prefetcher_struct *prefetcher);
+	void (*observe)(struct prefetcher_struct *prefetcher, uint32_t pc, uint32_t address, int hit);	/* issues with prefetch_issue */
+	uint32_t degree;	/* lines fetched ahead */
+} prefetcher_t;
+
+typedef struct {
+	prefetcher_t base;
+	uint32_t last_line;	/* line + 1 of the previous load */
+} next_line_prefetcher_t;
+
+typedef struct {
+	uint32_t pc, last, stride;
+	uint32_t confidence;	/* 0..3; prefetch from 2 */
+} stride_entry_t;
+
+typedef struct {
+	prefetcher_t base;
+	stride_entry_t table[STRIDE_TABLE_SIZE];
+} stride_prefetcher_t;
+
+typedef struct {
+	prefetcher_t base;
+	struct {
+		uint32_t head;	/* next line to fetch, 0 if the stream is free */
+		uint64_t last_use;
+	} streams[STREAM_COUNT];
+	uint64_t clock;
+	uint64_t allocations;
+} stream_prefetcher_t;
+
+prefetcher_t *PREFETCHER;	/* NULL for none */
+prefetch_line_t PREFETCH_LINES[PREFETCH_BUFFER_LINES];
+uint32_t PREFETCH_VICTIM;	/* next buffer entry to replace */
+uint64_t PREFETCH_LOADS;	/* demand loads seen */
+uint64_t PREFETCH_HITS;	/* demand loads served from the buffer */
+uint64_t PREFETCH_ISSUED, PREFETCH_USEFUL, PREFETCH_LATE;
+uint64_t PREFETCH_USELESS;	/* lines replaced before any load used them */
+
+
+/***************************************************************/
+/* Reuse (LRU stack) distance analysis.  Each line's last access  */
+/* time is kept in a hash table and every live time is marked in */
+/* a Fenwick tree, so the number of distinct lines touched since  */
+/* the previous access to a line is one prefix sum.  A fully         */
+/* associative LRU cache of C lines misses exactly the accesses at */
+/* distance >= C, giving the miss ratio of every size in one run.   */
+/***************************************************************/
+#define REUSE_MIN_TIMES 65536	/* smallest Fenwick tree */
+#define REUSE_MIN_TABLE 1024
+
+typedef struct {
+	const char *name;
+	uint32_t table_size, table_count;	/* open-addressed line + 1 -> last access time */
+	uint32_t *table_line, *table_time;
+	uint32_t capacity, now;	/* times 1..capacity-1; renumbered when full */
+	uint32_t *tree;	/* Fenwick tree over times, 1 where a line was last accessed */
+	uint32_t *time_slot;	/* table slot + 1 of the line last accessed at each time, 0 if stale */
+	uint64_t *histogram;	/* accesses by distance */
+	uint32_t histogram_size;
+	uint64_t accesses, cold;	/* cold: first touches, a miss at every size */
+} reuse_t;
+
+int REUSE_ENABLED;
+uint32_t REUSE_LINE_SHIFT = 5;	/* log2 of the line size */
+reuse_t REUSE_DATA = { "data" }, REUSE_INST = { "instruction" };
+
+
+/***************************************************************/
+/* Memory trace capture for mu-mips-cache: the header TRACE_MAGIC */
+/* then one record per fetch, load and store in the order the    */
+/* pipeline makes them.                                                                      */
+/***************************************************************/
+#define TRACE_MAGIC "MUTRACE1"
+#define TRACE_FETCH 0
+#define TRACE_LOAD 1
+#define TRACE_STORE 2
+#define TRACE_BUFFER_RECORDS 65536
+
+typedef struct {
+	uint32_t address;
+	uint32_t kind;	/* TRACE_FETCH, TRACE_LOAD or TRACE_STORE */
+} trace_record_t;
+
+FILE *TRACE_FILE;	/* NULL while not tracing */
+trace_record_t TRACE_RECORDS[TRACE_BUFFER_RECORDS];
+uint32_t TRACE_COUNT;	/* records buffered */
+uint64_t TRACE_TOTAL;
+
+
+/***************************************************************/
+/* Guest profiler.                                                                                           */
+/***************************************************************/
+typedef struct {
+	uint64_t executions;	/* instructions retired at this PC */
+	uint64_t cycles;	/* cycles this PC was the oldest instruction in flight */
+	uint64_t stalls;	/* of those, cycles in which nothing retired */
+	uint32_t block;	/* index of the leader of this PC's basic block */
+	uint64_t block_executions, block_cycles, block_stalls;	/* per-block totals, valid on leaders */
+} profile_entry_t;
+
+int PROFILE_ENABLED;
+profile_entry_t *PROFILE;	/* one entry per program word */
+uint32_t PROFILE_SIZE;
+uint64_t PROFILE_OTHER_CYCLES;	/* cycles with no program instruction in flight */
+
+
+/***************************************************************/
+/* Pipeline view export in the Kanata (Konata) log format: one     */
+/* record per instruction entering a stage, stall labels and a    */
+/* retire or flush record, written through an out_buffer_t.          */
+/***************************************************************/
+#define PIPEVIEW_STAGES 5	/* F D X M W */
+#define PIPEVIEW_SLOTS 8	/* instructions in flight */
+#define PIPEVIEW_FLUSH 65536	/* write the buffer out at this size */
+
+typedef struct {
+	uint32_t seq;	/* 0 if the slot is free */
+	uint64_t id;	/* Kanata instruction id */
+	uint32_t stage;
+	uint32_t stalls;	/* cycles spent in the stage beyond the first */
+} pipeview_slot_t;
+
+int PIPEVIEW_FD = -1;	/* -1 while not exporting */
+out_buffer_t PIPEVIEW_OUT;
+pipeview_slot_t PIPEVIEW_INFLIGHT[PIPEVIEW_SLOTS];
+uint64_t PIPEVIEW_CYCLE, PIPEVIEW_LAST_CYCLE;	/* cycles since the view started; last one written */
+uint64_t PIPEVIEW_NEXT_ID, PIPEVIEW_RETIRED, PIPEVIEW_FLUSHED;
+int PIPEVIEW_REDIRECT;	/* EX redirected fetch in the previous cycle */
+
+
+/***************************************************************/
+/* Interval statistics: a row of counters every N cycles, kept in */
+/* a preallocated table and written out as CSV when it fills.       */
+/***************************************************************/
+#define INTERVAL_BUFFER_ROWS 4096
+
+typedef struct {
+	uint64_t cycle;	/* cycle count at the end of the interval */
+	uint32_t cycles, instructions, loads, stores;
+	uint32_t memory_stalls;	/* cycles MEM waited on the memory model */
+	uint32_t fetch_stalls;	/* cycles fetch waited on a SYSCALL or faulting instruction */
+	uint32_t squashed;	/* instructions flushed by redirects and interrupts */
+	uint32_t exceptions;
+	uint32_t region_accesses[NUM_MEM_REGION + 1];	/* loads and stores per MEM_REGIONS entry; last: devices and unmapped */
+} interval_row_t;
+
+uint32_t INTERVAL_CYCLES;	/* 0 while not sampling */
+uint32_t INTERVAL_LEFT;	/* cycles until the next row */
+FILE *INTERVAL_FILE;
+interval_row_t INTERVAL_ROWS[INTERVAL_BUFFER_ROWS];
+uint32_t INTERVAL_ROW_COUNT;
+interval_row_t INTERVAL_CURRENT;	/* counters of the interval in progress */
+interval_row_t INTERVAL_BASE;	/* global counters at its start */
+uint64_t FETCH_STALLS, SQUASHED_INSTRUCTIONS;
+
+
+/***************************************************************/
+/* Region of interest.  The guest marks it with the magic SYSCALL  */
+/* services SYS_ROI_BEGIN/END ($v0); with "roi on" everything     */
+/* outside it runs on the functional model and only the ROI goes  */
+/* through the pipeline.  The guest can also reset and dump the  */
+/* statistics and take a checkpoint to re-run the ROI from.           */
+/* The functional model takes branches and jumps but the pipeline   */
+/* runs them as NOPs, so the two sides of the ROI only agree on      */
+/* straight-line code; the switch warns about programs with them.  */
+/***************************************************************/
+int ROI_FAST;	/* fast-forward functionally outside the ROI */
+int ROI_OUTSIDE;	/* the next run starts by fast-forwarding */
+int ROI_WARNED;	/* the branch/jump warning was printed for this "roi on" */
+uint64_t ROI_FAST_INSTRUCTIONS;	/* executed by the functional model */
+int STATS_RESET_DONE;	/* the guest reset the statistics */
+uint32_t STATS_BASE_CYCLES, STATS_BASE_INSTRUCTIONS;	/* counts at the last reset */
+checkpoint_t ROI_CHECKPOINT;	/* taken by SYS_CHECKPOINT, page_data NULL if none */
+
+
+/***************************************************************/
+/* Fuzzing.  Random straight-line programs of the instructions  */
+/* the pipeline implements run through the pipeline and through  */
+/* functional_step from the same snapshot (registers and a data   */
+/* window addressed off $28), and the resulting states must match.  */
+/* The pipeline has no forwarding or interlocks, so an instruction */
+/* only reads registers written at least FUZZ_HAZARD_DISTANCE  */
+/* instructions earlier; the generator pads with NOPs for that.     */
+/***************************************************************/
+#define FUZZ_MAX_WORDS (MEM_PAGE_SIZE / 4)	/* one text page, padding included */
+#define FUZZ_MAX_LENGTH 200	/* instructions, at most 4 words each */
+#define FUZZ_REGS 28	/* $0..$27 are read and written */
+#define FUZZ_BASE_REG 28	/* holds MEM_DATA_BEGIN, never written */
+#define FUZZ_WINDOW 256	/* bytes reached by the loads and stores */
+#define FUZZ_HAZARD_DISTANCE 4
+#define FUZZ_HI 32	/* HI and LO after the GPRs in dependence tracking */
+#define FUZZ_LO 33
+
+typedef struct {
+	uint32_t seed, length;	/* replayed by "fuzz 1 <length> <seed>" */
+	uint32_t count;	/* words, NOPs included */
+	uint32_t words[FUZZ_MAX_WORDS];
+	CPU_State state;	/* initial registers */
+	uint8_t window[FUZZ_WINDOW];	/* initial data at MEM_DATA_BEGIN */
+} fuzz_program_t;
+
+uint32_t FUZZ_OPS[64];	/* opcode/function templates of the instructions generated */
+uint32_t FUZZ_OP_COUNT;
+
+
+/***************************************************************/
+/* Command interpreter / scripts.                                                             */
+/***************************************************************/
+#define CMD_BUFFER_SIZE 1024
+#define CMD_MAX_ARGS 16
+#define SCRIPT_MAX_DEPTH 16
+
+/* command results */
+#define CMD_OK 0
+#define CMD_ERROR 1
+#define CMD_QUIT 2
+
+/* process exit codes of a scripted (-x) run */
+#define EXIT_PASS 0
+#define EXIT_ASSERT_FAILED 1
+#define EXIT_SCRIPT_ERROR 2
+
+typedef struct {
+	char *text;
+	int argc;
+	char *argv[CMD_MAX_ARGS];
+} script_line_t;
+
+typedef struct {
+	const char *filename;
+	script_line_t *args;
+	int count;
+} script_t;
+
+int SCRIPT_MODE;	/* commands are read from a script file */
+int QUIET;	/* suppress per-cycle pipeline and loader output */
+uint32_t ASSERT_PASSED, ASSERT_FAILED;
+
+
+/***************************************************************/
+/* Program image cache.                                                                                */
+/***************************************************************/
+#define IMAGE_CACHE_SIZE 16
+
+typedef struct {
+	char path[256];
+	uint64_t dev, ino, mtime, size;	/* identity of the parsed file */
+	uint32_t *words;
+	uint32_t count;
+	char *text;	/* per-word disassembly, DISASM_TEXT_SIZE bytes each, "" until used */
+	uint64_t last_use;
+	void *mapping;	/* store file holding words and text, NULL if malloc'd */
+	size_t mapping_size;
+	int text_fd;	/* descriptor + 1 of the words, page-aligned at text_offset; 0 if none */
+	uint64_t text_offset;
+} program_image_t;
+
+program_image_t IMAGE_CACHE[IMAGE_CACHE_SIZE];
+program_image_t *CURRENT_IMAGE;	/* image of the loaded program */
+uint64_t IMAGE_CACHE_CLOCK;
+uint64_t IMAGE_CACHE_HITS, IMAGE_CACHE_MISSES;
+
+
+/***************************************************************/
+/* Content-addressed store shared by simulator processes: parsed   */
+/* and fully disassembled images (<hash>.img, mapped copy-on-write) */
+/* and memoized results of complete quiet runs (<key>.res).  Files   */
+/* are written to a temporary name and renamed into place.           */
+/***************************************************************/
+#define STORE_IMAGE_MAGIC "MUIMAGE2"
+#define STORE_RESULT_MAGIC "MURESLT1"
+#define STORE_HASH_SEED 0xcbf29ce484222325ull	/* FNV-1a offset basis and prime */
+#define STORE_HASH_PRIME 0x100000001b3ull
+#define MEMO_OFF 0	/* run not eligible or no store */
+#define MEMO_HIT 1	/* final state replayed from the store */
+#define MEMO_RECORD 2	/* run it and store the result if deterministic */
+
+typedef struct {
+	char magic[8];
+	uint64_t hash;	/* of the source file's bytes */
+	uint32_t count;	/* words from MEM_PAGE_SIZE on, zero-padded to a page, */
+	uint32_t reserved;	/* then DISASM_TEXT_SIZE bytes of text per word */
+} store_image_t;
+
+typedef struct {
+	char magic[8];
+	uint64_t key;	/* build, initial state and memory */
+	CPU_State state;	/* final architectural state */
+	uint32_t heap_break, exit_code;
+	uint32_t cycles, instructions;	/* taken by the run */
+	uint64_t syscall_counts[SYS_MAX + 1];
+	uint64_t exception_counts[EXC_NONE], handler_cycles[EXC_NONE];
+	uint64_t fetch_stalls, squashed;
+	uint32_t page_count;	/* page addresses and page data follow */
+	uint32_t output_length;	/* then console output as (fd, length, bytes) records */
+} store_result_t;
+
+char STORE_DIR[256];	/* "" while the store is off */
+uint64_t STORE_IMAGE_HITS, STORE_IMAGE_MISSES;
+uint64_t MEMO_HITS, MEMO_STORES;
+int MEMO_RECORDING;	/* capture console output of the run */
+int MEMO_TAINTED;	/* the run talked to the host or a device */
+store_result_t MEMO_BASE;	/* counters at the start of the recorded run */
+out_buffer_t MEMO_OUTPUT;
+
+
+/***************************************************************/
+/* Simulation server.                                                                                      */
+/***************************************************************/
+#define SERVER_SHUTDOWN 3	/* command result: stop serving */
+#define SERVER_MAX_MDUMP_WORDS 65536
+#define SERVER_MAX_CYCLES 100000000	/* cycles one run/sim request may simulate */
+
+uint64_t SERVER_REQUESTS;
+
+
+/***************************************************************/
+/* GDB remote stub ("gdb <port>|<socket path>").  gdb sees the   */
+/* architectural state: whenever it has stopped the pipeline, fetch  */
+/* is held and the instructions in flight retire, so CURRENT_STATE  */
+/* holds every register and PC the next instruction.  Breakpoints   */
+/* stop before their instruction is fetched; watchpoints stop after */
+/* the access, squashing the younger instructions.                            */
+/***************************************************************/
+#define GDB_PACKET_SIZE 0x4000
+#define GDB_NUM_REGS 72	/* r0-r31, sr, lo, hi, bad, cause, pc, f0-f31, fsr, fir */
+#define GDB_MAX_BREAKPOINTS 64
+#define GDB_MAX_WATCHPOINTS 16
+#define GDB_FETCH_HOLD 0xFFFFFFFF	/* SYSCALL_SEQ no instruction matches: IF stalls */
+#define GDB_POLL_CYCLES 65536	/* check for ^C this often while running */
+
+enum { GDB_WATCH_WRITE = 2, GDB_WATCH_READ = 3, GDB_WATCH_ACCESS = 4 };	/* Z packet types */
+
+typedef struct {
+	uint32_t address, length, type;
+} gdb_watch_t;
 
-char prog_file[32];
+int GDB_FD = -1;
+int GDB_NO_ACK;	/* QStartNoAckMode */
+uint8_t GDB_INPUT[GDB_PACKET_SIZE];
+uint32_t GDB_INPUT_NEXT, GDB_INPUT_LENGTH;
+uint32_t GDB_BREAKPOINTS[GDB_MAX_BREAKPOINTS];
+uint32_t GDB_BREAKPOINT_COUNT;
+gdb_watch_t GDB_WATCHPOINTS[GDB_MAX_WATCHPOINTS];
+uint32_t GDB_WATCHPOINT_COUNT;
 
 
 /***************************************************************/
@@ -90,11 +850,43 @@ void cycle();
 void run(int num_cycles);
 void runAll();
 void mdump(uint32_t start, uint32_t stop) ;
+int mem_region_index(uint32_t address, uint32_t length);
+int mdump_bin(uint32_t start, uint32_t stop, const char *filename);
+int mload(uint32_t address, const char *filename);
 void rdump();
+void account_host_time(uint64_t start_ns, uint32_t start_cycles, uint32_t start_instructions);
+void stats();
 void handle_command();
+int tokenize_command(char *line, char **argv, int max_args);
+int parse_value(const char *text, int base, uint32_t *value);
+int parse_register(const char *text, uint32_t *register_no);
+int assert_command(int argc, char **argv);
+int execute_command(int argc, char **argv);
+void quit_simulator();
+void script_error(const char *filename, int line, const char *message);
+int find_block_end(script_t *script, int first);
+void run_script_block(script_t *script, int first, int last, int depth);
+void run_script(const char *filename);
 void reset();
+void *map_region(int region, void *address);
 void init_memory();
+void clear_region(int region);
+void clear_memory();
+void reset_memory();
+void reset_region(int region);
+void mark_dirty(int region, uint32_t offset, uint32_t length);
 void load_program();
+program_image_t *load_program_image(const char *filename);
+void text_share(program_image_t *image);
+int map_text(const program_image_t *image);
+uint64_t host_time_ns();
+int server_request(FILE *out, int argc, char **argv);
+int serve_client(int fd);
+void run_server(const char *socket_path);
+void write_register(uint32_t reg, uint32_t value);
+void commit_state();
+void clear_pipeline();
+int pipeline_empty();
 void handle_pipeline(); /*IMPLEMENT THIS*/
 void WB();/*IMPLEMENT THIS*/
 void MEM();/*IMPLEMENT THIS*/
@@ -102,6 +894,174 @@ void EX();/*IMPLEMENT THIS*/
 void ID();/*IMPLEMENT THIS*/
 void IF();/*IMPLEMENT THIS*/
 void show_pipeline();/*IMPLEMENT THIS*/
+int guest_copy_in(char *buffer, uint32_t address, uint32_t length);
+int guest_copy_out(uint32_t address, const char *buffer, uint32_t length);
+int guest_string(uint32_t address, char *buffer, uint32_t size);
+void guest_output(int fd, const char *data, uint32_t length);
+void guest_flush();
+int guest_open(const char *path, uint32_t flags, uint32_t mode);
+int emulate_syscall(const CPU_State *state, uint32_t *result);
+void syscall_reset();
+int set_sandbox(const char *directory);
+void write_cop0(uint32_t reg, uint32_t value);
+uint32_t cop0_read(const CPU_State *state, uint32_t reg);
+void cop0_write(CPU_State *state, uint32_t reg, uint32_t value);
+uint32_t interrupt_lines();
+uint32_t enter_exception(CPU_State *state, uint32_t code, uint32_t pc, uint32_t badvaddr);
+void report_exception(uint32_t code, uint32_t pc, uint32_t badvaddr);
+void pipeline_exception(uint32_t code, uint32_t badvaddr, CPU_Pipeline_Reg *out);
+void squash_latch(CPU_Pipeline_Reg *latch);
+void cop0_edge();
+void load_kernel();
+int instruction_known(uint32_t instruction);
+void map_pages();
+uint32_t mmio_read(uintptr_t entry, uint32_t address);
+void mmio_write(uintptr_t entry, uint32_t address, uint32_t value);
+void mmio_reset();
+void uart_reset(mmio_device_t *device);
+int uart_fill(uart_device_t *uart);
+uint32_t uart_read(mmio_device_t *device, uint32_t offset);
+void uart_write(mmio_device_t *device, uint32_t offset, uint32_t value);
+int uart_input(const char *filename);
+void timer_reset(mmio_device_t *device);
+int timer_expired(timer_device_t *timer);
+uint32_t timer_read(mmio_device_t *device, uint32_t offset);
+void timer_write(mmio_device_t *device, uint32_t offset, uint32_t value);
+uint32_t memory_request(uint32_t pc, uint32_t address, int write);
+void dram_reset(memory_model_t *model);
+void dram_idle(memory_model_t *model);
+uint32_t dram_access(memory_model_t *model, uint32_t address, int write, uint32_t cycle);
+void dram_histogram(const char *title, const uint64_t *buckets, uint64_t count);
+void dram_report(memory_model_t *model);
+int dram_command(int argc, char **argv);
+void prefetch_reset();
+void prefetch_idle();
+int prefetch_lookup(uint32_t address, uint32_t cycle, uint32_t *ready);
+void prefetch_issue(uint32_t address);
+void next_line_reset(prefetcher_t *prefetcher);
+void next_line_observe(prefetcher_t *prefetcher, uint32_t pc, uint32_t address, int hit);
+void stride_reset(prefetcher_t *prefetcher);
+void stride_observe(prefetcher_t *prefetcher, uint32_t pc, uint32_t address, int hit);
+void stream_reset(prefetcher_t *prefetcher);
+void stream_observe(prefetcher_t *prefetcher, uint32_t pc, uint32_t address, int hit);
+void prefetch_report();
+int prefetch_command(int argc, char **argv);
+void reuse_reset(reuse_t *reuse);
+void reuse_compact(reuse_t *reuse);
+void reuse_grow_table(reuse_t *reuse);
+void reuse_access(reuse_t *reuse, uint32_t address);
+uint64_t reuse_misses(const reuse_t *reuse, uint64_t lines);
+void reuse_report();
+int reuse_curve(const char *filename);
+int reuse_command(int argc, char **argv);
+void trace_record(uint32_t address, uint32_t kind);
+void trace_flush();
+int trace_open(const char *filename);
+void trace_close();
+int trace_command(int argc, char **argv);
+int functional_step(CPU_State *state);
+int functional_retire(CPU_State *state, retire_record_t *record);
+int functional_out_of_program(const CPU_State *state);
+void pipeline_start(const CPU_State *state);
+void checkpoint_save(checkpoint_t *checkpoint, const CPU_State *state, uint64_t instructions);
+void checkpoint_restore(const checkpoint_t *checkpoint);
+void checkpoint_free(checkpoint_t *checkpoint);
+uint32_t bbv_block_id(bbv_t *bbv, uint32_t pc);
+void bbv_flush_interval(bbv_t *bbv, FILE *fp);
+int collect_bbv(uint64_t interval, const char *filename);
+uint64_t detailed_run(uint64_t count);
+int run_simpoints(const char *points_file, const char *weights_file, uint64_t interval, uint64_t warmup);
+int simpoint_command(int argc, char **argv);
+void collect_interval_results(int fd, interval_result_t **results, uint32_t *capacity);
+int run_parallel(uint64_t interval, uint32_t jobs, uint64_t warmup);
+int parallel_command(int argc, char **argv);
+uint64_t register_uses(uint32_t instruction, uint64_t *writes);
+void inorder_reset(timing_model_t *model);
+void inorder_retire(timing_model_t *model, const retire_record_t *record);
+uint64_t inorder_cycles(timing_model_t *model);
+void inorder_report(timing_model_t *model);
+void *timing_thread(void *arg);
+int run_decoupled(timing_model_t *model);
+int decoupled_command(int argc, char **argv);
+uint32_t sweep_read(sweep_t *sweep, uint32_t lane, uint32_t address);
+void sweep_write(sweep_t *sweep, uint32_t lane, uint32_t address, uint32_t value);
+int sweep_execute(sweep_t *sweep, uint32_t instruction, uint32_t pc, const uint8_t *mask);
+int run_sweep(uint32_t lanes, uint32_t reg, uint32_t start, uint32_t step, const char *filename);
+int sweep_command(int argc, char **argv);
+const char *cop0_mnemonic(uint32_t instruction);
+void disassemble(uint32_t instruction, uint32_t pc, char *buffer, int size);
+const char *disassemble_pc(uint32_t instruction, uint32_t pc);
+void out_printf(out_buffer_t *out, const char *format, ...);
+void out_append(out_buffer_t *out, const char *data, size_t length);
+void out_flush(out_buffer_t *out, int fd);
+int show_command(int argc, char **argv);
+int is_control_transfer(uint32_t instruction);
+int branch_target(uint32_t instruction, uint32_t pc, uint32_t *target);
+void profile_reset();
+void profile_cycle();
+int profile_compare_pc(const void *a, const void *b);
+int profile_compare_block(const void *a, const void *b);
+void profile_report(uint32_t max_lines);
+int profile_write_flame(const char *filename);
+int profile_command(int argc, char **argv);
+void pipeview_emit_cycle();
+void pipeview_end_stage(pipeview_slot_t *slot);
+void pipeview_cycle();
+int pipeview_open(const char *filename);
+void pipeview_close();
+int pipeview_command(int argc, char **argv);
+uint64_t exception_total();
+void interval_start();
+void interval_access(uint32_t address, int store);
+void interval_row();
+void interval_flush();
+void interval_close();
+int interval_command(int argc, char **argv);
+void stats_reset();
+void magic_syscall(const CPU_State *state, uint32_t service);
+uint32_t count_branches();
+void roi_fast_forward();
+int roi_command(int argc, char **argv);
+uint64_t fuzz_random(uint64_t *seed);
+uint32_t fuzz_value(uint64_t *seed);
+void fuzz_init_ops();
+void fuzz_generate(fuzz_program_t *program, uint32_t program_seed, uint32_t length);
+int fuzz_run_pipeline(const fuzz_program_t *program, CPU_State *state, uint8_t *window);
+int fuzz_run_functional(const fuzz_program_t *program, CPU_State *state);
+int fuzz_compare(const fuzz_program_t *program, const CPU_State *pipe, const uint8_t *pipe_window,
+	const CPU_State *ref, int pipe_fault, int ref_fault);
+int run_fuzz(uint64_t programs, uint32_t length, uint32_t seed);
+int fuzz_command(int argc, char **argv);
+int gdb_getc();
+int gdb_read_packet(char *packet, uint32_t size);
+int gdb_send(const char *data, uint32_t length);
+int gdb_send_text(const char *text);
+uint32_t gdb_hex_value(const char **text);
+uint32_t gdb_read_memory(uint32_t address, uint8_t *data, uint32_t length);
+int gdb_write_memory(uint32_t address, const uint8_t *data, uint32_t length);
+uint32_t gdb_get_register(uint32_t reg);
+void gdb_set_register(uint32_t reg, uint32_t value);
+int gdb_in_flight();
+void gdb_drain();
+int gdb_watch_hit(uint32_t *address, uint32_t *type);
+void gdb_resume(int step, char *reply);
+int gdb_breakpoint(char type, uint32_t address, uint32_t length, int insert);
+void gdb_query(const char *packet, char *reply);
+int gdb_listen(const char *where);
+int gdb_serve(int fd);
+int gdb_command(int argc, char **argv);
+uint64_t store_hash(uint64_t hash, const void *data, size_t length);
+uint64_t store_file_hash(FILE *fp);
+void *store_map(uint64_t hash, const char *suffix, size_t *size, int *fd);
+void store_write(uint64_t hash, const char *suffix, out_buffer_t *data);
+int store_image_map(program_image_t *image, uint64_t hash);
+void store_image_save(program_image_t *image, uint64_t hash);
+uint64_t memo_key();
+void memo_replay(const store_result_t *result);
+int memo_begin();
+void memo_end();
+int set_store(const char *directory);
+int store_command(int argc, char **argv);
 void initialize();
 void print_program(); /*IMPLEMENT THIS*/
 
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Check that cycles a load spends waiting on the DRAM model are charged to
+# that load as stalls in the profile, not to pipeline fill/drain.
+#
+# usage: profile-dram.sh <simulator> <program>
+set -e
+sim=$1 prog=$2
+out=$(printf 'dram open\nprofile on\nsim\nprofile report 100000\nstats\n' | "$sim" -q "$prog" 2>&1)
+
+waits=$(printf '%s\n' "$out" | awk -F'\t: ' '/^MEM stall cycles/{print $2}')
+other=$(printf '%s\n' "$out" | sed -n 's/^Profile: .*, \([0-9]*\) fill\/drain cycles$/\1/p')
+stalls=$(printf '%s\n' "$out" | awk '/^\[PC\]/{t=1;next} /^---/{t=0} t&&/^0x/{s+=$5} END{print s+0}')
+
+echo "$(basename "$prog"): $waits MEM wait cycles, $stalls profiled stalls, $other fill/drain cycles"
+if [ -z "$waits" ] || [ "$waits" -eq 0 ]; then
+	echo "FAIL: the DRAM model caused no MEM waits"; exit 1
+fi
+if [ "$stalls" -lt "$waits" ]; then
+	echo "FAIL: MEM waits are missing from the Stalls column"; exit 1
+fi
+# only the cycles before the first instruction reaches WB and after the last
+if [ "$other" -gt 5 ]; then
+	echo "FAIL: MEM waits were booked as fill/drain"; exit 1
+fi
+echo PASS
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Check script mode's exit codes: 0 when every assert passes, 1 when an
+# assert fails, 2 when the script itself is broken (unknown command,
+# unterminated repeat, a load or dump that fails).
+#
+# usage: script-exit.sh <simulator> <program>
+sim=$1 prog=$2
+script=$(mktemp)
+dump=$(mktemp)
+trap 'rm -f "$script" "$dump"' EXIT
+status=0
+
+# expect <exit code> <description> <script lines...>
+expect() {
+	want=$1 what=$2
+	shift 2
+	printf '%s\n' "$@" > "$script"
+	"$sim" "$prog" -q -x "$script" > /dev/null 2>&1
+	got=$?
+	if [ "$got" -ne "$want" ]; then
+		echo "FAIL: $what: exit $got, expected $want"; status=1
+	fi
+}
+
+expect 0 "passing assert" 'assert pc 0x00400000' 'assert r0 0'
+expect 1 "failing assert" 'assert pc 0x00400004'
+expect 2 "unknown command" 'frobnicate'
+expect 2 "unterminated repeat" 'repeat 2' 'run 1'
+expect 2 "failing mload" 'mload 0x10010000 /nonexistent/mload.bin'
+expect 2 "failing mdump-bin" "mdump-bin 0x10000000 0x10000010 $dump"
+
+[ "$status" -eq 0 ] && echo "$(basename "$prog"): script exit codes PASS"
+exit $status